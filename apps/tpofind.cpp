@@ -7,12 +7,23 @@
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
 #include <boost/program_options.hpp>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <opencv2/highgui/highgui.hpp>
+#include <thread>
 
-#include "tpofinder/configure.h"
+#include "tpofinder/defaults.h"
 #include "tpofinder/detect.h"
+#include "tpofinder/match.h"
+#include "tpofinder/parallel.h"
+#include "tpofinder/persist.h"
 #include "tpofinder/provide.h"
+#include "tpofinder/report.h"
 #include "tpofinder/visualize.h"
 
 using namespace cv;
@@ -24,12 +35,94 @@ const string NAME = "tpofind";
 
 bool verbose = false;
 bool webcam = false;
+string frames = "latest";
+string video;
+size_t stride = 1;
+size_t startFrame = 0;
+bool cache = true;
+bool compact = false;
+unsigned threads = 0;
+unsigned pipeline = 0;
+unsigned decodeThreads = 0;
+size_t decodeMemory = 256;
+bool gray = false;
+double maxMegapixels = 0;
+string matcher = "lsh";
+MatchConfig matching;
+string packedPath;
+string packPath;
+string indexPath;
+bool headless = false;
+bool profile = false;
+string output;
+string format = "json";
+ReportFormat reportFormat = JSON_LINES;
+/** Receives a record of every image, if any. */
+ostream* records = NULL;
 vector<string> files;
 
 void processCommandLine(int argc, char* argv[]) {
     po::options_description named_opts;
     named_opts.add_options()
             ("webcam,w", "Read images from webcam.")
+            ("frames", po::value<string>(&frames),
+                "Webcam frames to process: latest (default; skip frames that\n"
+                "arrive while busy), all (capture waits for detection) or queue\n"
+                "(keep the last few frames).")
+            ("no-cache", "Do not use or write binary model caches.")
+            ("compact", "Merge features that several views of a model share.")
+            ("threads,j", po::value<unsigned>(&threads),
+                "Number of threads for loading models and verifying detections\n"
+                "(default: all cores).")
+            ("pipeline", po::value<unsigned>(&pipeline)->implicit_value(2),
+                "Read, describe, detect and draw images concurrently in a\n"
+                "pipeline, using the given number of threads each for describing\n"
+                "and for detecting (default: 2). Images are shown in order.")
+            ("video", po::value<string>(&video),
+                "Read images from a video file, or from image files given by a\n"
+                "pattern such as frame-%04d.jpg.")
+            ("stride", po::value<size_t>(&stride),
+                "Process only every n-th frame of the video.")
+            ("start", po::value<size_t>(&startFrame),
+                "Start at this frame of the video.")
+            ("decode-threads", po::value<unsigned>(&decodeThreads),
+                "Decode image files ahead on this many threads.")
+            ("decode-memory", po::value<size_t>(&decodeMemory),
+                "Megabytes of images to decode ahead at most (default: 256).")
+            ("gray", "Decode image files directly into gray images.")
+            ("max-megapixels", po::value<double>(&maxMegapixels),
+                "Reduce larger image files by a factor of 2, 4 or 8 while\n"
+                "decoding.")
+            ("matcher", po::value<string>(&matcher),
+                "Descriptor matcher: lsh (approximate, default), hamming (exact\n"
+                "brute force) or mih (exact multi-index hashing).")
+            ("ratio", po::value<float>(&matching.maxRatio),
+                "Discard matches whose distance is not below this ratio of the\n"
+                "distance to the second-nearest neighbour (e.g. 0.8).")
+            ("cross-check", "Keep only mutual nearest neighbours.")
+            ("min-support", po::value<int>(&matching.minSupport),
+                "Minimum number of matches for verifying a model.")
+            ("shortlist", po::value<int>(&matching.shortlist),
+                "Match each image only against this number of models that are\n"
+                "most similar to it by their visual words.")
+            ("modelbase,m", po::value<string>(&packedPath),
+                "Map the models from a packed modelbase file.")
+            ("pack", po::value<string>(&packPath),
+                "Write the models into a packed modelbase file and exit.")
+            ("index", po::value<string>(&indexPath),
+                "Restore the trained matcher index from this file, or train the\n"
+                "matcher and write its index there (default with --modelbase:\n"
+                "the modelbase file with suffix .index; --matcher mih only).")
+            ("headless", "Do not show any images; write a record of every\n"
+                "image to standard output instead, unless --output is given.")
+            ("output,o", po::value<string>(&output),
+                "Write a record of every image with its detections and timings\n"
+                "to this file (- for standard output).")
+            ("format", po::value<string>(&format),
+                "Format of the records: json (default; one JSON object per line)\n"
+                "or csv (one row per detection).")
+            ("profile", "Print latency percentiles of every stage of detection\n"
+                "at exit.")
             ("verbose,v", "Display verbose messages.")
             ("help,h", "Print help message.");
 
@@ -53,6 +146,12 @@ void processCommandLine(int argc, char* argv[]) {
 
     webcam = vm.count("webcam") > 0;
     verbose = vm.count("verbose") > 0;
+    cache = vm.count("no-cache") == 0;
+    compact = vm.count("compact") > 0;
+    gray = vm.count("gray") > 0;
+    headless = vm.count("headless") > 0;
+    profile = vm.count("profile") > 0;
+    matching.crossCheck = vm.count("cross-check") > 0;
 
     if (vm.count("help")) {
         cout << "Usage: tpofind [OPTIONS] image ..." << endl;
@@ -61,93 +160,377 @@ void processCommandLine(int argc, char* argv[]) {
     }
 }
 
-void loadModel(Modelbase& modelbase, const string& path) {
+/** Where messages go; standard error if the records are written to standard
+ * output. */
+ostream& console() {
+    return records == &cout ? cerr : cout;
+}
+
+double now() {
+    return chrono::duration<double>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void loadModels(Modelbase& modelbase,
+        const vector<boost::filesystem::path>& paths) {
     if (verbose) {
-        cout << boost::format("Loading object %-20s ... ") % path;
+        console() << boost::format("Loading %2d objects on %2d threads   ... ")
+                % paths.size() % (threads > 0 ? threads : defaultThreads());
     }
-    modelbase.add(path);
+    modelbase.addAll(paths, threads);
     if (verbose) {
-        cout << "[DONE]" << endl;
+        console() << "[DONE]" << endl;
+    }
+}
+
+/** An image on its way from the provider to the screen or the records. */
+struct Frame {
+
+    Frame() : reduction(1) {
     }
+
+    Mat image;
+    /** By which factor the image has been reduced while decoding. */
+    int reduction;
+    Scene scene;
+    vector<Detection> detections;
+    /** Number, file, error and timings of the image. */
+    FrameReport report;
+    DetectionStats stats;
+};
+
+/** Takes the next image from the provider; returns false if there is none.
+ * The decoding time is the time spent waiting for the provider. */
+bool readFrame(ImageProvider& provider, size_t number, Frame& frame) {
+    double start = now();
+    if (!provider.next(frame.image)) {
+        return false;
+    }
+    frame.reduction = provider.last_reduction();
+    frame.report.frame = number;
+    frame.report.file = provider.last_file();
+    frame.report.error = provider.last_error();
+    frame.report.decodeTime = now() - start;
+    return true;
+}
+
+void describeFrame(const Detector& detector, DetectionContext& context,
+        Frame& frame) {
+    double start = now();
+    frame.scene = detector.describe(frame.image, context);
+    frame.report.describeTime = now() - start;
+    frame.stats = context.stats();
 }
 
-void processImage(Detector& detector, Mat &image) {
-    if (!image.empty()) {
-        cout << "Detecting objects on image          ... ";
-        Scene scene = detector.describe(image);
-        vector<Detection> detections = detector.detect(scene);
-        cout << "[DONE]" << endl;
+void detectFrame(const Detector& detector, DetectionContext& context,
+        Frame& frame) {
+    double start = now();
+    frame.detections = detector.detect(frame.scene, context);
+    frame.report.detectTime = now() - start;
+    // The scene may have been described with another context.
+    DetectionStats stats = context.stats();
+    stats.keypointTime = frame.stats.keypointTime;
+    stats.extractTime = frame.stats.extractTime;
+    stats.keypoints = frame.stats.keypoints;
+    frame.stats = stats;
+}
 
-        BOOST_FOREACH(Detection d, detections) {
-            drawDetection(image, d);
+/** Draws and shows the detections unless headless, and writes the record of
+ * the frame. Homographies in the record refer to the original image, even if
+ * it has been reduced while decoding. */
+void finishFrame(Frame& frame) {
+    if (frame.image.empty()) {
+        if (!frame.report.error.empty()) {
+            cerr << frame.report.error << endl;
         }
+    } else if (!headless) {
+        console() << "Detected objects on image           ... [DONE]" << endl;
+        if (verbose) {
+            console() << boost::format("%5d keypoints, %5d matches, %2d models "
+                    "verified in %5d samples") % frame.stats.keypoints
+                    % frame.stats.matches % frame.stats.candidates
+                    % frame.stats.iterations << endl;
+        }
+
+        BOOST_FOREACH(const Detection& d, frame.detections) {
+            drawDetection(frame.image, d);
+        }
+        imshow(NAME, frame.image);
+    }
+
+    if (records) {
+        if (frame.reduction != 1) {
+            scaleDetections(frame.detections, frame.reduction);
+        }
+        writeReport(*records, reportFormat, frame.report, frame.detections);
+        records->flush();
     }
 }
 
+/** First error of any stage of the pipeline. */
+struct PipelineError {
+
+    void set() {
+        lock_guard<mutex> lock(mutex_);
+        if (!error) {
+            error = current_exception();
+        }
+    }
+
+    exception_ptr error;
+
+private:
+    mutex mutex_;
+};
+
+/** Starts the given number of threads that take frames from one queue,
+ * process them with their own detection context and hand them on to the
+ * next queue, which is closed once all of them are done. An error closes
+ * both queues, such that all stages stop. */
+void runStage(vector<thread>& stages, unsigned n, OrderedQueue<Frame>& in,
+        OrderedQueue<Frame>& out, PipelineError& error,
+        const function<void(Frame&, DetectionContext&)>& body) {
+    shared_ptr<atomic<unsigned> > running = make_shared<atomic<unsigned> >(n);
+    for (unsigned t = 0; t < n; t++) {
+        stages.push_back(thread([&in, &out, &error, running, body]() {
+            DetectionContext context;
+            try {
+                size_t number;
+                Frame frame;
+                while (in.pop(number, frame)) {
+                    if (!frame.image.empty()) {
+                        body(frame, context);
+                    }
+                    if (!out.push(number, move(frame))) {
+                        break;
+                    }
+                }
+            } catch (...) {
+                error.set();
+                in.close();
+                out.close();
+            }
+            if (--*running == 0) {
+                out.close();
+            }
+        }));
+    }
+}
+
+/** Reads images on one thread, describes and detects on the given number of
+ * threads each and draws or records the detections on the calling thread.
+ * Every stage is fed by a bounded queue, so that throughput is limited by the
+ * slowest stage while only a few frames are in flight. Returns the last
+ * image. */
+Mat processPipeline(const Detector& detector, ImageProvider& provider,
+        unsigned workers) {
+    const size_t capacity = 2 * workers;
+    OrderedQueue<Frame> decoded(capacity), described(capacity), detected(capacity);
+    PipelineError error;
+    vector<thread> stages;
+
+    stages.push_back(thread([&]() {
+        try {
+            Frame frame;
+            for (size_t number = 0; readFrame(provider, number, frame); number++) {
+                if (!decoded.push(number, move(frame))) {
+                    break;
+                }
+                frame = Frame();
+            }
+        } catch (...) {
+            error.set();
+        }
+        decoded.close();
+    }));
+    runStage(stages, workers, decoded, described, error,
+            [&](Frame& frame, DetectionContext& context) {
+                describeFrame(detector, context, frame);
+            });
+    runStage(stages, workers, described, detected, error,
+            [&](Frame& frame, DetectionContext& context) {
+                detectFrame(detector, context, frame);
+            });
+
+    Mat last;
+    try {
+        size_t number;
+        Frame frame;
+        while (detected.pop(number, frame)) {
+            finishFrame(frame);
+            if (!frame.image.empty()) {
+                last = frame.image;
+            }
+        }
+    } catch (...) {
+        error.set();
+        decoded.close();
+        described.close();
+        detected.close();
+    }
+
+    for (size_t t = 0; t < stages.size(); t++) {
+        stages[t].join();
+    }
+    if (error.error) {
+        rethrow_exception(error.error);
+    }
+    return last;
+}
+
 int main(int argc, char* argv[]) {
     processCommandLine(argc, argv);
 
-    cvStartWindowThread();
-    namedWindow(NAME, CV_WINDOW_NORMAL | CV_WINDOW_KEEPRATIO);
+    if (format == "json") {
+        reportFormat = JSON_LINES;
+    } else if (format == "csv") {
+        reportFormat = CSV;
+    } else {
+        cerr << "Unknown record format: " << format << endl;
+        return 1;
+    }
+    ofstream outputFile;
+    if (output == "-" || (output.empty() && headless)) {
+        records = &cout;
+    } else if (!output.empty()) {
+        outputFile.open(output.c_str());
+        if (!outputFile) {
+            cerr << "Cannot write records to " << output << endl;
+            return 1;
+        }
+        records = &outputFile;
+    }
 
-    // TODO: remove duplication
     // TODO: support SIFT
     // TODO: make customizable
-    Ptr<FeatureDetector> fd = new OrbFeatureDetector(1000, 1.2, 8);
-    Ptr<FeatureDetector> trainFd = new OrbFeatureDetector(250, 1.2, 8);
-    Ptr<DescriptorExtractor> de = new OrbDescriptorExtractor(1000, 1.2, 8);
+    Ptr<DescriptorMatcher> dm = createMatcher(matcher);
+    if (dm.empty()) {
+        cerr << "Unknown matcher: " << matcher << endl;
+        return 1;
+    }
+
+    Feature trainFeature = modelFeature(dm);
 
-    Ptr<flann::IndexParams> indexParams = new flann::LshIndexParams(15, 12, 2);
-    Ptr<DescriptorMatcher> dm = new FlannBasedMatcher(indexParams);
+    Modelbase modelbase(trainFeature, cache);
+
+    if (!packedPath.empty()) {
+        modelbase = mapPackedModelbase(packedPath, trainFeature);
+    } else {
+        loadModels(modelbase, defaultModelPaths());
 
-    Feature trainFeature(trainFd, de, dm);
+        if (compact) {
+
+            BOOST_FOREACH(PlanarModel& m, modelbase.models) {
+                m.compact();
+            }
+        }
+    }
 
-    Modelbase modelbase(trainFeature);
+    if (!packPath.empty()) {
+        writePackedModelbase(packPath, modelbase, trainFeature);
+        return 0;
+    }
 
-    loadModel(modelbase, PROJECT_BINARY_DIR + "/data/adapter");
-    loadModel(modelbase, PROJECT_BINARY_DIR + "/data/blokus");
-    loadModel(modelbase, PROJECT_BINARY_DIR + "/data/stockholm");
-    loadModel(modelbase, PROJECT_BINARY_DIR + "/data/taco");
-    loadModel(modelbase, PROJECT_BINARY_DIR + "/data/tea");
+    Feature feature = sceneFeature(dm);
+    Ptr<DetectionFilter> filter = createDefaultFilter();
 
-    Feature feature(fd, de, dm);
+    // Only some matchers can store their index; an index file is of no use
+    // to the others.
+    bool persistent = dynamic_cast<PersistentIndex*> (dm.obj) != NULL;
+    if (!indexPath.empty() && !persistent) {
+        cerr << "Matcher " << matcher << " cannot store its index" << endl;
+        return 1;
+    }
+    if (indexPath.empty() && !packedPath.empty() && cache && persistent) {
+        indexPath = packedPath + ".index";
+    }
 
-    Ptr<DetectionFilter> filter = new AndFilter(
-            Ptr<DetectionFilter> (new EigenvalueFilter(-1, 4.0)),
-            Ptr<DetectionFilter> (new InliersRatioFilter(0.30)));
+    Detector detector(modelbase, feature, filter, 3.0, threads, matching,
+            indexPath);
 
-    Detector detector(modelbase, feature, filter);
+    if (!headless) {
+        cvStartWindowThread();
+        namedWindow(NAME, CV_WINDOW_NORMAL | CV_WINDOW_KEEPRATIO);
+    }
 
+    DecodeOptions decoding(gray, (int) (maxMegapixels * 1e6));
     ImageProvider *image_provider;
+    WebcamImageProvider *webcam_provider = NULL;
     if (webcam) {
-        image_provider = new WebcamImageProvider();
+        FrameBuffer::Policy policy;
+        if (frames == "latest") {
+            policy = FrameBuffer::LATEST;
+        } else if (frames == "all") {
+            policy = FrameBuffer::NEVER_DROP;
+        } else if (frames == "queue") {
+            policy = FrameBuffer::QUEUE;
+        } else {
+            cerr << "Unknown frame policy: " << frames << endl;
+            return 1;
+        }
+        image_provider = webcam_provider = new WebcamImageProvider(0, policy);
+    } else if (!video.empty()) {
+        image_provider = new VideoFileImageProvider(video, stride, startFrame,
+                decoding);
+    } else if (decodeThreads > 0 && files.size() > 0) {
+        image_provider = new PrefetchImageProvider(files, decodeThreads,
+                decodeMemory << 20, decoding);
+    } else if (decodeThreads > 0) {
+        image_provider = new PrefetchImageProvider(cin, decodeThreads,
+                decodeMemory << 20, decoding);
     } else if (files.size() > 0) {
-        image_provider = new ListFilenameImageProvider(files);
+        image_provider = new ListFilenameImageProvider(files, decoding);
     } else {
-        image_provider = new StdinFilenameImageProvider();
+        image_provider = new StdinFilenameImageProvider(decoding);
+    }
+
+    if (records) {
+        writeReportHeader(*records, reportFormat);
     }
 
     Mat image;
-    while (image_provider->next(image)) {
-        processImage(detector, image);
-        if (!image.empty()) {
-            imshow(NAME, image);
+    if (pipeline > 0) {
+        image = processPipeline(detector, *image_provider, pipeline);
+    } else {
+        DetectionContext context;
+        Frame frame;
+        for (size_t number = 0; readFrame(*image_provider, number, frame); number++) {
+            if (!frame.image.empty()) {
+                describeFrame(detector, context, frame);
+                detectFrame(detector, context, frame);
+            }
+            finishFrame(frame);
+            if (!frame.image.empty()) {
+                image = frame.image;
+            }
+            frame = Frame();
         }
     }
 
+    if (verbose && webcam_provider) {
+        console() << boost::format("Dropped %5d webcam frames          ... [DONE]")
+                % webcam_provider->dropped() << endl;
+    }
+
     delete image_provider;
 
     if (verbose) {
-        cout << "No more images to process           ... [DONE]" << endl;
+        console() << "No more images to process           ... [DONE]" << endl;
     }
 
-    cout << "Waiting for key (win) or CTRL+C     ... [DONE]" << endl;
-    while (waitKey(10) == -1) {
-        imshow(NAME, image);
+    if (profile) {
+        writeProfile(console(), detector.profile());
+    }
+
+    if (!headless) {
+        console() << "Waiting for key (win) or CTRL+C     ... [DONE]" << endl;
+        while (waitKey(10) == -1) {
+            imshow(NAME, image);
+        }
     }
 
     if (verbose) {
-        cout << "Quitting                            ... [DONE]" << endl;
+        console() << "Quitting                            ... [DONE]" << endl;
     }
 
     return 0;
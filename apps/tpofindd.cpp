@@ -0,0 +1,155 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include <boost/program_options.hpp>
+#include <csignal>
+#include <iostream>
+#include <pthread.h>
+#include <thread>
+
+#include "tpofinder/defaults.h"
+#include "tpofinder/detect.h"
+#include "tpofinder/match.h"
+#include "tpofinder/persist.h"
+#include "tpofinder/report.h"
+#include "tpofinder/serve.h"
+
+using namespace cv;
+using namespace tpofinder;
+using namespace std;
+namespace po = boost::program_options;
+
+string socketPath = "/tmp/tpofind.sock";
+bool cache = true;
+unsigned threads = 0;
+string matcher = "lsh";
+MatchConfig matching;
+ServerConfig serving;
+string packedPath;
+string indexPath;
+bool verbose = false;
+
+void processCommandLine(int argc, char* argv[]) {
+    po::options_description named_opts;
+    named_opts.add_options()
+            ("socket,s", po::value<string>(&socketPath),
+                "Listen on this Unix domain socket (default: /tmp/tpofind.sock).")
+            ("workers", po::value<unsigned>(&serving.workers),
+                "Number of threads that detect objects (default: 1).")
+            ("batch", po::value<size_t>(&serving.maxBatch),
+                "Detect up to this many waiting requests together (default: 8).")
+            ("queue", po::value<size_t>(&serving.maxQueue),
+                "Reject requests while this many are waiting (default: 64).")
+            ("no-cache", "Do not use or write binary model caches.")
+            ("threads,j", po::value<unsigned>(&threads),
+                "Number of threads for loading models and verifying detections\n"
+                "(default: all cores).")
+            ("matcher", po::value<string>(&matcher),
+                "Descriptor matcher: lsh (approximate, default), hamming (exact\n"
+                "brute force) or mih (exact multi-index hashing).")
+            ("ratio", po::value<float>(&matching.maxRatio),
+                "Discard matches whose distance is not below this ratio of the\n"
+                "distance to the second-nearest neighbour (e.g. 0.8).")
+            ("cross-check", "Keep only mutual nearest neighbours.")
+            ("min-support", po::value<int>(&matching.minSupport),
+                "Minimum number of matches for verifying a model.")
+            ("shortlist", po::value<int>(&matching.shortlist),
+                "Match each image only against this number of models that are\n"
+                "most similar to it by their visual words.")
+            ("modelbase,m", po::value<string>(&packedPath),
+                "Map the models from a packed modelbase file.")
+            ("index", po::value<string>(&indexPath),
+                "Restore the trained matcher index from this file, or train the\n"
+                "matcher and write its index there (see tpofind).")
+            ("verbose,v", "Display verbose messages.")
+            ("help,h", "Print help message.");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, named_opts), vm);
+    po::notify(vm);
+
+    verbose = vm.count("verbose") > 0;
+    cache = vm.count("no-cache") == 0;
+    matching.crossCheck = vm.count("cross-check") > 0;
+
+    if (vm.count("help")) {
+        cout << "Usage: tpofindd [OPTIONS]" << endl;
+        cout << named_opts << endl;
+        exit(0);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    processCommandLine(argc, argv);
+
+    // Signals are taken by sigwait below, not by any of the server threads.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, 0);
+
+    // The same features as tpofind, such that model caches are shared.
+    Ptr<DescriptorMatcher> dm = createMatcher(matcher);
+    if (dm.empty()) {
+        cerr << "Unknown matcher: " << matcher << endl;
+        return 1;
+    }
+
+    Feature trainFeature = modelFeature(dm);
+    Modelbase modelbase(trainFeature, cache);
+
+    if (verbose) {
+        cout << "Loading models                      ... " << flush;
+    }
+    if (!packedPath.empty()) {
+        modelbase = mapPackedModelbase(packedPath, trainFeature);
+    } else {
+        modelbase.addAll(defaultModelPaths(), threads);
+    }
+    if (verbose) {
+        cout << "[DONE]" << endl;
+    }
+
+    // Only some matchers can store their index; an index file is of no use
+    // to the others.
+    bool persistent = dynamic_cast<PersistentIndex*> (dm.obj) != NULL;
+    if (!indexPath.empty() && !persistent) {
+        cerr << "Matcher " << matcher << " cannot store its index" << endl;
+        return 1;
+    }
+    if (indexPath.empty() && !packedPath.empty() && cache && persistent) {
+        indexPath = packedPath + ".index";
+    }
+
+    Detector detector(modelbase, sceneFeature(dm), createDefaultFilter(), 3.0,
+            threads, matching, indexPath);
+
+    DetectionServer server(detector, socketPath, serving);
+    thread stopper([&server, &signals]() {
+        int signal;
+        sigwait(&signals, &signal);
+        server.stop();
+    });
+
+    if (verbose) {
+        cout << "Serving on " << socketPath << endl;
+    }
+    server.run();
+
+    // The stopper refers to the server; wake it up, if no signal has yet,
+    // and wait for it before the server goes away.
+    pthread_kill(stopper.native_handle(), SIGTERM);
+    stopper.join();
+
+    if (verbose) {
+        ServerStats stats = server.stats();
+        cout << "Served " << stats.requests << " images in " << stats.batches
+                << " batches" << endl;
+        writeProfile(cout, detector.profile());
+    }
+    return 0;
+}
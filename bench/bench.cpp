@@ -0,0 +1,195 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "bench.h"
+#include "tpofinder/configure.h"
+
+#include <algorithm>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <opencv2/highgui/highgui.hpp>
+#include <stdexcept>
+#include <utility>
+
+using namespace cv;
+using namespace tpofinder;
+using namespace std;
+namespace po = boost::program_options;
+
+/** non-public interface */
+namespace {
+
+    struct Result {
+        string name;
+        size_t iterations;
+        /** Per operation, over all repetitions. */
+        double median;
+        double minimum;
+        double maximum;
+        double items;
+    };
+
+    vector<pair<string, BenchmarkFunction> >& benchmarks() {
+        static vector<pair<string, BenchmarkFunction> > registered;
+        return registered;
+    }
+
+    /** Runs a benchmark with the given number of iterations and returns the
+     * state after the run. */
+    State runOnce(BenchmarkFunction function, size_t iterations) {
+        State state(iterations);
+        function(state);
+        if (state.seconds() == 0 && iterations > 0) {
+            throw runtime_error("benchmark does not loop over State::next()");
+        }
+        return state;
+    }
+
+    Result run(const string& name, BenchmarkFunction function, double minTime,
+            int repetitions) {
+        // Grow the number of iterations until a run takes long enough.
+        size_t iterations = 1;
+        State state = runOnce(function, iterations);
+        while (state.seconds() < minTime) {
+            double factor = state.seconds() > 0 ? 1.4 * minTime / state.seconds() : 10;
+            iterations = max(iterations + 1,
+                    (size_t) (iterations * min(factor, 10.0)));
+            state = runOnce(function, iterations);
+        }
+
+        vector<double> times(1, state.seconds() / iterations);
+        for (int r = 1; r < repetitions; r++) {
+            times.push_back(runOnce(function, iterations).seconds() / iterations);
+        }
+        sort(times.begin(), times.end());
+
+        Result result;
+        result.name = name;
+        result.iterations = iterations;
+        result.median = times[times.size() / 2];
+        result.minimum = times.front();
+        result.maximum = times.back();
+        result.items = state.items();
+        return result;
+    }
+
+    void write(ostream& out, const string& format, const Result& r) {
+        double nanos = 1e9 * r.median;
+        double itemsPerSecond = r.items / r.median;
+        if (format == "json") {
+            out << boost::format("{\"name\":\"%s\",\"iterations\":%d,"
+                    "\"ns_per_op\":%.1f,\"min_ns_per_op\":%.1f,"
+                    "\"max_ns_per_op\":%.1f,\"items_per_second\":%.1f}")
+                    % r.name % r.iterations % nanos % (1e9 * r.minimum)
+                    % (1e9 * r.maximum) % itemsPerSecond << endl;
+        } else if (format == "csv") {
+            out << boost::format("%s,%d,%.1f,%.1f,%.1f,%.1f") % r.name
+                    % r.iterations % nanos % (1e9 * r.minimum)
+                    % (1e9 * r.maximum) % itemsPerSecond << endl;
+        } else {
+            out << boost::format("%-32s %10d %14.0f %14.0f") % r.name
+                    % r.iterations % nanos % itemsPerSecond << endl;
+        }
+    }
+
+    void writeHeader(ostream& out, const string& format) {
+        if (format == "csv") {
+            out << "name,iterations,ns_per_op,min_ns_per_op,max_ns_per_op,"
+                    "items_per_second" << endl;
+        } else if (format == "table") {
+            out << boost::format("%-32s %10s %14s %14s") % "benchmark"
+                    % "iterations" % "ns/op" % "items/s" << endl;
+        }
+    }
+
+}
+
+bool registerBenchmark(const char* name, BenchmarkFunction function) {
+    benchmarks().push_back(make_pair(string(name), function));
+    return true;
+}
+
+const Modelbase& shippedModels() {
+    static Modelbase models;
+    if (models.models.empty()) {
+        models.add(PROJECT_BINARY_DIR + "/data/adapter");
+        models.add(PROJECT_BINARY_DIR + "/data/blokus");
+        models.add(PROJECT_BINARY_DIR + "/data/stockholm");
+        models.add(PROJECT_BINARY_DIR + "/data/taco");
+        models.add(PROJECT_BINARY_DIR + "/data/tea");
+    }
+    return models;
+}
+
+const vector<Mat>& testScenes() {
+    static vector<Mat> scenes;
+    if (scenes.empty()) {
+        scenes.push_back(imread(PROJECT_BINARY_DIR + "/data/test/scene-blokus-taco-1.png"));
+        scenes.push_back(imread(PROJECT_BINARY_DIR + "/data/test/scene-blokus-taco-2.png"));
+        for (size_t i = 0; i < scenes.size(); i++) {
+            CV_Assert(!scenes[i].empty());
+        }
+    }
+    return scenes;
+}
+
+int main(int argc, char* argv[]) {
+    string filter;
+    string format = "table";
+    double minTime = 0.5;
+    int repetitions = 3;
+
+    po::options_description options;
+    options.add_options()
+            ("filter", po::value<string>(&filter),
+                "Run only the benchmarks whose name contains this string.")
+            ("format", po::value<string>(&format),
+                "Output format: table (default), json (one object per line) or\n"
+                "csv.")
+            ("min-time", po::value<double>(&minTime),
+                "Minimum seconds per run (default: 0.5).")
+            ("repetitions", po::value<int>(&repetitions),
+                "Number of runs; the median is reported (default: 3).")
+            ("list", "List the benchmarks and exit.")
+            ("help,h", "Print help message.");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, options), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << "Usage: bench [OPTIONS]" << endl;
+        cout << options << endl;
+        return 0;
+    }
+    if (format != "table" && format != "json" && format != "csv") {
+        cerr << "Unknown format: " << format << endl;
+        return 1;
+    }
+
+    vector<pair<string, BenchmarkFunction> > selected;
+    for (size_t i = 0; i < benchmarks().size(); i++) {
+        if (benchmarks()[i].first.find(filter) != string::npos) {
+            selected.push_back(benchmarks()[i]);
+        }
+    }
+    sort(selected.begin(), selected.end());
+
+    if (vm.count("list")) {
+        for (size_t i = 0; i < selected.size(); i++) {
+            cout << selected[i].first << endl;
+        }
+        return 0;
+    }
+
+    writeHeader(cout, format);
+    for (size_t i = 0; i < selected.size(); i++) {
+        write(cout, format, run(selected[i].first, selected[i].second, minTime,
+                max(1, repetitions)));
+    }
+    return 0;
+}
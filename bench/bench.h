@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#ifndef BENCH_H
+#define	BENCH_H
+
+#include "tpofinder/detect.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+/** A minimal microbenchmark harness. A benchmark is a function that runs its
+ * operation while State::next() returns true; setup before the loop is not
+ * timed. The runner chooses the number of iterations such that a run takes
+ * a minimum time, repeats the run and reports the median time per operation.
+ *
+ *   BENCHMARK(name) {
+ *       ... setup ...
+ *       while (state.next()) {
+ *           ... operation ...
+ *       }
+ *   }
+ */
+
+class State {
+public:
+
+    explicit State(size_t iterations) :
+    /*       */ iterations_(iterations), remaining_(iterations), items_(0),
+    /*       */ seconds_(0), started_(false) {
+    }
+
+    /** Returns whether to run the operation once more. */
+    bool next() {
+        if (!started_) {
+            started_ = true;
+            start_ = std::chrono::steady_clock::now();
+        }
+        if (remaining_ > 0) {
+            remaining_--;
+            return true;
+        }
+        seconds_ = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start_).count();
+        return false;
+    }
+
+    /** Sets the number of items (e.g. keypoints or descriptors) one operation
+     * processes, for reporting items per second. */
+    void setItems(double itemsPerOperation) {
+        items_ = itemsPerOperation;
+    }
+
+    size_t iterations() const {
+        return iterations_;
+    }
+
+    double items() const {
+        return items_;
+    }
+
+    /** Time of the loop in seconds. */
+    double seconds() const {
+        return seconds_;
+    }
+
+private:
+
+    size_t iterations_;
+    size_t remaining_;
+    double items_;
+    double seconds_;
+    bool started_;
+    std::chrono::steady_clock::time_point start_;
+
+};
+
+typedef void (*BenchmarkFunction)(State&);
+
+/** Adds a benchmark to those run by main; used by BENCHMARK. */
+bool registerBenchmark(const char* name, BenchmarkFunction function);
+
+#define BENCHMARK(name) \
+    void benchmark_##name(State& state); \
+    static const bool registered_##name = registerBenchmark(#name, benchmark_##name); \
+    void benchmark_##name(State& state)
+
+/** Keeps the compiler from optimizing away the computation of a value. */
+template <typename T>
+inline void doNotOptimize(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+/** The shipped models in data/, loaded once with the default feature. */
+const tpofinder::Modelbase& shippedModels();
+
+/** The scenes in data/test, loaded once. */
+const std::vector<cv::Mat>& testScenes();
+
+#endif
@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "bench.h"
+#include "tpofinder/detect.h"
+#include "tpofinder/estimate.h"
+#include "tpofinder/match.h"
+
+#include <algorithm>
+#include <boost/foreach.hpp>
+
+using namespace cv;
+using namespace tpofinder;
+using namespace std;
+
+/** non-public interface */
+namespace {
+
+    /** The descriptors of all shipped models, as a matcher is trained on
+     * them. */
+    vector<Mat> modelDescriptors() {
+        vector<Mat> descriptors;
+
+        BOOST_FOREACH(const PlanarModel& m, shippedModels().models) {
+            descriptors.push_back(m.allDescriptors);
+        }
+        return descriptors;
+    }
+
+    /** Queries the trained matcher with the descriptors of the first scene
+     * for two nearest neighbours, as Detector::detect does. */
+    void benchmarkMatcher(State& state, Ptr<DescriptorMatcher> matcher) {
+        Scene scene = Detector().describe(testScenes()[0]);
+        matcher->add(modelDescriptors());
+        matcher->train();
+        vector<vector<DMatch> > knn;
+        while (state.next()) {
+            matcher->knnMatch(scene.descriptors, knn, 2);
+            doNotOptimize(knn);
+        }
+        state.setItems(scene.descriptors.rows);
+    }
+
+}
+
+BENCHMARK(describe) {
+    Detector detector(shippedModels());
+    DetectionContext context;
+    Scene scene;
+    while (state.next()) {
+        scene = detector.describe(testScenes()[0], context);
+    }
+    state.setItems(scene.keypoints.size());
+}
+
+BENCHMARK(match_bruteforce) {
+    benchmarkMatcher(state, new BFMatcher(NORM_HAMMING));
+}
+
+BENCHMARK(match_hamming) {
+    benchmarkMatcher(state, new HammingMatcher());
+}
+
+BENCHMARK(match_mih) {
+    benchmarkMatcher(state, new MihMatcher());
+}
+
+BENCHMARK(match_lsh) {
+    benchmarkMatcher(state, new FlannBasedMatcher(new flann::LshIndexParams(15, 12, 2)));
+}
+
+BENCHMARK(detect) {
+    Detector detector(shippedModels());
+    DetectionContext context;
+    Scene scene = detector.describe(testScenes()[0], context);
+    while (state.next()) {
+        vector<Detection> detections = detector.detect(scene, context);
+        doNotOptimize(detections);
+    }
+    state.setItems(scene.descriptors.rows);
+}
+
+BENCHMARK(detect_batch) {
+    Detector detector(shippedModels());
+    DetectionContext context;
+    vector<Scene> scenes;
+
+    BOOST_FOREACH(const Mat& image, testScenes()) {
+        scenes.push_back(detector.describe(image, context));
+    }
+    vector<const Scene*> batch;
+    size_t descriptors = 0;
+
+    BOOST_FOREACH(const Scene& scene, scenes) {
+        batch.push_back(&scene);
+        descriptors += scene.descriptors.rows;
+    }
+    while (state.next()) {
+        vector<vector<Detection> > detections = detector.detect(batch, context);
+        doNotOptimize(detections);
+    }
+    state.setItems(descriptors);
+}
+
+/** Verifies one candidate model per operation, in turn: the homography
+ * estimation of Detector::detect on the matches of a model. */
+BENCHMARK(verify) {
+    Detector detector(shippedModels(), Feature(), new AcceptAllFilter());
+    Scene scene = detector.describe(testScenes()[0]);
+    vector<Detection> detections = detector.detect(scene);
+    CV_Assert(!detections.empty());
+
+    vector<vector<Point2f> > modelPoints(detections.size());
+    vector<vector<Point2f> > scenePoints(detections.size());
+    size_t matches = 0;
+    for (size_t i = 0; i < detections.size(); i++) {
+        vector<DMatch> sorted = detections[i].matches;
+        stable_sort(sorted.begin(), sorted.end());
+
+        BOOST_FOREACH(const DMatch& m, sorted) {
+            scenePoints[i].push_back(scene.keypoints[m.queryIdx].pt);
+            modelPoints[i].push_back(detections[i].model->allKeypoints[m.trainIdx].pt);
+        }
+        matches += sorted.size();
+    }
+
+    ProsacEstimator estimator;
+    size_t i = 0;
+    while (state.next()) {
+        HomographyEstimate estimate = estimator.estimate(modelPoints[i],
+                scenePoints[i]);
+        doNotOptimize(estimate);
+        i = (i + 1) % detections.size();
+    }
+    state.setItems(double(matches) / detections.size());
+}
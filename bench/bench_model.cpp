@@ -0,0 +1,36 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "bench.h"
+#include "tpofinder/configure.h"
+#include "tpofinder/model.h"
+
+#include <opencv2/highgui/highgui.hpp>
+
+using namespace cv;
+using namespace tpofinder;
+using namespace std;
+
+/** Creates a model from a single view, i.e. detects and describes its
+ * keypoints. */
+BENCHMARK(model_create) {
+    Mat image = imread(PROJECT_BINARY_DIR + "/data/taco/ref.jpg");
+    Mat roi = imread(PROJECT_BINARY_DIR + "/data/taco/roi.png", 0);
+    PlanarModel model;
+    while (state.next()) {
+        model = PlanarModel::create("taco", image, roi);
+    }
+    state.setItems(model.allKeypoints.size());
+}
+
+/** Loads a model with all its views from disk, bypassing the model cache. */
+BENCHMARK(model_load) {
+    PlanarModel model;
+    while (state.next()) {
+        model = PlanarModel::load(PROJECT_BINARY_DIR + "/data/taco");
+    }
+    state.setItems(model.views.size());
+}
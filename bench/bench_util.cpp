@@ -0,0 +1,49 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "bench.h"
+#include "tpofinder/util.h"
+
+#include <boost/foreach.hpp>
+
+using namespace cv;
+using namespace tpofinder;
+using namespace std;
+
+/** The keypoints of all views of the taco model and the homography of its
+ * second view. */
+BENCHMARK(perspectiveTransformKeypoints) {
+    const PlanarModel& model = shippedModels().models[3];
+    CV_Assert(model.views.size() > 1);
+    vector<KeyPoint> transformed;
+    while (state.next()) {
+        perspectiveTransformKeypoints(model.allKeypoints, transformed,
+                model.views[1].homography);
+        doNotOptimize(transformed);
+    }
+    state.setItems(model.allKeypoints.size());
+}
+
+/** The matches and homography of the first detection in the first scene. */
+BENCHMARK(findInliers) {
+    Detector detector(shippedModels(), Feature(), new AcceptAllFilter());
+    Scene scene = detector.describe(testScenes()[0]);
+    vector<Detection> detections = detector.detect(scene);
+    CV_Assert(!detections.empty());
+    const Detection& d = detections[0];
+
+    vector<Point2f> modelPoints, scenePoints;
+
+    BOOST_FOREACH(const DMatch& m, d.matches) {
+        scenePoints.push_back(scene.keypoints[m.queryIdx].pt);
+        modelPoints.push_back(d.model->allKeypoints[m.trainIdx].pt);
+    }
+    while (state.next()) {
+        vector<int> inliers = findInliers(modelPoints, scenePoints, d.homography);
+        doNotOptimize(inliers);
+    }
+    state.setItems(modelPoints.size());
+}
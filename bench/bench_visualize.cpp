@@ -0,0 +1,29 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "bench.h"
+#include "tpofinder/visualize.h"
+
+#include <boost/foreach.hpp>
+
+using namespace cv;
+using namespace tpofinder;
+using namespace std;
+
+/** Draws all detections of the first scene onto it. */
+BENCHMARK(drawDetection) {
+    Detector detector(shippedModels(), Feature(), new AcceptAllFilter());
+    Scene scene = detector.describe(testScenes()[0]);
+    vector<Detection> detections = detector.detect(scene);
+    Mat image = testScenes()[0].clone();
+    while (state.next()) {
+
+        BOOST_FOREACH(const Detection& d, detections) {
+            drawDetection(image, d);
+        }
+    }
+    state.setItems(detections.size());
+}
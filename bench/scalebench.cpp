@@ -0,0 +1,422 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "tpofinder/configure.h"
+#include "tpofinder/defaults.h"
+#include "tpofinder/detect.h"
+#include "tpofinder/parallel.h"
+#include "tpofinder/stats.h"
+
+#include <algorithm>
+#include <boost/foreach.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+/** Measures how detection scales with the number of models and threads. The
+ * modelbase is synthesized from the shipped objects: every further model is
+ * a random crop of an object under a random perspective distortion, mirrored
+ * half of the time, with random contrast, brightness, channel order and
+ * noise, and inverted a quarter of the time. The queries are scenes that show
+ * one of the first models under another random pose on a textured
+ * background. For every model count (in increasing order) and thread count,
+ * one line reports the startup time of the detector, the resident memory of
+ * the process, the latency of describing and detecting a query on a detector
+ * with that many threads, the throughput of as many concurrent query streams
+ * on the same detector, the recall of the queried models and the number of
+ * other models detected per query. */
+
+using namespace cv;
+using namespace tpofinder;
+using namespace std;
+namespace po = boost::program_options;
+
+const string OBJECTS[] = {"adapter", "blokus", "stockholm", "taco", "tea"};
+const int NOBJECTS = 5;
+
+vector<size_t> modelCounts;
+vector<unsigned> threadCounts;
+size_t queries = 40;
+string matcher = "lsh";
+string format = "table";
+string output;
+uint64 seed = 1;
+
+/** An image and the region of interest of a model or query. */
+struct View {
+    Mat image;
+    Mat roi;
+};
+
+/** A query scene and the index of the model it shows. */
+struct Query {
+    Mat image;
+    size_t model;
+};
+
+/** One point of the scaling curve. */
+struct Result {
+    size_t models;
+    unsigned threads;
+    double synthesisTime;
+    double startupTime;
+    double residentMegabytes;
+    double medianLatency;
+    double p99Latency;
+    double framesPerSecond;
+    double recall;
+    double falsePositives;
+};
+
+double now() {
+    return chrono::duration<double>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Resident memory of the process in megabytes, or zero if unknown. */
+double residentMegabytes() {
+    ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    if (!(statm >> size >> resident)) {
+        return 0;
+    }
+    return resident * (double) sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+template <typename T>
+vector<T> parseList(const string& list) {
+    vector<T> values;
+    istringstream in(list);
+    string item;
+    while (getline(in, item, ',')) {
+        values.push_back(boost::lexical_cast<T>(item));
+    }
+    return values;
+}
+
+void processCommandLine(int argc, char* argv[]) {
+    string models = "5,50,500";
+    string threads = "1";
+
+    po::options_description options;
+    options.add_options()
+            ("models", po::value<string>(&models),
+                "Comma-separated model counts (default: 5,50,500).")
+            ("threads,j", po::value<string>(&threads),
+                "Comma-separated thread counts (default: 1).")
+            ("queries", po::value<size_t>(&queries),
+                "Number of query scenes (default: 40).")
+            ("matcher", po::value<string>(&matcher),
+                "Descriptor matcher: lsh (default), hamming or mih.")
+            ("seed", po::value<uint64>(&seed),
+                "Seed of the synthesis of models and queries (default: 1).")
+            ("format", po::value<string>(&format),
+                "Output format: table (default), json (one object per line) or\n"
+                "csv.")
+            ("output,o", po::value<string>(&output),
+                "Write the results to this file instead of standard output.")
+            ("help,h", "Print help message.");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, options), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << "Usage: scalebench [OPTIONS]" << endl;
+        cout << options << endl;
+        exit(0);
+    }
+    modelCounts = parseList<size_t>(models);
+    threadCounts = parseList<unsigned>(threads);
+    sort(modelCounts.begin(), modelCounts.end());
+    if (modelCounts.empty() || modelCounts[0] == 0 || threadCounts.empty()) {
+        cerr << "Model and thread counts must not be empty" << endl;
+        exit(1);
+    }
+}
+
+/** Adds zero-mean Gaussian noise to an 8-bit image. */
+void addNoise(Mat& image, double sigma, RNG& rng) {
+    Mat noisy;
+    image.convertTo(noisy, CV_32F);
+    Mat noise(image.size(), noisy.type());
+    rng.fill(noise, RNG::NORMAL, 0, sigma);
+    noisy += noise;
+    noisy.convertTo(image, CV_8U);
+}
+
+/** A random variant of an object; the variant is the object itself if
+ * identity is set. */
+View augment(const View& object, RNG& rng, bool identity) {
+    if (identity) {
+        return object;
+    }
+    const float w = object.image.cols, h = object.image.rows;
+
+    // A crop of 60 to 100 percent of the object, whose corners move by up to
+    // a tenth of its size.
+    float cw = rng.uniform(0.6, 1.0) * w, ch = rng.uniform(0.6, 1.0) * h;
+    float x = rng.uniform(0.0, w - cw), y = rng.uniform(0.0, h - ch);
+    Point2f src[] = {Point2f(x, y), Point2f(x + cw, y), Point2f(x + cw, y + ch),
+        Point2f(x, y + ch)};
+    Point2f dst[] = {Point2f(0, 0), Point2f(cw, 0), Point2f(cw, ch), Point2f(0, ch)};
+    for (int i = 0; i < 4; i++) {
+        dst[i].x = min(max(dst[i].x + (float) rng.uniform(-0.1, 0.1) * cw, 0.0f), cw);
+        dst[i].y = min(max(dst[i].y + (float) rng.uniform(-0.1, 0.1) * ch, 0.0f), ch);
+    }
+    if (rng.uniform(0, 2) == 1) {
+        for (int i = 0; i < 4; i++) {
+            dst[i].x = cw - dst[i].x;
+        }
+    }
+    Mat homography = getPerspectiveTransform(src, dst);
+    View variant;
+    warpPerspective(object.image, variant.image, homography, Size(cw, ch),
+            INTER_LINEAR, BORDER_REPLICATE);
+    warpPerspective(object.roi, variant.roi, homography, Size(cw, ch),
+            INTER_NEAREST);
+
+    // Photometric changes.
+    variant.image.convertTo(variant.image, -1, rng.uniform(0.7, 1.3),
+            rng.uniform(-30.0, 30.0));
+    vector<Mat> channels;
+    split(variant.image, channels);
+    for (int i = (int) channels.size() - 1; i > 0; i--) {
+        swap(channels[i], channels[rng.uniform(0, i + 1)]);
+    }
+    merge(channels, variant.image);
+    if (rng.uniform(0, 4) == 0) {
+        variant.image = Scalar::all(255) - variant.image;
+    }
+    addNoise(variant.image, rng.uniform(0.0, 8.0), rng);
+    return variant;
+}
+
+/** A scene of 640 x 480 pixels with the model at a random pose. */
+Mat compose(const View& model, RNG& rng) {
+    Mat scene(480, 640, CV_8UC3);
+    rng.fill(scene, RNG::UNIFORM, 0, 256);
+    GaussianBlur(scene, scene, Size(0, 0), 3);
+
+    // The model covers 40 to 80 percent of the scene height, rotated by up to
+    // 25 degrees, with corners moving by up to a tenth of its size.
+    double scale = rng.uniform(0.4, 0.8) * min(scene.rows / (double) model.image.rows,
+            scene.cols / (double) model.image.cols);
+    double angle = rng.uniform(-25.0, 25.0) * CV_PI / 180;
+    Point2f center(rng.uniform(0.35, 0.65) * scene.cols,
+            rng.uniform(0.35, 0.65) * scene.rows);
+    float w = model.image.cols, h = model.image.rows;
+    Point2f src[] = {Point2f(0, 0), Point2f(w, 0), Point2f(w, h), Point2f(0, h)};
+    Point2f dst[4];
+    for (int i = 0; i < 4; i++) {
+        Point2f p = (src[i] - Point2f(w / 2, h / 2)) * scale;
+        p += Point2f(rng.uniform(-0.1, 0.1) * w, rng.uniform(-0.1, 0.1) * h) * scale;
+        dst[i] = center + Point2f(cos(angle) * p.x - sin(angle) * p.y,
+                sin(angle) * p.x + cos(angle) * p.y);
+    }
+    Mat homography = getPerspectiveTransform(src, dst);
+    Mat warped, mask;
+    warpPerspective(model.image, warped, homography, scene.size());
+    warpPerspective(model.roi, mask, homography, scene.size(), INTER_NEAREST);
+    warped.copyTo(scene, mask);
+
+    scene.convertTo(scene, -1, rng.uniform(0.8, 1.2), rng.uniform(-20.0, 20.0));
+    addNoise(scene, 3, rng);
+    return scene;
+}
+
+/** Describes and detects every query once on the calling thread, recording
+ * latencies and correct and other detections. */
+void runQueries(const Detector& detector, const vector<Query>& scenes,
+        LatencyHistogram& latency, size_t& found, size_t& others) {
+    DetectionContext context;
+    found = others = 0;
+
+    BOOST_FOREACH(const Query& q, scenes) {
+        double start = now();
+        vector<Detection> detections = detector.detect(
+                detector.describe(q.image, context), context);
+        latency.record(now() - start);
+
+        BOOST_FOREACH(const Detection& d, detections) {
+            if (d.model->name == str(boost::format("model-%d") % q.model)) {
+                found++;
+            } else {
+                others++;
+            }
+        }
+    }
+}
+
+/** Frames per second with one stream of queries per thread. */
+double throughput(const Detector& detector, const vector<Query>& scenes,
+        unsigned threads) {
+    double start = now();
+    vector<thread> streams;
+    for (unsigned t = 0; t < threads; t++) {
+        streams.push_back(thread([&detector, &scenes, t, threads]() {
+            DetectionContext context;
+            for (size_t i = t; i < scenes.size(); i += threads) {
+                detector.detect(detector.describe(scenes[i].image, context),
+                        context);
+            }
+        }));
+    }
+
+    BOOST_FOREACH(thread& s, streams) {
+        s.join();
+    }
+    return scenes.size() / (now() - start);
+}
+
+void writeHeader(ostream& out) {
+    if (format == "csv") {
+        out << "models,threads,synthesis_s,startup_s,rss_mb,latency_p50_ms,"
+                "latency_p99_ms,frames_per_s,recall,false_positives_per_frame"
+                << endl;
+    } else if (format == "table") {
+        out << " models threads synthesis_s startup_s  rss_mb  p50_ms  p99_ms"
+                "    fps recall  fp/frame" << endl;
+    }
+}
+
+void write(ostream& out, const Result& r) {
+    if (format == "json") {
+        out << boost::format("{\"models\":%d,\"threads\":%d,\"synthesis_s\":%.3f,"
+                "\"startup_s\":%.3f,\"rss_mb\":%.1f,\"latency_p50_ms\":%.3f,"
+                "\"latency_p99_ms\":%.3f,\"frames_per_s\":%.2f,\"recall\":%.4f,"
+                "\"false_positives_per_frame\":%.4f}")
+                % r.models % r.threads % r.synthesisTime % r.startupTime
+                % r.residentMegabytes % (1000 * r.medianLatency)
+                % (1000 * r.p99Latency) % r.framesPerSecond % r.recall
+                % r.falsePositives << endl;
+    } else if (format == "csv") {
+        out << boost::format("%d,%d,%.3f,%.3f,%.1f,%.3f,%.3f,%.2f,%.4f,%.4f")
+                % r.models % r.threads % r.synthesisTime % r.startupTime
+                % r.residentMegabytes % (1000 * r.medianLatency)
+                % (1000 * r.p99Latency) % r.framesPerSecond % r.recall
+                % r.falsePositives << endl;
+    } else {
+        out << boost::format("%7d %7d %11.2f %9.2f %7.1f %7.1f %7.1f %6.1f %6.3f %9.3f")
+                % r.models % r.threads % r.synthesisTime % r.startupTime
+                % r.residentMegabytes % (1000 * r.medianLatency)
+                % (1000 * r.p99Latency) % r.framesPerSecond % r.recall
+                % r.falsePositives << endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    processCommandLine(argc, argv);
+    if (format != "table" && format != "json" && format != "csv") {
+        cerr << "Unknown format: " << format << endl;
+        return 1;
+    }
+    ofstream file;
+    if (!output.empty()) {
+        file.open(output.c_str());
+        if (!file) {
+            cerr << "Cannot write to " << output << endl;
+            return 1;
+        }
+    }
+    ostream& out = output.empty() ? cout : file;
+
+    // The features of tpofind.
+    Ptr<DescriptorMatcher> dm = createMatcher(matcher);
+    if (dm.empty()) {
+        cerr << "Unknown matcher: " << matcher << endl;
+        return 1;
+    }
+    Feature trainFeature = modelFeature(dm);
+    Feature feature = sceneFeature(dm);
+
+    vector<View> objects(NOBJECTS);
+    for (int o = 0; o < NOBJECTS; o++) {
+        string path = PROJECT_BINARY_DIR + "/data/" + OBJECTS[o];
+        objects[o].image = imread(path + "/ref.jpg");
+        objects[o].roi = imread(path + "/roi.png", CV_LOAD_IMAGE_GRAYSCALE);
+        CV_Assert(!objects[o].image.empty() && !objects[o].roi.empty());
+    }
+
+    // Queries show the models that all model counts have. Their views are
+    // kept; those of all other models are dropped after describing them, as
+    // in a packed modelbase.
+    const size_t queried = modelCounts[0];
+    vector<View> queriedViews(queried);
+    vector<Query> scenes(queries);
+
+    Modelbase modelbase(trainFeature);
+    double synthesisTime = 0;
+    writeHeader(out);
+
+    BOOST_FOREACH(size_t count, modelCounts) {
+        double start = now();
+        size_t first = modelbase.models.size();
+        modelbase.models.resize(max(first, count));
+        parallelFor(modelbase.models.size() - first, [&](size_t k) {
+            size_t i = first + k;
+            RNG rng(seed * 1000003 + i);
+            View view = augment(objects[i % NOBJECTS], rng, i < (size_t) NOBJECTS);
+            PlanarModel& model = modelbase.models[i];
+            model = PlanarModel::create(str(boost::format("model-%d") % i),
+                    view.image, view.roi, Scalar(0, 0, 255, 255),
+                    trainFeature.copy());
+
+            BOOST_FOREACH(PlanarView& v, model.views) {
+                v.image.release();
+                v.roi.release();
+            }
+            if (i < queried) {
+                queriedViews[i] = view;
+            }
+        });
+        if (first == 0) {
+            for (size_t q = 0; q < queries; q++) {
+                RNG rng(seed * 7919 + q);
+                scenes[q].model = q % queried;
+                scenes[q].image = compose(queriedViews[scenes[q].model], rng);
+            }
+        }
+        synthesisTime += now() - start;
+
+        BOOST_FOREACH(unsigned threads, threadCounts) {
+            Result r;
+            r.models = count;
+            r.threads = threads;
+            r.synthesisTime = synthesisTime;
+
+            Modelbase prefix(trainFeature);
+            prefix.models.assign(modelbase.models.begin(),
+                    modelbase.models.begin() + count);
+
+            start = now();
+            Detector detector(prefix, feature, createDefaultFilter(), 3.0,
+                    threads);
+            r.startupTime = now() - start;
+            r.residentMegabytes = residentMegabytes();
+
+            LatencyHistogram latency;
+            size_t found, others;
+            runQueries(detector, scenes, latency, found, others);
+            r.medianLatency = latency.quantile(0.5);
+            r.p99Latency = latency.quantile(0.99);
+            r.recall = queries > 0 ? double(found) / queries : 0;
+            r.falsePositives = queries > 0 ? double(others) / queries : 0;
+            r.framesPerSecond = throughput(detector, scenes, threads);
+            write(out, r);
+        }
+    }
+    return 0;
+}
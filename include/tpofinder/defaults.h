@@ -0,0 +1,45 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#ifndef DEFAULTS_H
+#define	DEFAULTS_H
+
+#include "tpofinder/detect.h"
+#include "tpofinder/feature.h"
+
+#include <boost/filesystem.hpp>
+#include <opencv2/features2d/features2d.hpp>
+#include <string>
+#include <vector>
+
+/** The configuration shared by tpofind, tpofindd and the benchmarks, such that
+ * they detect alike and share model caches. */
+
+namespace tpofinder {
+
+    /** Creates the matcher of the given name: "hamming" (HammingMatcher),
+     * "mih" (MihMatcher) or "lsh" (a FlannBasedMatcher with an LSH index).
+     * Returns an empty pointer for any other name. */
+    cv::Ptr<cv::DescriptorMatcher> createMatcher(const std::string& name);
+
+    /** The feature scenes are described with: ORB with up to 1000 keypoints
+     * on eight levels. */
+    Feature sceneFeature(const cv::Ptr<cv::DescriptorMatcher>& matcher);
+
+    /** The feature models are described with. Views get fewer keypoints than
+     * scenes; the extractor is the same as that of sceneFeature. */
+    Feature modelFeature(const cv::Ptr<cv::DescriptorMatcher>& matcher);
+
+    /** Accepts detections whose homography is well-conditioned and that have
+     * at least 30% inliers. */
+    cv::Ptr<DetectionFilter> createDefaultFilter();
+
+    /** The models that come with tpofinder. */
+    std::vector<boost::filesystem::path> defaultModelPaths();
+
+}
+
+#endif
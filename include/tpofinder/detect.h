@@ -7,8 +7,14 @@
 #ifndef DETECT_H
 #define	DETECT_H
 
+#include "tpofinder/estimate.h"
 #include "tpofinder/model.h"
+#include "tpofinder/parallel.h"
+#include "tpofinder/stats.h"
+#include "tpofinder/vocabulary.h"
 
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <opencv2/features2d/features2d.hpp>
 
@@ -38,23 +44,34 @@ namespace tpofinder {
 
     };
 
-    /** A description of objects that are presumably on scene. */
+    /** A description of objects that are presumably on scene. Detections
+     * refer to the model in the detector instead of copying it, and can only
+     * be moved, such that detecting objects does not copy model data. */
     struct Detection {
 
         Detection() {
             /* this constructor is required for testing */
         }
 
-        Detection(const PlanarModel& model, const cv::Mat& homography,
-                const std::vector<cv::DMatch>& matches,
-                const std::vector<int>& inliers) :
+        Detection(const std::shared_ptr<const PlanarModel>& model,
+                const cv::Mat& homography, std::vector<cv::DMatch> matches,
+                std::vector<int> inliers) :
         /*       */ model(model), homography(homography),
-        /*       */ matches(matches), inliers(inliers) {
+        /*       */ matches(std::move(matches)), inliers(std::move(inliers)) {
             /* no operation */
         }
 
-        /** Corresponds to the detected object. */
-        PlanarModel model;
+        Detection(Detection&& other) = default;
+
+        Detection& operator=(Detection&& other) = default;
+
+        Detection(const Detection&) = delete;
+
+        Detection& operator=(const Detection&) = delete;
+
+        /** Corresponds to the detected object. The model stays valid even if
+         * it is removed from the detector afterwards. */
+        std::shared_ptr<const PlanarModel> model;
         /** Transforms model coordinates into scene coordinates. */
         cv::Mat homography;
         /** Matches that lead to this detection. For a given DMatch dm,
@@ -62,8 +79,8 @@ namespace tpofinder {
          * dm.trainIdx references the keypoints (descriptors) of the model as
          * stored in PlanarModel::allKeyppoints (PlanarModel::allDescriptors);
          * dm.imgIdx references the planar model it belongs to. The planar view
-         * the matched keypoints belongs to can be recovered by counting the
-         * numbers of keypoints in each view. */
+         * the matched keypoints belongs to can be recovered by
+         * PlanarModel::viewOf(dm.trainIdx). */
         std::vector<cv::DMatch> matches;
         /** References those matches that are considered inliers for the given
          * fitted homography. */
@@ -133,33 +150,347 @@ namespace tpofinder {
 
     };
 
-    /** Detects objects in a scene. */
+    /** Selects the matches between scene and models that are used for
+     * fitting homographies. The defaults keep the nearest neighbour of every
+     * scene descriptor and verify every model with at least four matches. */
+    struct MatchConfig {
+
+        MatchConfig(float maxRatio = 1.0f, bool crossCheck = false,
+                int minSupport = 4, int shortlist = 0) :
+        /*       */ maxRatio(maxRatio), crossCheck(crossCheck),
+        /*       */ minSupport(minSupport), shortlist(shortlist) {
+        }
+
+        /** Ratio test (Lowe): a match is only kept if its distance is less
+         * than maxRatio times the distance to the second-nearest model
+         * descriptor. Values of one or more disable the test. Features that
+         * several views of a model share fail the test; see
+         * PlanarModel::compact. */
+        float maxRatio;
+        /** Keep a match only if the scene descriptor is also the nearest
+         * scene descriptor of the matched model descriptor. */
+        bool crossCheck;
+        /** Models with fewer matches are rejected without fitting a
+         * homography. Values below four have no effect. */
+        int minSupport;
+        /** If positive, the scene is only matched against the given number
+         * of models that are most similar to it by their visual words (see
+         * VocabularyTree), instead of against all models. This requires
+         * binary descriptors. */
+        int shortlist;
+
+    };
+
+    /** Maps detections in a scene image that has been reduced by the given
+     * factor (see DecodeOptions) to the original image: their homographies
+     * then map model coordinates to coordinates in the original image. */
+    void scaleDetections(std::vector<Detection>& detections, double factor);
+
+    /** Counters and timings of describing and detecting a scene; times are in
+     * seconds. The times of verification and filtering are summed over all
+     * verified models. */
+    struct DetectionStats {
+
+        DetectionStats() :
+        /*       */ keypointTime(0), extractTime(0), matchTime(0),
+        /*       */ verifyTime(0), filterTime(0), detectTime(0), keypoints(0),
+        /*       */ matches(0), candidates(0), iterations(0), detections(0) {
+        }
+
+        DetectionStats& operator+=(const DetectionStats& other);
+
+        /** Spent in FeatureDetector::detect and DescriptorExtractor::compute. */
+        double keypointTime;
+        double extractTime;
+        /** Spent in finding the nearest neighbours, the ratio test and
+         * cross-checking. */
+        double matchTime;
+        /** Spent in estimating homographies. */
+        double verifyTime;
+        /** Spent in the detection filter. */
+        double filterTime;
+        /** Spent in Detector::detect as a whole. */
+        double detectTime;
+        size_t keypoints;
+        /** Matches that passed the ratio test and cross-checking. */
+        size_t matches;
+        /** Models with enough matches to be verified. */
+        size_t candidates;
+        /** Samples drawn by the homography estimation. */
+        size_t iterations;
+        size_t detections;
+
+    };
+
+    /** Latency histograms of the stages of describing scenes and detecting
+     * objects, over all calls of a detector and its copies. Verification and
+     * filtering are recorded once per verified model, the other stages once
+     * per call. */
+    struct DetectionProfile {
+        LatencyHistogram keypoints;
+        LatencyHistogram extract;
+        LatencyHistogram match;
+        LatencyHistogram verify;
+        LatencyHistogram filter;
+        LatencyHistogram detect;
+    };
+
+    /** Scratch space of a thread that detects objects (see Detector): its own
+     * copies of the feature detector and extractor, a matcher for
+     * cross-checking, and buffers that are reused from one scene to the next.
+     * A context is set up by the first detector it is used with; it must not
+     * be used by several threads at once. */
+    class DetectionContext {
+    public:
+
+        DetectionContext() :
+        /*       */ sourceDetector_(0), sourceExtractor_(0), shared_(false),
+        /*       */ sourceMatcher_(0) {
+        }
+
+        /** Counters and timings of the last scene described with this
+         * context, and of the last detection; describe resets them all,
+         * detect only those of detection. Detecting several scenes at once
+         * sums them over the scenes. */
+        const DetectionStats& stats() const {
+            return stats_;
+        }
+
+    private:
+
+        friend class Detector;
+
+        /** The feature detector and extractor these are copies of. */
+        const cv::FeatureDetector* sourceDetector_;
+        const cv::DescriptorExtractor* sourceExtractor_;
+        cv::Ptr<cv::FeatureDetector> detector_;
+        cv::Ptr<cv::DescriptorExtractor> extractor_;
+        /** Whether detector_ and extractor_ are those of the detector because
+         * they could not be copied. */
+        bool shared_;
+        /** The matcher crossMatcher_ is an untrained clone of; the clone is
+         * made by the first cross-check. */
+        const cv::DescriptorMatcher* sourceMatcher_;
+        cv::Ptr<cv::DescriptorMatcher> crossMatcher_;
+        std::vector<std::vector<cv::DMatch> > knn_;
+        std::vector<cv::DMatch> nearest_;
+        std::vector<std::vector<cv::DMatch> > buckets_;
+        DetectionStats stats_;
+
+    };
+
+    /** Detects objects in a scene.
+     *
+     * Models can be added and removed while other threads detect objects.
+     * The matcher index consists of segments, each a matcher trained on the
+     * descriptors of some of the models. The constructor creates one segment
+     * for all models; addModel creates one segment per added model. Removed
+     * models are only marked as such until their segment is rebuilt by
+     * compact(). Every call to detect works on a consistent snapshot of the
+     * models and segments; updates build a new snapshot and swap it in.
+     *
+     * With a shortlist (see MatchConfig), a vocabulary tree is learned from
+     * the models the detector is constructed with, or from the first model
+     * added. Every segment keeps an inverted file of the visual words of its
+     * models. Every model also gets a matcher of its own, trained once when
+     * the model is added; the scene is matched by querying the matchers of
+     * the shortlisted models only.
+     *
+     * Describing scenes and detecting objects does not modify the detector,
+     * so that several threads can serve frames with a single detector. Every
+     * thread should keep a DetectionContext and pass it to describe and
+     * detect. The context holds copies of the feature detector and extractor,
+     * made by the first describe, and scratch space for detect. The models
+     * and the trained matchers are shared by all threads; matchers are only
+     * queried, which is safe for the matchers of OpenCV and tpofinder.
+     * Describing without a context uses the detector and extractor of the
+     * feature instead of copying them, one scene at a time; so do all
+     * contexts if they cannot be copied by their parameters (see
+     * Feature::copyable). The filter must be safe to call from several
+     * threads. */
     class Detector {
     public:
 
+        /** The descriptors of the models are handed to the matcher by
+         * reference. Brute-force matchers therefore work directly on the
+         * memory of the models, e.g. on a mapped packed modelbase. Candidate
+         * models are verified on the given number of threads (zero means one
+         * per hardware thread); the filter must then be safe to call from
+         * several threads. The detections do not depend on the number of
+         * threads.
+         *
+         * If an index path is given, the trained matcher index of the models
+         * is restored from that file instead of training the matcher, unless
+         * it was written for other models, another feature or another matcher
+         * (see readMatcherIndex). Otherwise the matcher is trained and its
+         * index written to the file, if the matcher supports it. */
         Detector(const Modelbase& modelbase = Modelbase(),
                 const Feature& feature = Feature(),
                 const cv::Ptr<DetectionFilter> filter = new AcceptAllFilter(),
-                double reprojThreshold = 3.0);
+                double reprojThreshold = 3.0, unsigned threads = 1,
+                const MatchConfig& matching = MatchConfig(),
+                const std::string& indexPath = std::string());
+
+        /** Copies share the current snapshot; later updates of either detector
+         * do not affect the other one. */
+        Detector(const Detector& other);
+
+        Detector& operator=(const Detector& other);
 
         /** Construct a scene description out of an image. */
-        Scene describe(const cv::Mat& sceneImage);
+        Scene describe(const cv::Mat& sceneImage) const;
 
-        /** Detect objects given the description of a scene. */
-        std::vector<Detection> detect(const Scene& scene);
+        Scene describe(const cv::Mat& sceneImage, DetectionContext& context) const;
 
-        const Modelbase& modelbase() const {
-            return modelbase_;
-        }
+        /** Detect objects given the description of a scene. */
+        std::vector<Detection> detect(const Scene& scene) const;
+
+        std::vector<Detection> detect(const Scene& scene,
+                DetectionContext& context) const;
+
+        /** Detects objects in several scenes at once: the descriptors of all
+         * scenes are matched by a single query of every matcher segment,
+         * which saves the per-query overhead of the matcher (e.g. for a
+         * server that collects concurrent requests). The detections equal
+         * those of detecting objects in every scene on its own. */
+        std::vector<std::vector<Detection> > detect(
+                const std::vector<const Scene*>& scenes,
+                DetectionContext& context) const;
+
+        /** Adds a model. Only a matcher for the new model is trained; the
+         * models already known are not touched. */
+        void addModel(const PlanarModel& model);
+
+        /** Removes the first model with the given name and returns whether
+         * there was such a model. Scene descriptors whose nearest neighbour
+         * belongs to a removed model are left unmatched until the segment of
+         * that model is rebuilt by compact(). */
+        bool removeModel(const std::string& name);
+
+        /** Rebuilds the matcher index as a single segment of all models that
+         * have not been removed. The matcher is trained without blocking
+         * detection; it is safe to call this from a background thread. */
+        void compact();
+
+        /** Number of matcher segments; compact() reduces them to one. */
+        size_t segments() const;
+
+        /** A copy of the current models, in the order in which they are
+         * referenced by DMatch::imgIdx after compaction. */
+        Modelbase modelbase() const;
+
+        /** Latency histograms of all calls so far; they may be read and
+         * cleared while other threads detect objects. */
+        DetectionProfile& profile() const;
 
     private:
 
-        std::vector<cv::DMatch> match(const Scene& scene);
-
-        Modelbase modelbase_;
+        /** A matcher trained on the descriptors of some of the models; the
+         * image with index i in the matcher belongs to the model in slot
+         * slots[i]. */
+        struct Segment {
+            /** Queried by several threads at once; knnMatch is not const, but
+             * does not modify a trained matcher. */
+            mutable cv::Ptr<cv::DescriptorMatcher> matcher;
+            std::vector<int> slots;
+            /** Visual words of the models, identified by their slots; empty
+             * without a shortlist. */
+            InvertedFile words;
+        };
+
+        /** An immutable snapshot of the models and the matcher index. Removed
+         * models leave an empty slot until the next compaction. */
+        struct Index {
+            std::vector<std::shared_ptr<const PlanarModel> > models;
+            std::vector<std::shared_ptr<const Segment> > segments;
+            std::shared_ptr<const VocabularyTree> vocabulary;
+            /** With a vocabulary, a segment of only the model in each slot,
+             * empty for removed models; shortlisted models are matched by
+             * querying theirs. */
+            std::vector<std::shared_ptr<const Segment> > modelSegments;
+        };
+
+        /** Trains a matcher on the models in the given slots and, if there is
+         * a vocabulary and words is set, indexes their visual words. With an
+         * index path, the matcher index is restored from or written to that
+         * file. */
+        std::shared_ptr<const Segment> train(const std::vector<int>& slots,
+                const Index& index, bool words = true,
+                const std::string& indexPath = std::string()) const;
+
+        /** Learns a vocabulary from all models of the index. */
+        void learnVocabulary(Index& index) const;
+
+        /** Trains a segment for every model of the index that has none yet. */
+        void trainModelSegments(Index& index) const;
+
+        /** Returns the slots of the models most similar to the scene, in
+         * ascending order. */
+        std::vector<int> shortlist(const Scene& scene, const Index& index) const;
+
+        std::shared_ptr<const Index> snapshot() const;
+
+        void publish(const std::shared_ptr<const Index>& index);
+
+        /** Copies the feature detector and extractor into the context unless
+         * it already holds copies of them; only describing needs them. */
+        void prepare(DetectionContext& context) const;
+
+        /** Finds the nearest model descriptors of the scene descriptors and
+         * applies the ratio test. */
+        std::vector<cv::DMatch> match(const Scene& scene, const Index& index,
+                const std::vector<std::shared_ptr<const Segment> >& segments,
+                DetectionContext& context) const;
+
+        /** Stores the nearest model descriptors of every descriptor in the
+         * context. */
+        void findNeighbours(const cv::Mat& descriptors, const Index& index,
+                const std::vector<std::shared_ptr<const Segment> >& segments,
+                DetectionContext& context) const;
+
+        /** Applies the ratio test and cross-checking to the neighbours found
+         * for the scene, whose descriptors were passed to findNeighbours from
+         * the given row on. */
+        std::vector<cv::DMatch> select(const Scene& scene, int offset,
+                const Index& index, DetectionContext& context) const;
+
+        /** Verifies every model with enough matches. */
+        std::vector<Detection> verifyCandidates(const Scene& scene,
+                const Index& index, const std::vector<cv::DMatch>& matches,
+                DetectionContext& context) const;
+
+        /** Removes matches whose model descriptor has another scene
+         * descriptor as its nearest neighbour. */
+        void crossCheck(const Scene& scene, const Index& index,
+                std::vector<cv::DMatch>& matches, DetectionContext& context) const;
+
+        /** Fits a homography to the matches of a model and returns whether
+         * the resulting detection passes the filter. The matches are sorted by
+         * distance. Adds the time and iterations to the stats. */
+        bool verify(const Scene& scene,
+                const std::shared_ptr<const PlanarModel>& model,
+                std::vector<cv::DMatch>& matches, Detection& detection,
+                DetectionStats& stats) const;
+
+        Feature modelFeature_;
         Feature feature_;
-        cv::Ptr<DetectionFilter> filter_;
-        float reprojThreshold_;
+        /** DetectionFilter::accept is not const; see the class comment. */
+        mutable cv::Ptr<DetectionFilter> filter_;
+        ProsacEstimator estimator_;
+        MatchConfig matching_;
+        /** Shared by copies of this detector. */
+        std::shared_ptr<ThreadPool> pool_;
+
+        std::shared_ptr<const Index> index_;
+        /** Guards index_, which is only held for copying or swapping it. */
+        mutable std::mutex indexMutex_;
+        /** Serializes updates of the index. */
+        std::mutex updateMutex_;
+        /** Serializes describing scenes with a feature detector or extractor
+         * that could not be copied; shared by copies of this detector. */
+        std::shared_ptr<std::mutex> describeMutex_;
+        /** Shared by copies of this detector. */
+        std::shared_ptr<DetectionProfile> profile_;
 
     };
 
@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#ifndef ESTIMATE_H
+#define	ESTIMATE_H
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+namespace tpofinder {
+
+    /** Result of a robust homography estimation. */
+    struct HomographyEstimate {
+
+        HomographyEstimate() : iterations(0), rejected(0) {
+        }
+
+        /** Maps source points onto destination points; empty if no
+         * homography has been found. */
+        cv::Mat homography;
+        /** Indices of the point pairs consistent with the homography. */
+        std::vector<int> inliers;
+        /** Number of minimal samples drawn. */
+        int iterations;
+        /** Number of hypotheses abandoned early by the sequential test. */
+        int rejected;
+
+    };
+
+    /** Estimates homographies by progressive sample consensus (PROSAC):
+     * minimal samples are drawn from a growing set of the best-ranked point
+     * pairs instead of uniformly from all of them. Hypotheses are verified by
+     * a sequential probability ratio test (SPRT), which abandons a hypothesis
+     * as soon as it is unlikely to be good, so that bad hypotheses are
+     * rejected after checking a few points only. The estimation is
+     * deterministic. See Chum and Matas, "Matching with PROSAC - progressive
+     * sample consensus", CVPR 2005, and Matas and Chum, "Randomized RANSAC
+     * with sequential probability ratio test", ICCV 2005. */
+    struct ProsacEstimator {
+
+        ProsacEstimator(double reprojThreshold = 3.0, double confidence = 0.995,
+                int maxIterations = 2000) :
+        /*       */ reprojThreshold(reprojThreshold), confidence(confidence),
+        /*       */ maxIterations(maxIterations) {
+        }
+
+        /** Estimates the homography mapping src onto dst. The point pairs must
+         * be sorted by decreasing quality, e.g. by increasing descriptor
+         * distance of the matches they come from. */
+        HomographyEstimate estimate(const std::vector<cv::Point2f>& src,
+                const std::vector<cv::Point2f>& dst) const;
+
+        /** Maximum distance in pixels between a projected source point and
+         * its destination point for the pair to be an inlier. */
+        double reprojThreshold;
+        /** Probability with which the estimation finds the best homography
+         * before it stops sampling. */
+        double confidence;
+        /** Upper limit on the number of samples. */
+        int maxIterations;
+
+    };
+
+}
+
+#endif
@@ -20,6 +20,24 @@ namespace tpofinder {
                 const cv::Ptr<cv::DescriptorExtractor> extractor,
                 const cv::Ptr<cv::DescriptorMatcher> matcher);
 
+        /** Identifies the configuration of the detector and the extractor,
+         * i.e. everything that determines the keypoints and descriptors of a
+         * model. Two features with equal fingerprints produce equal models.
+         * The fingerprint is empty if the detector or the extractor is not
+         * registered with OpenCV, as their parameters are unknown then. */
+        std::string fingerprint() const;
+
+        /** Whether the detector and the extractor are registered with OpenCV,
+         * such that they can be copied by their parameters. */
+        bool copyable() const;
+
+        /** Returns a feature with new instances of the detector and the
+         * extractor that have the same parameters, and the same matcher.
+         * Detectors and extractors need not be safe to call from several
+         * threads at once; threads that extract features concurrently should
+         * each use their own copy. The feature must be copyable. */
+        Feature copy() const;
+
         cv::Ptr<cv::FeatureDetector> detector;
         cv::Ptr<cv::DescriptorExtractor> extractor;
         cv::Ptr<cv::DescriptorMatcher> matcher;
@@ -0,0 +1,195 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#ifndef MATCH_H
+#define	MATCH_H
+
+#include <iosfwd>
+#include <opencv2/features2d/features2d.hpp>
+
+namespace tpofinder {
+
+    /** Implemented by matchers whose trained index can be stored and restored
+     * instead of training it again (see writeMatcherIndex). */
+    class PersistentIndex {
+    public:
+
+        virtual ~PersistentIndex() {
+        }
+
+        /** Writes the trained index, but not the train descriptors. */
+        virtual void writeIndex(std::ostream& out) const = 0;
+
+        /** Restores an index written by writeIndex for the train descriptors
+         * that have been added to the matcher. Returns false, leaving the
+         * matcher untrained, if the index is corrupt or does not fit the
+         * train descriptors. */
+        virtual bool readIndex(std::istream& in) = 0;
+
+    };
+
+    /** Exact brute-force matcher for binary descriptors (e.g. ORB) under the
+     * Hamming distance. Distances are computed by popcount kernels for AVX2
+     * and AVX-512 if the processor supports them, and by a portable kernel
+     * otherwise; the kernel is selected at runtime. Query and train
+     * descriptors are processed in blocks, such that a block of train
+     * descriptors stays in cache while it is compared against the queries.
+     *
+     * The results are equal to those of cv::BFMatcher(NORM_HAMMING): among
+     * neighbours of equal distance, the one with the lower image index and
+     * then the lower train index comes first. Masks are supported. The train
+     * descriptors are not copied; they must be continuous rows of CV_8U. */
+    class HammingMatcher : public cv::DescriptorMatcher {
+    public:
+
+        enum Kernel {
+            /** Fastest kernel supported by the processor. */
+            AUTO,
+            SCALAR,
+            AVX2,
+            AVX512
+        };
+
+        /** Fails if the processor does not support the requested kernel. */
+        explicit HammingMatcher(Kernel kernel = AUTO);
+
+        virtual ~HammingMatcher() {
+        }
+
+        /** Returns whether the processor supports the kernel. */
+        static bool supports(Kernel kernel);
+
+        /** The kernel used for computing distances, never AUTO. */
+        Kernel kernel() const;
+
+        virtual bool isMaskSupported() const;
+
+        virtual cv::Ptr<cv::DescriptorMatcher> clone(bool emptyTrainData = false) const;
+
+    protected:
+
+        virtual void knnMatchImpl(const cv::Mat& queryDescriptors,
+                std::vector<std::vector<cv::DMatch> >& matches, int k,
+                const std::vector<cv::Mat>& masks = std::vector<cv::Mat>(),
+                bool compactResult = false);
+
+        virtual void radiusMatchImpl(const cv::Mat& queryDescriptors,
+                std::vector<std::vector<cv::DMatch> >& matches, float maxDistance,
+                const std::vector<cv::Mat>& masks = std::vector<cv::Mat>(),
+                bool compactResult = false);
+
+    private:
+
+        Kernel kernel_;
+
+    };
+
+    /** Exact nearest-neighbour matcher for binary descriptors under the
+     * Hamming distance, based on multi-index hashing (Norouzi, Punjani and
+     * Fleet, "Fast search in Hamming space with multi-index hashing", CVPR
+     * 2012). Every descriptor is split into m disjoint substrings of about b
+     * bits, each indexed by its own table. Two descriptors within distance r
+     * agree up to r / m bits on at least one substring, such that probing the
+     * tables with substrings of increasing distance finds all neighbours
+     * within a growing radius; the search stops as soon as the k nearest
+     * neighbours found so far are closer than any descriptor not found yet.
+     * If probing would cost more than a linear scan, the remaining
+     * descriptors are scanned instead, so the results are always exact.
+     *
+     * The results equal those of cv::BFMatcher(NORM_HAMMING), including the
+     * order of neighbours of equal distance (see HammingMatcher). Masks are
+     * supported. The tables are built by train() and take m * 2^b + m * N
+     * integers for N train descriptors; the descriptors are not copied. */
+    class MihMatcher : public cv::DescriptorMatcher, public PersistentIndex {
+    public:
+
+        /** Substrings are of at most the given number of bits (up to 16); zero
+         * chooses about log2 of the number of train descriptors. */
+        explicit MihMatcher(int substringBits = 0);
+
+        virtual ~MihMatcher() {
+        }
+
+        virtual void add(const std::vector<cv::Mat>& descriptors);
+
+        virtual void clear();
+
+        /** Builds the hash tables; calling it again without adding
+         * descriptors has no effect. */
+        virtual void train();
+
+        virtual bool isMaskSupported() const;
+
+        virtual cv::Ptr<cv::DescriptorMatcher> clone(bool emptyTrainData = false) const;
+
+        /** Writes the hash tables; the matcher must have been trained. */
+        virtual void writeIndex(std::ostream& out) const;
+
+        virtual bool readIndex(std::istream& in);
+
+    protected:
+
+        virtual void knnMatchImpl(const cv::Mat& queryDescriptors,
+                std::vector<std::vector<cv::DMatch> >& matches, int k,
+                const std::vector<cv::Mat>& masks = std::vector<cv::Mat>(),
+                bool compactResult = false);
+
+        virtual void radiusMatchImpl(const cv::Mat& queryDescriptors,
+                std::vector<std::vector<cv::DMatch> >& matches, float maxDistance,
+                const std::vector<cv::Mat>& masks = std::vector<cv::Mat>(),
+                bool compactResult = false);
+
+    private:
+
+        /** Collects the train descriptors by id. */
+        void collectRows();
+
+        /** Maps the values of one substring to the descriptors having them;
+         * the descriptors with value v are ids[starts[v]] to
+         * ids[starts[v + 1] - 1], in ascending order. */
+        struct Table {
+            int offset;
+            int bits;
+            std::vector<int> starts;
+            std::vector<int> ids;
+        };
+
+        /** Calls visit(id, distance) for train descriptors of the query, at
+         * least for all those within the distance returned by bound(), which
+         * may shrink while visiting. A descriptor may be visited several
+         * times. Returns false if the search gave up because a linear scan
+         * would be cheaper. */
+        template <typename Visit, typename Bound>
+        bool search(const uchar* query, Visit visit, Bound bound) const;
+
+        /** Calls visit(query, id, distance) for all train descriptors and the
+         * given queries, by a linear scan. */
+        template <typename Visit>
+        void scanRemaining(const cv::Mat& queryDescriptors,
+                const std::vector<int>& queries, Visit visit) const;
+
+        /** Returns the image of a train descriptor. */
+        int imageOf(int id) const;
+
+        /** Returns whether the pair of query and train descriptor is masked
+         * out. */
+        bool masked(const std::vector<cv::Mat>& masks, int query, int id) const;
+
+        int substringBits_;
+        bool trained_;
+        int bytes_;
+        std::vector<Table> tables_;
+        /** Train descriptors by id; ids enumerate the descriptors of all
+         * images in order. */
+        std::vector<const uchar*> rows_;
+        /** Id of the first descriptor of every image. */
+        std::vector<int> imageStarts_;
+
+    };
+
+}
+
+#endif
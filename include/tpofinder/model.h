@@ -11,6 +11,7 @@
 #include "tpofinder/feature.h"
 
 #include <boost/filesystem.hpp>
+#include <memory>
 #include <opencv2/features2d/features2d.hpp>
 #include <vector>
 
@@ -72,39 +73,98 @@ namespace tpofinder {
         /** Collection of all keypoints from all views transformed into the
          * reference frame of the first view. Be careful, some duplication here. */
         std::vector<cv::KeyPoint> allKeypoints;
-        /** Collection of all descriptors. Be careful, some duplication here. */
+        /** Collection of all descriptors. Be careful, some duplication here.
+         * The descriptors are stored in a single contiguous block aligned to a
+         * cache line; the descriptors of the views refer to slices of it. */
         cv::Mat allDescriptors;
+        /** The features of view i are those with indices viewOffsets[i] up to
+         * but excluding viewOffsets[i + 1] in allKeypoints and allDescriptors;
+         * there is one more offset than there are views. */
+        std::vector<int> viewOffsets;
+        /** Number of features each feature in allKeypoints (allDescriptors)
+         * stands for; all ones unless the model has been compacted. */
+        std::vector<int> allWeights;
+        /** Keeps memory alive that the matrices of this model refer to but do
+         * not own, such as a mapped packed modelbase. Empty if the matrices
+         * own their data. */
+        std::shared_ptr<const void> storage;
+
+        /** Index of the view the feature with the given index in allKeypoints
+         * (allDescriptors) has been found in. Looks up viewOffsets, such that
+         * the cost only depends on the (small) number of views. */
+        int viewOf(int feature) const;
+
+        /** Merges features of different views that coincide in the reference
+         * frame, i.e. whose keypoints are at most maxKeypointDistance pixels
+         * apart and whose descriptors are at most maxDescriptorDistance apart
+         * (Hamming distance for binary descriptors, L2 distance otherwise).
+         * The feature of the earliest view is kept as representative and its
+         * weight is increased by the weight of each merged feature. The views
+         * keep only their representative features. */
+        void compact(float maxKeypointDistance = 2.0f,
+                double maxDescriptorDistance = 32);
 
         static PlanarModel create(const std::string& name,
                 const cv::Mat& image, const cv::Mat& roi,
                 const cv::Scalar& color = cv::Scalar(0, 0, 255, 255),
                 const Feature& feature = Feature());
 
+        /** Loads a model from a directory. The views other than the reference
+         * view are loaded on up to the given number of threads (zero means
+         * one per hardware thread), each with its own copy of the feature; if
+         * the feature cannot be copied, they are loaded one after another.
+         * The order of the views does not depend on the number of threads. */
         static PlanarModel load(const boost::filesystem::path& path,
-                const Feature& feature = Feature());
+                const Feature& feature = Feature(), unsigned threads = 1);
+
+        /** Paths of the homography files of all but the reference view of the
+         * model stored in path, in the order in which the views are loaded. */
+        static std::vector<boost::filesystem::path> viewPaths(
+                const boost::filesystem::path& path);
 
     };
 
     class Modelbase {
     public:
 
-        Modelbase(const Feature& feature = Feature()) : feature_(feature) {}
+        /** If useCache is set, models are read from the binary model cache in
+         * their directory whenever it is up to date, and the cache is
+         * rewritten whenever it is not (see persist.h). */
+        Modelbase(const Feature& feature = Feature(), bool useCache = false) :
+        /*       */ feature_(feature), useCache_(useCache) {
+        }
 
         void add(const PlanarModel & model) {
             models.push_back(model);
         }
 
-        /** Equivalent to Modelbase::add(PlanarModel::load( ... )). */
-        void add(const boost::filesystem::path& path) {
-            add(PlanarModel::load(path, feature_));
-        }
+        /** Equivalent to Modelbase::add(PlanarModel::load( ... )), unless the
+         * model can be taken from the model cache. */
+        void add(const boost::filesystem::path& path);
+
+        /** Equivalent to calling Modelbase::add for each path in turn, but
+         * loads the models on up to the given number of threads (zero means
+         * one per hardware thread). The models are added in the order of the
+         * paths, regardless of the number of threads. */
+        void addAll(const std::vector<boost::filesystem::path>& paths,
+                unsigned threads = 0);
 
         int findByName(const std::string& name);
+
+        /** The feature used for loading models from directories. */
+        const Feature& feature() const {
+            return feature_;
+        }
         
         std::vector<PlanarModel> models;
         
     private:
+
+        PlanarModel load(const boost::filesystem::path& path,
+                const Feature& feature, unsigned threads) const;
+
         Feature feature_;
+        bool useCache_;
     };
 
 }
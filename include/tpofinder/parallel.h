@@ -0,0 +1,160 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#ifndef PARALLEL_H
+#define	PARALLEL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tpofinder {
+
+    /** Number of threads to use when zero threads are requested; this is the
+     * number of hardware threads, or one if that cannot be determined. */
+    unsigned defaultThreads();
+
+    /** Calls body(i) for all 0 <= i < n on up to the given number of threads
+     * (zero means defaultThreads()). Iterations are handed out in increasing
+     * order, but may complete in any order; the body must therefore write its
+     * results to a slot determined by i. Returns after all iterations
+     * finished. If iterations throw, the first exception is rethrown. */
+    void parallelFor(size_t n, const std::function<void(size_t)>& body,
+            unsigned threads = 0);
+
+    /** A fixed set of threads that run parallel loops, for callers that run
+     * many short loops and should not pay for starting threads each time.
+     * Several threads may run loops on the same pool at once. */
+    class ThreadPool {
+    public:
+
+        /** Creates a pool for loops on the given number of threads (zero
+         * means defaultThreads()); this includes the calling thread. */
+        explicit ThreadPool(unsigned threads = 0);
+
+        ThreadPool(const ThreadPool&) = delete;
+
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /** Waits for running loops to complete. */
+        ~ThreadPool();
+
+        unsigned threads() const {
+            return workers_.size() + 1;
+        }
+
+        /** Like tpofinder::parallelFor, but runs on the threads of this pool
+         * and the calling thread. */
+        void parallelFor(size_t n, const std::function<void(size_t)>& body);
+
+    private:
+
+        struct Job;
+
+        bool take(Job& job, size_t& i);
+
+        void run(Job& job, size_t i);
+
+        void work();
+
+        std::vector<std::thread> workers_;
+        std::deque<std::shared_ptr<Job> > jobs_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        bool stop_;
+
+    };
+
+    /** A bounded queue between the stages of a pipeline. Items are numbered
+     * 0, 1, 2, ... by their producers and are popped in the order of their
+     * numbers, no matter in which order several producers push them. An item
+     * can only be pushed once all items numbered capacity or more below it
+     * have been popped, so that producers cannot run ahead of consumers.
+     * Consumers that pop items in order and push their results in order
+     * never block each other for good. Several threads may push and pop at
+     * once. */
+    template <typename T>
+    class OrderedQueue {
+    public:
+
+        /** The capacity must be positive. */
+        explicit OrderedQueue(size_t capacity) :
+        /*       */ slots_(capacity), filled_(capacity, false), next_(0),
+        /*       */ closed_(false) {
+        }
+
+        OrderedQueue(const OrderedQueue&) = delete;
+
+        OrderedQueue& operator=(const OrderedQueue&) = delete;
+
+        /** Waits until there is room for the item with the given number and
+         * adds it. Returns false, dropping the item, if the queue has been
+         * closed. Every number must be pushed once. */
+        bool push(size_t number, T item) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            space_.wait(lock, [&]() {
+                return closed_ || number < next_ + slots_.size();
+            });
+            if (closed_) {
+                return false;
+            }
+            size_t slot = number % slots_.size();
+            slots_[slot] = std::move(item);
+            filled_[slot] = true;
+            ready_.notify_all();
+            return true;
+        }
+
+        /** Waits for the item with the next number and removes it. Returns
+         * false once the queue has been closed and the next item has not
+         * been pushed. */
+        bool pop(size_t& number, T& item) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [&]() {
+                return closed_ || filled_[next_ % slots_.size()];
+            });
+            size_t slot = next_ % slots_.size();
+            if (!filled_[slot]) {
+                return false;
+            }
+            item = std::move(slots_[slot]);
+            filled_[slot] = false;
+            number = next_++;
+            space_.notify_all();
+            return true;
+        }
+
+        /** Ends the queue: items pushed so far can still be popped in order,
+         * further pushes fail. Producers waiting for room give up. */
+        void close() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            ready_.notify_all();
+            space_.notify_all();
+        }
+
+    private:
+
+        std::vector<T> slots_;
+        std::vector<bool> filled_;
+        /** Number of the next item to pop. */
+        size_t next_;
+        bool closed_;
+        std::mutex mutex_;
+        std::condition_variable ready_;
+        std::condition_variable space_;
+
+    };
+
+}
+
+#endif
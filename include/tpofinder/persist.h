@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#ifndef PERSIST_H
+#define	PERSIST_H
+
+#include "tpofinder/feature.h"
+#include "tpofinder/model.h"
+
+#include <boost/filesystem.hpp>
+#include <stdint.h>
+
+/** Binary representations of models that allow skipping feature extraction
+ * when loading a modelbase. The files are written in native byte order; they
+ * are caches, not an exchange format. */
+
+namespace tpofinder {
+
+    /** Version of the model cache layout. Caches of other versions are
+     * considered stale. */
+    const uint32_t MODEL_CACHE_VERSION = 2;
+
+    /** Location of the model cache within a model directory. */
+    boost::filesystem::path modelCachePath(const boost::filesystem::path& modelPath);
+
+    /** Writes the keypoints, descriptors and homographies of all views as well
+     * as name and color of a model loaded from modelPath into the model cache,
+     * along with the modification time and size of every file the model is
+     * loaded from.
+     * The cache is first written to a uniquely named temporary file and then
+     * renamed, such that concurrent readers never see a partial cache.
+     * Returns false if the cache could not be written, or if the feature has
+     * no fingerprint. */
+    bool writeModelCache(const boost::filesystem::path& modelPath,
+            const PlanarModel& model, const Feature& feature);
+
+    /** Reads a model from the model cache in modelPath. Returns false if there
+     * is no cache, if the feature has no fingerprint, if any of the files the
+     * model is loaded from has been modified, resized, added or removed since
+     * the cache was written, if it has been built with a different feature or
+     * cache version, or if it is corrupt. Only the reference view carries image
+     * and region of interest; the other views are restored without their
+     * images. */
+    bool readModelCache(const boost::filesystem::path& modelPath,
+            const Feature& feature, PlanarModel& model);
+
+    /** Version of the matcher index layout. */
+    const uint32_t MATCHER_INDEX_VERSION = 1;
+
+    /** Identifies what a trained matcher index depends on: the feature the
+     * model descriptors have been extracted with, the type and parameters of
+     * the matcher, and a hash of the contents of its train descriptors. */
+    std::string matcherIndexFingerprint(const cv::DescriptorMatcher& matcher,
+            const Feature& feature);
+
+    /** Writes the index of a trained matcher that implements PersistentIndex
+     * along with its fingerprint. Like the model cache, the file is replaced
+     * atomically. Returns false if the matcher cannot store its index or the
+     * file cannot be written. */
+    bool writeMatcherIndex(const boost::filesystem::path& path,
+            const cv::DescriptorMatcher& matcher, const Feature& feature);
+
+    /** Restores the index of a matcher that the train descriptors have been
+     * added to, such that it need not be trained. Returns false if there is no
+     * such file, if the matcher does not implement PersistentIndex, or if the
+     * index was written for other train descriptors, another matcher or
+     * another feature; the matcher must then be trained. Reading takes time
+     * linear in the size of the file and the train descriptors. */
+    bool readMatcherIndex(const boost::filesystem::path& path,
+            cv::DescriptorMatcher& matcher, const Feature& feature);
+
+    /** Version of the packed modelbase layout. */
+    const uint32_t PACKED_MODELBASE_VERSION = 2;
+
+    /** Writes all models of a modelbase into a single file that can be mapped
+     * into memory by mapPackedModelbase. Descriptors, reference images and
+     * regions of interest are stored aligned to cache lines. The pack is
+     * written to a temporary file that then replaces path, such that
+     * processes that have mapped an earlier pack at path are not affected.
+     * Throws a runtime_error if the file cannot be written. */
+    void writePackedModelbase(const boost::filesystem::path& path,
+            const Modelbase& modelbase, const Feature& feature = Feature());
+
+    /** Maps a packed modelbase read-only into memory. The descriptors
+     * (including those of the views), reference images and regions of interest
+     * of the returned models point directly into the mapping, such that
+     * processes mapping the same file share one physical copy through the page
+     * cache; the mapping is released with the last model referring to it (see
+     * PlanarModel::storage). These matrices must not be written to. Keypoints
+     * are copied. Throws a runtime_error if the file is not a packed modelbase,
+     * is truncated or corrupt, or was built with a different feature. */
+    Modelbase mapPackedModelbase(const boost::filesystem::path& path,
+            const Feature& feature = Feature());
+
+}
+
+#endif
@@ -7,8 +7,14 @@
 #ifndef PROVIDE_H
 #define	PROVIDE_H
 
+#include "tpofinder/parallel.h"
+
 #include <atomic>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <memory>
 #include <opencv2/highgui/highgui.hpp>
 #include <mutex>
 #include <string>
@@ -17,41 +23,267 @@
 
 namespace tpofinder {
 
+    /** How image files are decoded. */
+    struct DecodeOptions {
+
+        DecodeOptions(bool grayscale = false, int max_pixels = 0) :
+        /*       */ grayscale(grayscale), max_pixels(max_pixels) {
+        }
+
+        /** Decode into a single gray channel; for JPEG, the colour channels
+         * are then neither upsampled nor converted. Features are computed on
+         * gray images anyway. */
+        bool grayscale;
+
+        /** If positive, images with more pixels are reduced by a factor of 2,
+         * 4 or 8 (the smallest that suffices, at most 8) in each direction
+         * right after decoding. */
+        int max_pixels;
+
+    };
+
+    /** Reads an image file as given by the options; reduction is set to the
+     * factor by which the image has been reduced. The image is empty if the
+     * file cannot be read. */
+    cv::Mat read_image(const std::string &file, const DecodeOptions &options,
+            int &reduction);
+
     class ImageProvider {
 
       public:
-        
-        ImageProvider() = default;
+
+        explicit ImageProvider(const DecodeOptions &options = DecodeOptions()) :
+        /*       */ options_(options), last_reduction_(1) {
+        }
 
         ImageProvider(const ImageProvider&) = delete;
 
         virtual ~ImageProvider() {}
 
+        /** Reads the next image. Returns false at the end of the images; an
+         * image that cannot be read is returned as an empty image, and
+         * last_error() tells why. */
         virtual bool next(cv::Mat &image) = 0;
 
+        /** Path of the image last returned by next(), if it was read from a
+         * file. */
+        const std::string &last_file() const {
+            return last_file_;
+        }
+
+        /** Why the image last returned by next() is empty; empty if it was
+         * read. */
+        const std::string &last_error() const {
+            return last_error_;
+        }
+
+        /** Factor by which the image last returned by next() has been reduced
+         * (see DecodeOptions); coordinates in the image times this factor are
+         * coordinates in the original image (see scaleDetections). */
+        int last_reduction() const {
+            return last_reduction_;
+        }
+
+      protected:
+
+        /** Reads an image file, setting last_file_, last_error_ and
+         * last_reduction_. */
+        cv::Mat read_file(const std::string &file);
+
+        DecodeOptions options_;
+
+        std::string last_file_;
+
+        std::string last_error_;
+
+        int last_reduction_;
+
+    };
+
+    /** When and in which order a frame was captured. */
+    struct FrameInfo {
+
+        FrameInfo() : sequence(0), timestamp(0), position(0), reduction(1) {
+        }
+
+        /** Number of the frame among all captured frames, starting at zero;
+         * gaps are frames that have been dropped or skipped. For video files,
+         * the number of the frame in the video. */
+        uint64_t sequence;
+
+        /** Capture time in seconds on a monotonic clock; for video files, the
+         * time the frame was decoded. */
+        double timestamp;
+
+        /** Position of the frame in a video file in seconds; zero for
+         * cameras. */
+        double position;
+
+        /** Factor by which the frame has been reduced while decoding (see
+         * DecodeOptions); frames of an image sequence may differ in size and
+         * thus in their factor. */
+        int reduction;
+
+    };
+
+    /** Hands frames from one capturing thread to one consuming thread.
+     *
+     * With the LATEST policy, frames pass through three slots: the producer
+     * fills one, the consumer reads another and the third holds the latest
+     * complete frame. Producer and consumer swap their slot with the third one
+     * by a single atomic exchange, so neither takes a lock while frames keep
+     * coming; a frame that is replaced before it was taken is dropped. The
+     * other policies queue up to capacity frames under a mutex. */
+    class FrameBuffer {
+
+      public:
+
+        enum Policy {
+            /** take() returns the latest frame; older frames are dropped. */
+            LATEST,
+            /** Frames are queued; put() waits while the queue is full. */
+            NEVER_DROP,
+            /** Frames are queued; if the queue is full, the oldest frame is
+             * dropped. */
+            QUEUE
+        };
+
+        explicit FrameBuffer(Policy policy = LATEST, size_t capacity = 4);
+
+        FrameBuffer(const FrameBuffer&) = delete;
+
+        /** Adds a frame; called by the producer. The image is taken over and
+         * replaced by a buffer that may be reused for the next frame. Returns
+         * false if the buffer has been closed. */
+        bool put(cv::Mat &image, const FrameInfo &info);
+
+        /** Removes the next frame; called by the consumer. Returns without
+         * waiting if there is a frame, and false once the buffer has been
+         * closed and no frame is left. */
+        bool take(cv::Mat &image, FrameInfo &info);
+
+        /** Ends the buffer and wakes up waiting threads. */
+        void close();
+
+        /** Number of frames dropped so far. */
+        uint64_t dropped() const;
+
+      private:
+
+        struct Slot {
+            cv::Mat image;
+            FrameInfo info;
+        };
+
+        bool putLatest(cv::Mat &image, const FrameInfo &info);
+
+        bool takeLatest(cv::Mat &image, FrameInfo &info);
+
+        Policy policy_;
+
+        size_t capacity_;
+
+        /** Slots of the LATEST policy. */
+        Slot slots_[3];
+
+        /** Index of the slot holding the latest complete frame, or'ed with
+         * FRESH if that frame has not been taken yet. */
+        std::atomic<unsigned> middle_;
+
+        /** Slot filled by the producer. */
+        unsigned back_;
+
+        /** Slot read by the consumer. */
+        unsigned front_;
+
+        /** Set while the consumer waits for a frame of the LATEST policy, such
+         * that the producer only takes the mutex if it has to wake it up. */
+        std::atomic<bool> waiting_;
+
+        /** Frames of the queueing policies. */
+        std::deque<Slot> queue_;
+
+        std::atomic<bool> closed_;
+
+        std::atomic<uint64_t> dropped_;
+
+        std::mutex mutex_;
+
+        std::condition_variable ready_;
+
+        std::condition_variable space_;
+
     };
 
+    /** Captures frames from a camera on a background thread. */
     class WebcamImageProvider : public ImageProvider {
 
         void capture_loop();
 
       public:
 
-        WebcamImageProvider();
+        WebcamImageProvider(int device = 0,
+                FrameBuffer::Policy policy = FrameBuffer::LATEST,
+                size_t capacity = 4);
 
         ~WebcamImageProvider();
 
         bool next(cv::Mat &image);
 
+        /** Like next(image), but also tells when the frame was captured. */
+        bool next(cv::Mat &image, FrameInfo &info);
+
+        /** Number of frames captured but dropped so far. */
+        uint64_t dropped() const;
+
       private:
 
         cv::VideoCapture capture_;
 
-        std::mutex image_mutex_;
+        FrameBuffer buffer_;
 
-        cv::Mat image_;
+        std::atomic<bool> stop_;
 
-        std::condition_variable ready_;
+        std::thread *worker_;
+
+    };
+
+    /** Decodes a video file, or a sequence of image files given by a
+     * printf-style pattern such as "frame-%04d.jpg", on a background thread
+     * that stays up to capacity frames ahead. Frames are never dropped; the
+     * decoding thread waits for the consumer instead. */
+    class VideoFileImageProvider : public ImageProvider {
+
+        void decode_loop();
+
+      public:
+
+        /** Starts at the given frame and returns every stride-th frame from
+         * there on. Throws if the file cannot be opened. */
+        VideoFileImageProvider(const std::string &file, size_t stride = 1,
+                size_t start = 0, const DecodeOptions &options = DecodeOptions(),
+                size_t capacity = 8);
+
+        ~VideoFileImageProvider();
+
+        bool next(cv::Mat &image);
+
+        /** Like next(image), but also tells the number and position of the
+         * frame in the video and when it was decoded. */
+        bool next(cv::Mat &image, FrameInfo &info);
+
+        /** Frames per second as stored in the file, or zero if unknown. */
+        double fps() const;
+
+      private:
+
+        cv::VideoCapture capture_;
+
+        size_t stride_;
+
+        double fps_;
+
+        FrameBuffer buffer_;
 
         std::atomic<bool> stop_;
 
@@ -63,6 +295,9 @@ namespace tpofinder {
 
       public:
 
+        explicit StdinFilenameImageProvider(
+                const DecodeOptions &options = DecodeOptions());
+
         bool next(cv::Mat &image);
 
     };
@@ -71,16 +306,93 @@ namespace tpofinder {
 
       public:
 
-        ListFilenameImageProvider(const std::vector<std::string> &files);
+        ListFilenameImageProvider(const std::vector<std::string> &files,
+                const DecodeOptions &options = DecodeOptions());
+
+        bool next(cv::Mat &image);
+
+      private:
+
+        size_t num_;
+
+        std::vector<std::string> files_;
+
+    };
+
+    /** Decodes image files ahead of time on several threads, while the
+     * images before them are processed. Images are returned in the order of
+     * the file names, which come either from a list or from a stream (one per
+     * line, up to an empty line). Decoding stops ahead of the consumer once
+     * the decoded images waiting to be taken exceed the memory budget, or
+     * once two images per thread are waiting; the next image is always
+     * decoded. */
+    class PrefetchImageProvider : public ImageProvider {
+
+      public:
+
+        PrefetchImageProvider(const std::vector<std::string> &files,
+                unsigned threads = 0, size_t memory_budget = 256 << 20,
+                const DecodeOptions &options = DecodeOptions());
+
+        /** The stream is read by the decoding threads; it must remain valid
+         * while the provider exists. */
+        PrefetchImageProvider(std::istream &files, unsigned threads = 0,
+                size_t memory_budget = 256 << 20,
+                const DecodeOptions &options = DecodeOptions());
+
+        /** Stops decoding and waits for the threads. */
+        ~PrefetchImageProvider();
 
         bool next(cv::Mat &image);
 
       private:
 
-        int num_;
+        struct Decoded {
+            cv::Mat image;
+            std::string file;
+            std::string error;
+            int reduction;
+        };
+
+        void start(unsigned threads);
+
+        /** Hands out the next file name and its number; returns false at the
+         * end of the names. */
+        bool take_file(size_t &number, std::string &file);
+
+        void decode_loop();
 
         std::vector<std::string> files_;
 
+        std::istream *stream_;
+
+        size_t memory_budget_;
+
+        /** Guards the file names and the stream. Reading the stream may block
+         * until the next name arrives; next() must not wait for that. */
+        std::mutex files_mutex_;
+
+        size_t next_file_;
+
+        std::atomic<bool> end_of_files_;
+
+        /** Guards the memory budget, the bytes waiting and taken_. */
+        std::mutex mutex_;
+
+        /** Bytes of decoded images waiting to be taken. */
+        size_t waiting_bytes_;
+
+        /** Number of images taken by next(). */
+        size_t taken_;
+
+        std::condition_variable budget_;
+
+        std::unique_ptr<OrderedQueue<Decoded> > decoded_;
+
+        std::atomic<unsigned> running_;
+
+        std::vector<std::thread> workers_;
+
     };
 
 }
@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#ifndef REPORT_H
+#define	REPORT_H
+
+#include "tpofinder/detect.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/** Writes detections in machine-readable form, as JSON lines (one object per
+ * image) or as CSV (one row per detection, and one row without a model for
+ * images without detections). */
+
+namespace tpofinder {
+
+    /** Everything but the detections that is reported about an image. */
+    struct FrameReport {
+
+        FrameReport() :
+        /*       */ frame(0), decodeTime(0), describeTime(0), detectTime(0) {
+        }
+
+        /** Number of the image in the input, starting at zero. */
+        size_t frame;
+        /** Path of the image file, if any. */
+        std::string file;
+        /** Why the image could not be read, if it could not. */
+        std::string error;
+        /** Seconds spent on decoding, describing and detecting. */
+        double decodeTime;
+        double describeTime;
+        double detectTime;
+
+    };
+
+    enum ReportFormat {
+        JSON_LINES,
+        CSV
+    };
+
+    /** Writes what comes before the first image, i.e. the header of a CSV
+     * file. */
+    void writeReportHeader(std::ostream& out, ReportFormat format);
+
+    /** Writes the detections of an image. Their homographies are written row
+     * by row. */
+    void writeReport(std::ostream& out, ReportFormat format,
+            const FrameReport& frame, const std::vector<Detection>& detections);
+
+    /** Writes a table of the number of calls, the mean, the median, the 90th
+     * and 99th percentile and the maximum latency of every stage, in
+     * milliseconds. */
+    void writeProfile(std::ostream& out, const DetectionProfile& profile);
+
+}
+
+#endif
@@ -0,0 +1,200 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#ifndef SERVE_H
+#define	SERVE_H
+
+#include "tpofinder/detect.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** A detection server keeps a trained detector in memory and detects objects
+ * in images sent to it over a Unix domain socket, such that clients do not pay
+ * for loading models and training matchers.
+ *
+ * A client sends any number of requests over a connection, each a header line
+ * optionally followed by binary data, and receives one line per request:
+ *
+ *   IMAGE <bytes>\n<encoded image>      an image file, e.g. JPEG or PNG
+ *   FRAME <cols> <rows> <channels>\n<pixels>
+ *                                       raw 8-bit gray (1 channel) or BGR
+ *                                       (3 channels) pixels, row by row
+ *   STATS\n                             statistics of the server
+ *
+ * Images are answered by a JSON line as written by writeReport, numbered per
+ * connection; the statistics are a JSON object as well. An unknown request is
+ * answered by an error and closes the connection. */
+
+namespace tpofinder {
+
+    struct ServerConfig {
+
+        ServerConfig() :
+        /*       */ workers(1), maxBatch(8), maxQueue(64) {
+        }
+
+        /** Number of threads that detect objects in batches of requests. */
+        unsigned workers;
+        /** Requests that are waiting at the same time are detected together,
+         * up to this many (see Detector::detect). */
+        size_t maxBatch;
+        /** Further requests are answered by the error "busy". */
+        size_t maxQueue;
+
+    };
+
+    struct ServerStats {
+        /** Images served, and those rejected because the queue was full. */
+        size_t requests;
+        size_t rejected;
+        /** Number of batches detected; requests / batches is the mean batch
+         * size. */
+        size_t batches;
+        /** Requests waiting for detection now, and at most so far. */
+        size_t queueDepth;
+        size_t maxQueueDepth;
+        /** Seconds from receiving the request header to sending the reply,
+         * over the last requests. */
+        double meanLatency;
+        double medianLatency;
+        double p90Latency;
+        double p99Latency;
+        double maxLatency;
+    };
+
+    class DetectionServer {
+    public:
+
+        /** Listens on a Unix domain socket at the given path, replacing a
+         * socket file left behind by an earlier server. Throws a
+         * runtime_error if that fails, or if the path is taken by another
+         * file or by a server that still listens. The detector is copied; the
+         * copy shares the models of the original (see Detector). */
+        DetectionServer(const Detector& detector, const std::string& socketPath,
+                const ServerConfig& config = ServerConfig());
+
+        DetectionServer(const DetectionServer&) = delete;
+
+        DetectionServer& operator=(const DetectionServer&) = delete;
+
+        /** Stops the server and removes the socket file. */
+        ~DetectionServer();
+
+        /** Serves connections, each on its own thread, until stop() is
+         * called. Returns once all connections are closed and all accepted
+         * requests are answered. */
+        void run();
+
+        /** Makes run() return; may be called from any thread, but not from a
+         * signal handler. */
+        void stop();
+
+        ServerStats stats() const;
+
+    private:
+
+        /** A described scene waiting for detection. */
+        struct Request {
+
+            Request() :
+            /*       */ scene(0), detectTime(0), done(false) {
+            }
+
+            const Scene* scene;
+            std::vector<Detection> detections;
+            double detectTime;
+            std::exception_ptr error;
+            bool done;
+        };
+
+        struct Connection {
+            int socket;
+            std::thread thread;
+            std::atomic<bool> closed;
+        };
+
+        /** Answers the requests of a connection until it is closed. */
+        void serve(Connection& connection);
+
+        /** Queues the request and waits until it is detected; returns false
+         * if the queue is full. */
+        bool submit(Request& request);
+
+        /** Detects the waiting requests in batches until stopped. */
+        void work();
+
+        void recordLatency(double seconds);
+
+        std::string statsLine() const;
+
+        Detector detector_;
+        std::string path_;
+        ServerConfig config_;
+        int listener_;
+        std::atomic<bool> stopping_;
+        std::list<std::shared_ptr<Connection> > connections_;
+
+        /** Guards the queue and the statistics. */
+        mutable std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable done_;
+        std::deque<Request*> queue_;
+        bool stopWorkers_;
+        size_t requests_;
+        size_t rejected_;
+        size_t batches_;
+        size_t maxQueueDepth_;
+        /** The latencies of the last requests, as a ring. */
+        std::vector<double> latencies_;
+        size_t latencyCount_;
+
+    };
+
+    /** Connects to a DetectionServer and sends requests one after another;
+     * every call returns the reply line without the line break. */
+    class DetectionClient {
+    public:
+
+        /** Throws a runtime_error if there is no server at the path. */
+        explicit DetectionClient(const std::string& socketPath);
+
+        DetectionClient(const DetectionClient&) = delete;
+
+        DetectionClient& operator=(const DetectionClient&) = delete;
+
+        ~DetectionClient();
+
+        /** Sends an encoded image, e.g. the contents of a JPEG file. */
+        std::string detect(const std::vector<uchar>& encoded);
+
+        /** Sends the pixels of an 8-bit gray or BGR image. */
+        std::string detect(const cv::Mat& frame);
+
+        std::string stats();
+
+    private:
+
+        std::string request(const std::string& header, const uchar* data,
+                size_t size);
+
+        int socket_;
+        /** Received but not yet returned. */
+        std::string buffer_;
+
+    };
+
+}
+
+#endif
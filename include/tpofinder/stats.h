@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#ifndef STATS_H
+#define	STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <stdint.h>
+
+namespace tpofinder {
+
+    /** Distribution of durations from a microsecond to minutes, with a
+     * relative error below 7%. Every power of two is split into eight
+     * buckets of equal width. Recording is lock-free, such that several
+     * threads can record into one histogram at little cost. */
+    class LatencyHistogram {
+    public:
+
+        LatencyHistogram();
+
+        LatencyHistogram(const LatencyHistogram&) = delete;
+
+        LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+        void record(double seconds);
+
+        size_t count() const;
+
+        /** Mean and maximum in seconds; zero if nothing has been recorded. */
+        double mean() const;
+
+        double max() const;
+
+        /** Returns the duration in seconds below which the given fraction of
+         * the recorded durations lie, e.g. 0.99 for the 99th percentile. */
+        double quantile(double fraction) const;
+
+        void clear();
+
+    private:
+
+        /** Durations are counted in microseconds; longer ones than 2^31
+         * microseconds end up in the last bucket. */
+        static const int BUCKETS = 30 * 8;
+
+        static int bucketOf(uint64_t micros);
+
+        /** Smallest duration in microseconds of a bucket. */
+        static uint64_t lowerBound(int bucket);
+
+        std::atomic<uint64_t> counts_[BUCKETS];
+        std::atomic<uint64_t> count_;
+        std::atomic<uint64_t> totalNanos_;
+        std::atomic<uint64_t> maxNanos_;
+
+    };
+
+    /** Adds the time from its construction to its destruction to a variable
+     * and records it in a histogram, if any. */
+    class ScopedTimer {
+    public:
+
+        explicit ScopedTimer(double& seconds, LatencyHistogram* histogram = 0) :
+        /*       */ seconds_(seconds), histogram_(histogram),
+        /*       */ start_(std::chrono::steady_clock::now()) {
+        }
+
+        ScopedTimer(const ScopedTimer&) = delete;
+
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+        ~ScopedTimer() {
+            double elapsed = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start_).count();
+            seconds_ += elapsed;
+            if (histogram_) {
+                histogram_->record(elapsed);
+            }
+        }
+
+    private:
+
+        double& seconds_;
+        LatencyHistogram* histogram_;
+        std::chrono::steady_clock::time_point start_;
+
+    };
+
+}
+
+#endif
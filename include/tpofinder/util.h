@@ -27,6 +27,11 @@ namespace tpofinder {
             std::vector<cv::KeyPoint>& dst,
             const cv::Mat& mtx);
 
+    /** Allocates a continuous matrix whose data starts at a multiple of the
+     * given alignment (a power of two and a multiple of the element size). The
+     * matrix owns its data like any other matrix. */
+    cv::Mat createAligned(int rows, int cols, int type, size_t alignment = 64);
+
     std::vector<int> findInliers(const std::vector<cv::Point2f>& pts1,
             const std::vector<cv::Point2f>& pts2, const cv::Mat& homography,
             const float reprojThreshold = 3.0);
@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#ifndef VOCABULARY_H
+#define	VOCABULARY_H
+
+#include <opencv2/core/core.hpp>
+#include <utility>
+#include <vector>
+
+namespace tpofinder {
+
+    /** Sparse bag-of-words vector: pairs of word and weight, sorted by
+     * word. */
+    typedef std::vector<std::pair<int, float> > BowVector;
+
+    /** Hierarchical vocabulary of visual words for binary descriptors (see
+     * Nister and Stewenius, "Scalable recognition with a vocabulary tree",
+     * CVPR 2006). Every level splits the descriptors by k-majority clustering:
+     * like k-means, but under the Hamming distance and with the bitwise
+     * majority of the members as cluster center. A descriptor is quantized by
+     * descending to the nearest child at every level, which costs
+     * branching * depth distance computations regardless of the number of
+     * words. The leaves are the words; each word is weighted by its inverse
+     * document frequency in the training documents. */
+    class VocabularyTree {
+    public:
+
+        VocabularyTree(int branching = 10, int depth = 4, int iterations = 10,
+                int maxSamples = 200000);
+
+        /** Learns the words from the descriptors of several documents (e.g.
+         * models). At most maxSamples descriptors are clustered. Descriptors
+         * must be of type CV_8U. The inverse document frequency of a word
+         * that occurs in n of N documents is log(1 + N / n). */
+        void build(const std::vector<cv::Mat>& documents);
+
+        bool empty() const;
+
+        /** Number of words; the words are numbered from zero. */
+        int words() const;
+
+        /** Returns the word of a single descriptor. */
+        int quantize(const uchar* descriptor) const;
+
+        /** Returns the L1-normalized term frequency - inverse document
+         * frequency vector of a set of descriptors. */
+        BowVector transform(const cv::Mat& descriptors) const;
+
+    private:
+
+        struct Node {
+            /** Index of the first child in nodes_; children are
+             * consecutive. */
+            int firstChild;
+            int children;
+            /** Word of a leaf, -1 for inner nodes. */
+            int word;
+        };
+
+        /** Clusters the descriptors of a node into its children. */
+        void split(int node, const std::vector<const uchar*>& descriptors,
+                int level);
+
+        int distance(const uchar* descriptor, int node) const;
+
+        int branching_;
+        int depth_;
+        int iterations_;
+        int maxSamples_;
+        int bytes_;
+        std::vector<Node> nodes_;
+        /** Cluster centers of the nodes, bytes_ per node. */
+        std::vector<uchar> centers_;
+        std::vector<float> idf_;
+
+    };
+
+    /** Maps words to the documents they occur in, and scores documents by
+     * their similarity to a query. */
+    class InvertedFile {
+    public:
+
+        /** Adds a document with the given identifier. */
+        void add(int document, const BowVector& bow);
+
+        /** Adds the similarity of every document to the query to
+         * scores[document]; scores must be large enough for all identifiers.
+         * The similarity of two L1-normalized vectors q and d is the sum of
+         * min(q_w, d_w) over all words, i.e. 1 - |q - d|_1 / 2. */
+        void score(const BowVector& query, std::vector<float>& scores) const;
+
+    private:
+
+        std::vector<std::vector<std::pair<int, float> > > postings_;
+
+    };
+
+}
+
+#endif
@@ -0,0 +1,54 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "tpofinder/configure.h"
+#include "tpofinder/defaults.h"
+#include "tpofinder/match.h"
+
+using namespace cv;
+using namespace std;
+namespace bfs = boost::filesystem;
+
+namespace tpofinder {
+
+    Ptr<DescriptorMatcher> createMatcher(const string& name) {
+        if (name == "hamming") {
+            return new HammingMatcher();
+        } else if (name == "mih") {
+            return new MihMatcher();
+        } else if (name == "lsh") {
+            return new FlannBasedMatcher(new flann::LshIndexParams(15, 12, 2));
+        }
+        return Ptr<DescriptorMatcher>();
+    }
+
+    Feature sceneFeature(const Ptr<DescriptorMatcher>& matcher) {
+        return Feature(new OrbFeatureDetector(1000, 1.2, 8),
+                new OrbDescriptorExtractor(1000, 1.2, 8), matcher);
+    }
+
+    Feature modelFeature(const Ptr<DescriptorMatcher>& matcher) {
+        return Feature(new OrbFeatureDetector(250, 1.2, 8),
+                new OrbDescriptorExtractor(1000, 1.2, 8), matcher);
+    }
+
+    Ptr<DetectionFilter> createDefaultFilter() {
+        return new AndFilter(
+                Ptr<DetectionFilter> (new EigenvalueFilter(-1, 4.0)),
+                Ptr<DetectionFilter> (new InliersRatioFilter(0.30)));
+    }
+
+    vector<bfs::path> defaultModelPaths() {
+        vector<bfs::path> paths;
+        paths.push_back(PROJECT_BINARY_DIR + "/data/adapter");
+        paths.push_back(PROJECT_BINARY_DIR + "/data/blokus");
+        paths.push_back(PROJECT_BINARY_DIR + "/data/stockholm");
+        paths.push_back(PROJECT_BINARY_DIR + "/data/taco");
+        paths.push_back(PROJECT_BINARY_DIR + "/data/tea");
+        return paths;
+    }
+
+}
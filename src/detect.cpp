@@ -5,9 +5,12 @@
  */
 
 #include "tpofinder/detect.h"
+#include "tpofinder/persist.h"
 #include "tpofinder/util.h"
 
+#include <algorithm>
 #include <boost/foreach.hpp>
+#include <map>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/features2d/features2d.hpp>
 #include <stdarg.h>
@@ -18,65 +21,618 @@ using namespace std;
 namespace tpofinder {
 
     Detector::Detector(const Modelbase& modelbase, const Feature& feature,
-            const cv::Ptr<DetectionFilter> filter, double reprojThreshold) :
-    /*       */ modelbase_(modelbase), feature_(feature), filter_(filter),
-    /*       */ reprojThreshold_(reprojThreshold) {
-        vector<Mat> descriptors;
+            const cv::Ptr<DetectionFilter> filter, double reprojThreshold,
+            unsigned threads, const MatchConfig& matching, const string& indexPath) :
+    /*       */ modelFeature_(modelbase.feature()), feature_(feature),
+    /*       */ filter_(filter), estimator_(reprojThreshold), matching_(matching),
+    /*       */ pool_(make_shared<ThreadPool>(threads)),
+    /*       */ describeMutex_(make_shared<mutex>()),
+    /*       */ profile_(make_shared<DetectionProfile>()) {
+        shared_ptr<Index> index = make_shared<Index>();
+        vector<int> slots;
 
-        BOOST_FOREACH(const PlanarModel& m, modelbase_.models) {
-            descriptors.push_back(m.allDescriptors);
+        BOOST_FOREACH(const PlanarModel& m, modelbase.models) {
+            slots.push_back(index->models.size());
+            index->models.push_back(make_shared<const PlanarModel>(m));
+        }
+        if (!slots.empty()) {
+            if (matching_.shortlist > 0) {
+                learnVocabulary(*index);
+            }
+            index->segments.push_back(train(slots, *index, true, indexPath));
+            if (index->vocabulary) {
+                trainModelSegments(*index);
+            }
         }
-        feature_.matcher->add(descriptors);
-        feature_.matcher->train();
+        index_ = index;
+    }
+
+    Detector::Detector(const Detector& other) :
+    /*       */ modelFeature_(other.modelFeature_), feature_(other.feature_),
+    /*       */ filter_(other.filter_), estimator_(other.estimator_),
+    /*       */ matching_(other.matching_),
+    /*       */ pool_(other.pool_), index_(other.snapshot()),
+    /*       */ describeMutex_(other.describeMutex_),
+    /*       */ profile_(other.profile_) {
     }
 
-    Scene Detector::describe(const Mat& sceneImage) {
+    Detector& Detector::operator=(const Detector& other) {
+        if (this != &other) {
+            lock_guard<mutex> update(updateMutex_);
+            modelFeature_ = other.modelFeature_;
+            feature_ = other.feature_;
+            filter_ = other.filter_;
+            estimator_ = other.estimator_;
+            matching_ = other.matching_;
+            pool_ = other.pool_;
+            describeMutex_ = other.describeMutex_;
+            profile_ = other.profile_;
+            publish(other.snapshot());
+        }
+        return *this;
+    }
+
+    void Detector::prepare(DetectionContext& context) const {
+        if (context.sourceDetector_ == feature_.detector
+                && context.sourceExtractor_ == feature_.extractor) {
+            return;
+        }
+        context.sourceDetector_ = feature_.detector;
+        context.sourceExtractor_ = feature_.extractor;
+        context.shared_ = !feature_.copyable();
+        if (context.shared_) {
+            context.detector_ = feature_.detector;
+            context.extractor_ = feature_.extractor;
+        } else {
+            Feature copy = feature_.copy();
+            context.detector_ = copy.detector;
+            context.extractor_ = copy.extractor;
+        }
+    }
+
+    Scene Detector::describe(const Mat& sceneImage) const {
+        // Copying the algorithms would cost more than waiting for other
+        // threads that describe a scene without a context.
+        DetectionContext context;
+        context.sourceDetector_ = feature_.detector;
+        context.sourceExtractor_ = feature_.extractor;
+        context.detector_ = feature_.detector;
+        context.extractor_ = feature_.extractor;
+        context.shared_ = true;
+        return describe(sceneImage, context);
+    }
+
+    Scene Detector::describe(const Mat& sceneImage, DetectionContext& context) const {
         CV_Assert(!sceneImage.empty());
+        prepare(context);
+        unique_lock<mutex> lock(*describeMutex_, defer_lock);
+        if (context.shared_) {
+            lock.lock();
+        }
+        DetectionStats& stats = context.stats_;
+        stats = DetectionStats();
         vector<KeyPoint> kpts;
-        feature_.detector->detect(sceneImage, kpts);
+        {
+            ScopedTimer timer(stats.keypointTime, &profile_->keypoints);
+            context.detector_->detect(sceneImage, kpts);
+        }
         cv::Mat descs;
-        feature_.extractor->compute(sceneImage, kpts, descs);
+        {
+            ScopedTimer timer(stats.extractTime, &profile_->extract);
+            context.extractor_->compute(sceneImage, kpts, descs);
+        }
+        stats.keypoints = kpts.size();
         return Scene(sceneImage, kpts, descs);
     }
 
-    vector<DMatch> Detector::match(const Scene& scene) {
+    void Detector::findNeighbours(const Mat& descriptors, const Index& index,
+            const vector<shared_ptr<const Segment> >& segments,
+            DetectionContext& context) const {
+        // Each descriptor keeps its k nearest neighbours over all segments.
+        // Segments are visited in order of creation and ties are resolved in
+        // favour of the earlier segment, as a single matcher would do.
+        const int k = matching_.maxRatio < 1 ? 2 : 1;
+        vector<DMatch>& nearest = context.nearest_;
+        nearest.assign(descriptors.rows * k, DMatch());
+
+        BOOST_FOREACH(const shared_ptr<const Segment>& segment, segments) {
+            vector<vector<DMatch> >& knn = context.knn_;
+            segment->matcher->knnMatch(descriptors, knn, k);
+
+            BOOST_FOREACH(const vector<DMatch>& neighbours, knn) {
+
+                BOOST_FOREACH(DMatch m, neighbours) {
+                    m.imgIdx = segment->slots[m.imgIdx];
+                    if (!index.models[m.imgIdx]) {
+                        continue;
+                    }
+                    DMatch* best = &nearest[m.queryIdx * k];
+                    int j = k - 1;
+                    if (!(m.distance < best[j].distance)) {
+                        continue;
+                    }
+                    for (; j > 0 && best[j - 1].distance > m.distance; j--) {
+                        best[j] = best[j - 1];
+                    }
+                    best[j] = m;
+                }
+            }
+        }
+    }
+
+    vector<DMatch> Detector::match(const Scene& scene, const Index& index,
+            const vector<shared_ptr<const Segment> >& segments,
+            DetectionContext& context) const {
+        findNeighbours(scene.descriptors, index, segments, context);
+        return select(scene, 0, index, context);
+    }
+
+    vector<DMatch> Detector::select(const Scene& scene, int offset,
+            const Index& index, DetectionContext& context) const {
+        const int k = matching_.maxRatio < 1 ? 2 : 1;
         vector<DMatch> matches;
-        feature_.matcher->match(scene.descriptors, matches);
+        matches.reserve(scene.descriptors.rows);
+        for (int q = 0; q < scene.descriptors.rows; q++) {
+            const DMatch* best = &context.nearest_[(offset + q) * k];
+            if (best[0].imgIdx < 0) {
+                continue;
+            }
+            if (k > 1 && best[1].imgIdx >= 0
+                    && !(best[0].distance < matching_.maxRatio * best[1].distance)) {
+                continue;
+            }
+            matches.push_back(best[0]);
+            matches.back().queryIdx = q;
+        }
+
+        if (matching_.crossCheck) {
+            crossCheck(scene, index, matches, context);
+        }
         return matches;
     }
 
-    vector<Detection> Detector::detect(const Scene& scene) {
+    void Detector::crossCheck(const Scene& scene, const Index& index,
+            vector<DMatch>& matches, DetectionContext& context) const {
+        if (matches.empty()) {
+            return;
+        }
+
+        // Match the model descriptors that occur in the matches back against
+        // the scene; every model descriptor is looked up once.
+        map<pair<int, int>, int> rows;
+
+        BOOST_FOREACH(const DMatch& m, matches) {
+            rows.insert(make_pair(make_pair(m.imgIdx, m.trainIdx), (int) rows.size()));
+        }
+        Mat modelDescriptors(rows.size(), scene.descriptors.cols,
+                scene.descriptors.type());
+        for (map<pair<int, int>, int>::const_iterator it = rows.begin();
+                it != rows.end(); ++it) {
+            Mat row = modelDescriptors.row(it->second);
+            index.models[it->first.first]->allDescriptors.row(it->first.second).copyTo(row);
+        }
+
+        if (context.sourceMatcher_ != feature_.matcher) {
+            context.sourceMatcher_ = feature_.matcher;
+            context.crossMatcher_ = feature_.matcher->clone(true);
+        }
+        Ptr<DescriptorMatcher> matcher = context.crossMatcher_;
+        matcher->clear();
+        matcher->add(vector<Mat>(1, scene.descriptors));
+        matcher->train();
+        vector<DMatch> reverse;
+        matcher->match(modelDescriptors, reverse);
+
+        vector<int> nearestScene(rows.size(), -1);
+
+        BOOST_FOREACH(const DMatch& r, reverse) {
+            nearestScene[r.queryIdx] = r.trainIdx;
+        }
+
+        vector<DMatch> checked;
+        checked.reserve(matches.size());
+
+        BOOST_FOREACH(const DMatch& m, matches) {
+            int row = rows[make_pair(m.imgIdx, m.trainIdx)];
+            if (nearestScene[row] == m.queryIdx) {
+                checked.push_back(m);
+            }
+        }
+        matches.swap(checked);
+    }
+
+    vector<Detection> Detector::detect(const Scene& scene) const {
+        DetectionContext context;
+        return detect(scene, context);
+    }
+
+    vector<Detection> Detector::detect(const Scene& scene,
+            DetectionContext& context) const {
+        return move(detect(vector<const Scene*>(1, &scene), context)[0]);
+    }
+
+    vector<vector<Detection> > Detector::detect(const vector<const Scene*>& scenes,
+            DetectionContext& context) const {
+        shared_ptr<const Index> index = snapshot();
+        vector<vector<Detection> > detections(scenes.size());
+
+        // Keep the stats of the last description.
+        DetectionStats& stats = context.stats_;
+        DetectionStats described = stats;
+        stats = DetectionStats();
+        stats.keypointTime = described.keypointTime;
+        stats.extractTime = described.extractTime;
+        stats.keypoints = described.keypoints;
+        ScopedTimer timer(stats.detectTime, &profile_->detect);
+
+        size_t live = 0;
+
+        BOOST_FOREACH(const shared_ptr<const PlanarModel>& m, index->models) {
+            live += m ? 1 : 0;
+        }
+
+        if (matching_.shortlist > 0 && index->vocabulary
+                && live > (size_t) matching_.shortlist) {
+            // Match every scene against the segments of its shortlisted models
+            // only; shortlisting counts as matching.
+            for (size_t i = 0; i < scenes.size(); i++) {
+                vector<DMatch> matches;
+                {
+                    ScopedTimer timer(stats.matchTime, &profile_->match);
+                    vector<shared_ptr<const Segment> > segments;
+
+                    BOOST_FOREACH(int s, shortlist(*scenes[i], *index)) {
+                        segments.push_back(index->modelSegments[s]);
+                    }
+                    matches = match(*scenes[i], *index, segments, context);
+                }
+                detections[i] = verifyCandidates(*scenes[i], *index, matches,
+                        context);
+            }
+            return detections;
+        }
+
+        // Stack the descriptors of all scenes, such that every segment is
+        // queried once; the descriptors of scene i start at row offsets[i].
+        vector<int> offsets(scenes.size(), 0);
+        vector<Mat> parts;
+        int rows = 0;
+        for (size_t i = 0; i < scenes.size(); i++) {
+            offsets[i] = rows;
+            rows += scenes[i]->descriptors.rows;
+            if (scenes[i]->descriptors.rows > 0) {
+                parts.push_back(scenes[i]->descriptors);
+            }
+        }
+        Mat stacked;
+        if (parts.size() == 1) {
+            stacked = parts[0];
+        } else if (parts.size() > 1) {
+            vconcat(parts, stacked);
+        }
+
+        vector<vector<DMatch> > matches(scenes.size());
+        {
+            ScopedTimer timer(stats.matchTime, &profile_->match);
+            findNeighbours(stacked, *index, index->segments, context);
+            for (size_t i = 0; i < scenes.size(); i++) {
+                matches[i] = select(*scenes[i], offsets[i], *index, context);
+            }
+        }
+        for (size_t i = 0; i < scenes.size(); i++) {
+            detections[i] = verifyCandidates(*scenes[i], *index, matches[i],
+                    context);
+        }
+        return detections;
+    }
+
+    vector<Detection> Detector::verifyCandidates(const Scene& scene,
+            const Index& index, const vector<DMatch>& matches,
+            DetectionContext& context) const {
+        // Distribute the matches to their models in a single pass.
+        vector<vector<DMatch> >& buckets = context.buckets_;
+        buckets.resize(index.models.size());
+
+        BOOST_FOREACH(vector<DMatch>& bucket, buckets) {
+            bucket.clear();
+        }
+
+        BOOST_FOREACH(const DMatch& m, matches) {
+            buckets[m.imgIdx].push_back(m);
+        }
+        context.stats_.matches += matches.size();
+
+        // Homographies need at least four matches.
+        const int minSupport = max(4, matching_.minSupport);
+        vector<int> candidates;
+        for (size_t i = 0; i < buckets.size(); i++) {
+            if (index.models[i] && (int) buckets[i].size() >= minSupport) {
+                candidates.push_back(i);
+            }
+        }
+
+        // Candidates are verified independently of each other; collecting the
+        // results in the order of the candidates keeps the output independent
+        // of scheduling.
+        vector<Detection> results(candidates.size());
+        vector<char> accepted(candidates.size(), 0);
+        vector<DetectionStats> verified(candidates.size());
+        pool_->parallelFor(candidates.size(), [&](size_t k) {
+            int i = candidates[k];
+            accepted[k] = verify(scene, index.models[i], buckets[i], results[k],
+                    verified[k]);
+        });
+
         vector<Detection> detections;
-        vector<DMatch> matches = match(scene);
-
-        for (size_t i = 0; i < modelbase_.models.size(); i++) {
-            const PlanarModel& model = modelbase_.models[i];
-
-            vector<Point2f> scenePoints, modelPoints;
-            vector<DMatch> modelMatches;
-            for (size_t j = 0; j < matches.size(); j++) {
-                if ((size_t) matches[j].imgIdx == i) {
-                    scenePoints.push_back(scene.keypoints[matches[j].queryIdx].pt);
-                    modelPoints.push_back(model.allKeypoints[matches[j].trainIdx].pt);
-                    modelMatches.push_back(matches[j]);
+        for (size_t k = 0; k < results.size(); k++) {
+            context.stats_ += verified[k];
+            if (accepted[k]) {
+                detections.push_back(move(results[k]));
+            }
+        }
+        context.stats_.candidates += candidates.size();
+        context.stats_.detections += detections.size();
+        return detections;
+    }
+
+    bool Detector::verify(const Scene& scene,
+            const shared_ptr<const PlanarModel>& model,
+            vector<DMatch>& matches, Detection& detection,
+            DetectionStats& stats) const {
+        // PROSAC samples the best-ranked matches first.
+        stable_sort(matches.begin(), matches.end());
+
+        vector<Point2f> scenePoints, modelPoints;
+        scenePoints.reserve(matches.size());
+        modelPoints.reserve(matches.size());
+
+        BOOST_FOREACH(const DMatch& m, matches) {
+            scenePoints.push_back(scene.keypoints[m.queryIdx].pt);
+            modelPoints.push_back(model->allKeypoints[m.trainIdx].pt);
+        }
+
+        // TODO: Depending on whether they use symmetric error criteria
+        // for determining RANSAC inliers, it might be a difference
+        // whether the homography between model and scene is computed
+        // or its inverse homography (i.e. between scene and model).
+        HomographyEstimate estimate;
+        {
+            ScopedTimer timer(stats.verifyTime, &profile_->verify);
+            estimate = estimator_.estimate(modelPoints, scenePoints);
+        }
+        stats.iterations += estimate.iterations;
+        if (estimate.homography.empty()) {
+            return false;
+        }
+        detection = Detection(model, estimate.homography, move(matches),
+                move(estimate.inliers));
+        ScopedTimer timer(stats.filterTime, &profile_->filter);
+        return filter_->accept(detection);
+    }
+
+    void Detector::addModel(const PlanarModel& model) {
+        lock_guard<mutex> update(updateMutex_);
+        shared_ptr<Index> index = make_shared<Index>(*snapshot());
+        index->models.push_back(make_shared<const PlanarModel>(model));
+        if (matching_.shortlist > 0 && !index->vocabulary) {
+            // The first model with a shortlist: learn a vocabulary and index
+            // the words of all models in a single segment.
+            learnVocabulary(*index);
+            vector<int> slots;
+            for (size_t i = 0; i < index->models.size(); i++) {
+                if (index->models[i]) {
+                    slots.push_back(i);
                 }
             }
+            index->segments.assign(1, train(slots, *index));
+            if (index->vocabulary) {
+                trainModelSegments(*index);
+            }
+        } else {
+            shared_ptr<const Segment> segment =
+                    train(vector<int>(1, index->models.size() - 1), *index);
+            index->segments.push_back(segment);
+            if (index->vocabulary) {
+                // The segment of the new model is its own.
+                index->modelSegments.push_back(segment);
+            }
+        }
+        publish(index);
+    }
+
+    bool Detector::removeModel(const string& name) {
+        lock_guard<mutex> update(updateMutex_);
+        shared_ptr<Index> index = make_shared<Index>(*snapshot());
+
+        size_t slot = 0;
+        while (slot < index->models.size()
+                && !(index->models[slot] && index->models[slot]->name == name)) {
+            slot++;
+        }
+        if (slot == index->models.size()) {
+            return false;
+        }
+        index->models[slot].reset();
+        if (slot < index->modelSegments.size()) {
+            index->modelSegments[slot].reset();
+        }
+
+        // Segments without any remaining model can be dropped right away.
+        vector<shared_ptr<const Segment> > segments;
+
+        BOOST_FOREACH(const shared_ptr<const Segment>& segment, index->segments) {
 
-            if (scenePoints.size() >= 4) {
-                // TODO: Depending on whether they use symmetric error criteria
-                // for determining RANSAC inliers, it might be a difference
-                // whether the homography between model and scene is computed
-                // or its inverse homography (i.e. between scene and model).
-                Mat h = findHomography(modelPoints, scenePoints, CV_RANSAC, reprojThreshold_);
-                vector<int> inliers = findInliers(modelPoints, scenePoints, h, reprojThreshold_);
-                Detection d(model, h, modelMatches, inliers);
-                if (filter_->accept(d)) {
-                    detections.push_back(d);
+            BOOST_FOREACH(int s, segment->slots) {
+                if (index->models[s]) {
+                    segments.push_back(segment);
+                    break;
                 }
             }
         }
+        index->segments.swap(segments);
 
-        return detections;
+        publish(index);
+        return true;
+    }
+
+    void Detector::compact() {
+        lock_guard<mutex> update(updateMutex_);
+        shared_ptr<const Index> old = snapshot();
+        shared_ptr<Index> index = make_shared<Index>();
+        index->vocabulary = old->vocabulary;
+        vector<int> slots;
+
+        for (size_t i = 0; i < old->models.size(); i++) {
+            if (!old->models[i]) {
+                continue;
+            }
+            if (i < old->modelSegments.size()) {
+                // Keep the trained matcher of the model, but refer to its new
+                // slot.
+                shared_ptr<Segment> segment = make_shared<Segment>();
+                segment->matcher = old->modelSegments[i]->matcher;
+                segment->slots.assign(1, index->models.size());
+                index->modelSegments.push_back(segment);
+            }
+            slots.push_back(index->models.size());
+            index->models.push_back(old->models[i]);
+        }
+        if (!slots.empty()) {
+            index->segments.push_back(train(slots, *index));
+        }
+        publish(index);
+    }
+
+    size_t Detector::segments() const {
+        return snapshot()->segments.size();
+    }
+
+    Modelbase Detector::modelbase() const {
+        shared_ptr<const Index> index = snapshot();
+        Modelbase modelbase(modelFeature_);
+
+        BOOST_FOREACH(const shared_ptr<const PlanarModel>& m, index->models) {
+            if (m) {
+                modelbase.add(*m);
+            }
+        }
+        return modelbase;
+    }
+
+    shared_ptr<const Detector::Segment> Detector::train(const vector<int>& slots,
+            const Index& index, bool words, const string& indexPath) const {
+        shared_ptr<Segment> segment = make_shared<Segment>();
+        segment->matcher = feature_.matcher->clone(true);
+        segment->slots = slots;
+
+        vector<Mat> descriptors;
+
+        BOOST_FOREACH(int s, slots) {
+            descriptors.push_back(index.models[s]->allDescriptors);
+        }
+        segment->matcher->add(descriptors);
+        if (indexPath.empty()) {
+            segment->matcher->train();
+        } else if (!readMatcherIndex(indexPath, *segment->matcher, modelFeature_)) {
+            segment->matcher->train();
+            writeMatcherIndex(indexPath, *segment->matcher, modelFeature_);
+        }
+
+        if (words && index.vocabulary) {
+
+            BOOST_FOREACH(int s, slots) {
+                segment->words.add(s,
+                        index.vocabulary->transform(index.models[s]->allDescriptors));
+            }
+        }
+        return segment;
+    }
+
+    void Detector::learnVocabulary(Index& index) const {
+        vector<Mat> documents;
+
+        BOOST_FOREACH(const shared_ptr<const PlanarModel>& m, index.models) {
+            if (m) {
+                documents.push_back(m->allDescriptors);
+            }
+        }
+        shared_ptr<VocabularyTree> vocabulary = make_shared<VocabularyTree>();
+        vocabulary->build(documents);
+        if (!vocabulary->empty()) {
+            index.vocabulary = vocabulary;
+        }
+    }
+
+    void Detector::trainModelSegments(Index& index) const {
+        while (index.modelSegments.size() < index.models.size()) {
+            int slot = index.modelSegments.size();
+            shared_ptr<const Segment> segment;
+            if (index.models[slot]) {
+                segment = train(vector<int>(1, slot), index, false);
+            }
+            index.modelSegments.push_back(segment);
+        }
+    }
+
+    vector<int> Detector::shortlist(const Scene& scene, const Index& index) const {
+        BowVector words = index.vocabulary->transform(scene.descriptors);
+        vector<float> scores(index.models.size(), 0);
+
+        BOOST_FOREACH(const shared_ptr<const Segment>& segment, index.segments) {
+            segment->words.score(words, scores);
+        }
+
+        vector<int> slots;
+        for (size_t i = 0; i < index.models.size(); i++) {
+            if (index.models[i] && scores[i] > 0) {
+                slots.push_back(i);
+            }
+        }
+        size_t k = min(slots.size(), (size_t) matching_.shortlist);
+        partial_sort(slots.begin(), slots.begin() + k, slots.end(),
+                [&](int a, int b) {
+                    return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+                });
+        slots.resize(k);
+        sort(slots.begin(), slots.end());
+        return slots;
+    }
+
+    shared_ptr<const Detector::Index> Detector::snapshot() const {
+        lock_guard<mutex> lock(indexMutex_);
+        return index_;
+    }
+
+    void Detector::publish(const shared_ptr<const Index>& index) {
+        lock_guard<mutex> lock(indexMutex_);
+        index_ = index;
+    }
+
+    DetectionProfile& Detector::profile() const {
+        return *profile_;
+    }
+
+    DetectionStats& DetectionStats::operator+=(const DetectionStats& other) {
+        keypointTime += other.keypointTime;
+        extractTime += other.extractTime;
+        matchTime += other.matchTime;
+        verifyTime += other.verifyTime;
+        filterTime += other.filterTime;
+        detectTime += other.detectTime;
+        keypoints += other.keypoints;
+        matches += other.matches;
+        candidates += other.candidates;
+        iterations += other.iterations;
+        detections += other.detections;
+        return *this;
+    }
+
+    void scaleDetections(vector<Detection>& detections, double factor) {
+        Mat scaling = (Mat_<double>(3, 3) << factor, 0, 0, 0, factor, 0, 0, 0, 1);
+
+        BOOST_FOREACH(Detection& d, detections) {
+            d.homography = scaling * d.homography;
+        }
     }
 
     bool MagicHomographyFilter::accept(const Detection& detection) {
@@ -0,0 +1,313 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "tpofinder/estimate.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace cv;
+using namespace std;
+
+namespace tpofinder {
+
+    /** non-public interface */
+    namespace {
+
+        /** Number of point pairs that determine a homography. */
+        const int SAMPLE_SIZE = 4;
+
+        /** Cost of computing a hypothesis relative to checking one point pair
+         * against it, as used for tuning the sequential test. */
+        const double HYPOTHESIS_COST = 200.0;
+
+        /** Initial guesses of the probability that a point pair is consistent
+         * with a good and with a bad hypothesis. */
+        const double INITIAL_EPSILON = 0.1;
+        const double INITIAL_DELTA = 0.01;
+
+        /** Maximum number of least-squares refits of a new best
+         * hypothesis. */
+        const int MAX_REFITS = 3;
+
+        /** Seed of the sampling; fixed such that the estimation is
+         * reproducible. */
+        const uint64 SEED = 0x5eed;
+
+        /** Returns whether h maps s within a distance of sqrt(threshold2)
+         * onto d. */
+        inline bool consistent(const double* h, const Point2f& s,
+                const Point2f& d, double threshold2) {
+            double w = h[6] * s.x + h[7] * s.y + h[8];
+            if (fabs(w) < DBL_EPSILON) {
+                return false;
+            }
+            double dx = (h[0] * s.x + h[1] * s.y + h[2]) / w - d.x;
+            double dy = (h[3] * s.x + h[4] * s.y + h[5]) / w - d.y;
+            return dx * dx + dy * dy <= threshold2;
+        }
+
+        inline bool collinear(const Point2f& a, const Point2f& b,
+                const Point2f& c) {
+            double cross = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+            return fabs(cross) < 1e-2;
+        }
+
+        /** Returns whether any three of the four points lie on a line, in
+         * which case they do not determine a homography. */
+        bool degenerate(const Point2f* p) {
+            return collinear(p[0], p[1], p[2]) || collinear(p[0], p[1], p[3])
+                    || collinear(p[0], p[2], p[3]) || collinear(p[1], p[2], p[3]);
+        }
+
+        /** Decision threshold of the sequential test for the given
+         * probabilities that a point pair is consistent with a good
+         * (epsilon) and with a bad (delta) hypothesis. */
+        double sprtThreshold(double epsilon, double delta) {
+            double c = (1 - delta) * log((1 - delta) / (1 - epsilon))
+                    + delta * log(delta / epsilon);
+            double a0 = HYPOTHESIS_COST * c + 1;
+            double a = a0;
+            for (int i = 0; i < 10; i++) {
+                a = a0 + log(a);
+            }
+            return a;
+        }
+
+        /** Smallest number of inliers among the first n pairs that is
+         * unlikely (at 5% significance) to be the support of a bad hypothesis,
+         * which is consistent with each pair outside its sample with
+         * probability delta. */
+        double minimalSupport(int n, double delta) {
+            double trials = n - SAMPLE_SIZE;
+            return SAMPLE_SIZE + trials * delta
+                    + 1.645 * sqrt(trials * delta * (1 - delta));
+        }
+
+        /** Marks the pairs consistent with h and returns their number. */
+        int findSupport(const Mat& h, const vector<Point2f>& src,
+                const vector<Point2f>& dst, double threshold2,
+                vector<char>& mask) {
+            const double* hd = h.ptr<double>();
+            int count = 0;
+            for (size_t i = 0; i < src.size(); i++) {
+                mask[i] = consistent(hd, src[i], dst[i], threshold2);
+                count += mask[i];
+            }
+            return count;
+        }
+
+        /** Fits a homography to the marked pairs by least squares. */
+        Mat refit(const vector<Point2f>& src, const vector<Point2f>& dst,
+                const vector<char>& mask) {
+            vector<Point2f> srcInliers, dstInliers;
+            for (size_t i = 0; i < src.size(); i++) {
+                if (mask[i]) {
+                    srcInliers.push_back(src[i]);
+                    dstInliers.push_back(dst[i]);
+                }
+            }
+            Mat h = findHomography(srcInliers, dstInliers, 0);
+            if (h.empty() || !checkRange(h)) {
+                return Mat();
+            }
+            return h;
+        }
+
+    }
+
+    HomographyEstimate ProsacEstimator::estimate(const vector<Point2f>& src,
+            const vector<Point2f>& dst) const {
+        CV_Assert(src.size() == dst.size());
+
+        HomographyEstimate result;
+        const int N = src.size();
+        if (N < SAMPLE_SIZE) {
+            return result;
+        }
+        const double threshold2 = reprojThreshold * reprojThreshold;
+        RNG rng(SEED);
+
+        // The sequential test assumes that the point pairs are checked in
+        // random order; the pairs are sorted by quality though.
+        vector<int> order(N);
+        for (int i = 0; i < N; i++) {
+            order[i] = i;
+        }
+        for (int i = N - 1; i > 0; i--) {
+            swap(order[i], order[rng.uniform(0, i + 1)]);
+        }
+
+        // Growth function of PROSAC: after tn samples from the first n pairs
+        // a uniform sampler would have drawn as many samples from them as
+        // maxIterations samples from all pairs contain.
+        int n = SAMPLE_SIZE;
+        double Tn = maxIterations;
+        for (int i = 0; i < SAMPLE_SIZE; i++) {
+            Tn *= double(n - i) / (N - i);
+        }
+        double tn = 1;
+
+        double epsilon = INITIAL_EPSILON;
+        double delta = INITIAL_DELTA;
+        double A = sprtThreshold(epsilon, delta);
+        double rejectedDelta = 0;
+
+        Mat best;
+        int bestCount = 0;
+        vector<char> bestMask;
+        int limit = maxIterations;
+
+        vector<char> mask(N);
+        Point2f s[SAMPLE_SIZE], d[SAMPLE_SIZE];
+        int sample[SAMPLE_SIZE];
+
+        for (int t = 1; t <= limit; t++) {
+            result.iterations = t;
+
+            if (t > tn && n < N) {
+                double Tn1 = Tn * (n + 1) / (n + 1 - SAMPLE_SIZE);
+                tn += ceil(Tn1 - Tn);
+                Tn = Tn1;
+                n++;
+            }
+
+            // Either draw all pairs from the first n, or take the n-th pair
+            // and draw the rest from the first n - 1.
+            int k = 0;
+            int range = n;
+            if (tn >= t) {
+                sample[k++] = n - 1;
+                range = n - 1;
+            }
+            while (k < SAMPLE_SIZE) {
+                int j = rng.uniform(0, range);
+                if (find(sample, sample + k, j) == sample + k) {
+                    sample[k++] = j;
+                }
+            }
+            for (int i = 0; i < SAMPLE_SIZE; i++) {
+                s[i] = src[sample[i]];
+                d[i] = dst[sample[i]];
+            }
+            if (degenerate(s) || degenerate(d)) {
+                continue;
+            }
+
+            Mat h = getPerspectiveTransform(s, d);
+            const double* hd = h.ptr<double>();
+            if (!checkRange(h)) {
+                continue;
+            }
+
+            // Sequential probability ratio test: stop checking as soon as
+            // the likelihood ratio of a bad over a good hypothesis exceeds A.
+            double lambda = 1;
+            int count = 0;
+            int checked = 0;
+            bool good = true;
+            while (checked < N) {
+                int i = order[checked++];
+                mask[i] = consistent(hd, src[i], dst[i], threshold2);
+                if (mask[i]) {
+                    count++;
+                    lambda *= delta / epsilon;
+                } else {
+                    lambda *= (1 - delta) / (1 - epsilon);
+                }
+                if (lambda > A) {
+                    good = false;
+                    break;
+                }
+            }
+
+            if (!good) {
+                // Rejected hypotheses are mostly bad ones; use them to
+                // estimate delta.
+                result.rejected++;
+                rejectedDelta += double(count) / checked;
+                double estimate = rejectedDelta / result.rejected;
+                if (estimate > 0 && estimate < epsilon
+                        && fabs(estimate - delta) > 0.05 * delta) {
+                    delta = estimate;
+                    A = sprtThreshold(epsilon, delta);
+                }
+                continue;
+            }
+
+            if (count > bestCount) {
+                // Hypotheses from minimal samples are disturbed by the noise
+                // of the four pairs; refitting them to their inliers usually
+                // gains support.
+                vector<char> refitMask(N);
+                for (int r = 0; r < MAX_REFITS; r++) {
+                    Mat better = refit(src, dst, mask);
+                    if (better.empty()) {
+                        break;
+                    }
+                    int refitCount = findSupport(better, src, dst, threshold2,
+                            refitMask);
+                    if (refitCount <= count) {
+                        break;
+                    }
+                    h = better;
+                    count = refitCount;
+                    mask.swap(refitMask);
+                }
+
+                best = h;
+                bestCount = count;
+                bestMask = mask;
+
+                double ratio = double(bestCount) / N;
+                if (ratio > delta) {
+                    epsilon = ratio;
+                    A = sprtThreshold(epsilon, delta);
+                }
+
+                // Stop as soon as the hypothesis is well supported by some
+                // prefix of the ranked pairs: enough samples have then been
+                // drawn from that prefix to find it with the requested
+                // confidence. Good hypotheses are falsely rejected with a
+                // probability of about 1 / A, which lowers the chance of each
+                // sample.
+                int support = 0;
+                for (int j = 0; j < N; j++) {
+                    support += mask[j];
+                    int prefix = j + 1;
+                    if (prefix < SAMPLE_SIZE
+                            || support < minimalSupport(prefix, delta)) {
+                        continue;
+                    }
+                    double p = pow(double(support) / prefix, SAMPLE_SIZE)
+                            * (1 - 1 / A);
+                    if (p >= 1) {
+                        limit = t;
+                    } else if (p > 0) {
+                        double needed = log(1 - confidence) / log(1 - p);
+                        limit = min(limit, (int) min(ceil(needed), (double) limit));
+                    }
+                }
+            }
+        }
+
+        if (best.empty()) {
+            return result;
+        }
+
+        for (int i = 0; i < N; i++) {
+            if (bestMask[i]) {
+                result.inliers.push_back(i);
+            }
+        }
+        result.homography = best;
+        return result;
+    }
+
+}
@@ -13,6 +13,32 @@ using namespace cv;
 
 namespace tpofinder {
 
+    /** non-public interface */
+    namespace {
+
+        /** Returns a new algorithm with the name and parameters of the given
+         * one, or an empty pointer if it is not registered with OpenCV. */
+        template <typename T>
+        Ptr<T> copyAlgorithm(const Ptr<T>& algorithm) {
+            if (!algorithm->info()) {
+                return Ptr<T>();
+            }
+            Ptr<T> copy = Algorithm::create<T>(algorithm->name());
+            if (copy.empty()) {
+                return copy;
+            }
+            FileStorage out(".yml", FileStorage::WRITE + FileStorage::MEMORY);
+            out << "algorithm" << "{";
+            algorithm->write(out);
+            out << "}";
+            FileStorage in(out.releaseAndGetString(),
+                    FileStorage::READ + FileStorage::MEMORY);
+            copy->read(in["algorithm"]);
+            return copy;
+        }
+
+    }
+
     Feature::Feature(const string& detectorName,
             const string& extractorName,
             const string& matcherName) :
@@ -31,6 +57,34 @@ namespace tpofinder {
         validate();
     }
 
+    string Feature::fingerprint() const {
+        // Only algorithms registered with OpenCV can write their parameters.
+        if (!copyable()) {
+            return "";
+        }
+        FileStorage fs(".yml", FileStorage::WRITE + FileStorage::MEMORY);
+        fs << "detector" << "{";
+        detector->write(fs);
+        fs << "}";
+        fs << "extractor" << "{";
+        extractor->write(fs);
+        fs << "}";
+        return fs.releaseAndGetString();
+    }
+
+    bool Feature::copyable() const {
+        return detector->info() && extractor->info();
+    }
+
+    Feature Feature::copy() const {
+        Ptr<FeatureDetector> d = copyAlgorithm(detector);
+        Ptr<DescriptorExtractor> e = copyAlgorithm(extractor);
+        if (d.empty() || e.empty()) {
+            throw runtime_error("Feature detector or extractor cannot be copied.");
+        }
+        return Feature(d, e, matcher);
+    }
+
     void Feature::validate() {
         if (detector == NULL) {
             throw runtime_error("Feature detector not initialized.");
@@ -0,0 +1,792 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "tpofinder/match.h"
+
+#include <algorithm>
+#include <boost/foreach.hpp>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TPOFINDER_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace tpofinder {
+
+    /** non-public interface */
+    namespace {
+
+        /** Computes the Hamming distances between one query descriptor and
+         * rows consecutive train descriptors of the given byte length. */
+        typedef void (*DistanceKernel)(const uchar* query, const uchar* train,
+                size_t step, int rows, int bytes, int* distances);
+
+        /** Number of query descriptors compared against one block of train
+         * descriptors before moving on to the next block. */
+        const int QUERY_BLOCK = 64;
+
+        /** Size of a block of train descriptors, chosen to stay in the L1
+         * cache. */
+        const int TRAIN_BLOCK_BYTES = 16 * 1024;
+
+        inline int popcount64(uint64_t x) {
+            x = x - ((x >> 1) & 0x5555555555555555ULL);
+            x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+            x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+            return (int) ((x * 0x0101010101010101ULL) >> 56);
+        }
+
+        inline int hammingScalar(const uchar* a, const uchar* b, int bytes) {
+            int d = 0;
+            int i = 0;
+            for (; i + 8 <= bytes; i += 8) {
+                uint64_t x, y;
+                memcpy(&x, a + i, 8);
+                memcpy(&y, b + i, 8);
+                d += popcount64(x ^ y);
+            }
+            for (; i < bytes; i++) {
+                d += popcount64(a[i] ^ b[i]);
+            }
+            return d;
+        }
+
+        void distancesScalar(const uchar* query, const uchar* train,
+                size_t step, int rows, int bytes, int* distances) {
+            for (int r = 0; r < rows; r++) {
+                distances[r] = hammingScalar(query, train + r * step, bytes);
+            }
+        }
+
+#ifdef TPOFINDER_X86
+
+        // Both vector kernels count bits by looking up the population count of
+        // each nibble with a byte shuffle and summing the bytes with psadbw
+        // (W. Mula, N. Kurz, D. Lemire, "Faster population counts using AVX2
+        // instructions", 2016).
+
+        __attribute__((target("avx2")))
+        void distancesAvx2(const uchar* query, const uchar* train,
+                size_t step, int rows, int bytes, int* distances) {
+            const __m256i lookup = _mm256_setr_epi8(
+                    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+            const __m256i nibble = _mm256_set1_epi8(0x0f);
+            const __m256i zero = _mm256_setzero_si256();
+            int vectorBytes = bytes & ~31;
+
+            for (int r = 0; r < rows; r++) {
+                const uchar* t = train + r * step;
+                __m256i sum = zero;
+                for (int i = 0; i < vectorBytes; i += 32) {
+                    __m256i x = _mm256_xor_si256(
+                            _mm256_loadu_si256((const __m256i*) (query + i)),
+                            _mm256_loadu_si256((const __m256i*) (t + i)));
+                    __m256i lo = _mm256_and_si256(x, nibble);
+                    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+                    __m256i counts = _mm256_add_epi8(
+                            _mm256_shuffle_epi8(lookup, lo),
+                            _mm256_shuffle_epi8(lookup, hi));
+                    sum = _mm256_add_epi64(sum, _mm256_sad_epu8(counts, zero));
+                }
+                uint64_t lanes[4];
+                _mm256_storeu_si256((__m256i*) lanes, sum);
+                distances[r] = (int) (lanes[0] + lanes[1] + lanes[2] + lanes[3])
+                        + hammingScalar(query + vectorBytes, t + vectorBytes,
+                        bytes - vectorBytes);
+            }
+        }
+
+        __attribute__((target("avx512f,avx512bw")))
+        inline __m512i popcountBytes512(__m512i x) {
+            const __m512i lookup = _mm512_set4_epi32(
+                    0x04030302, 0x03020201, 0x03020201, 0x02010100);
+            const __m512i nibble = _mm512_set1_epi8(0x0f);
+            __m512i lo = _mm512_and_si512(x, nibble);
+            __m512i hi = _mm512_and_si512(_mm512_srli_epi16(x, 4), nibble);
+            return _mm512_add_epi8(_mm512_shuffle_epi8(lookup, lo),
+                    _mm512_shuffle_epi8(lookup, hi));
+        }
+
+        __attribute__((target("avx512f,avx512bw")))
+        void distancesAvx512(const uchar* query, const uchar* train,
+                size_t step, int rows, int bytes, int* distances) {
+            const __m512i zero = _mm512_setzero_si512();
+            int r = 0;
+
+            if (bytes == 32) {
+                // ORB descriptors: compare two train descriptors at once.
+                // Inserting into zeroed registers (instead of casting) keeps
+                // GCC from warning about undefined upper halves.
+                __m256i q = _mm256_loadu_si256((const __m256i*) query);
+                __m512i qq = _mm512_maskz_inserti64x4(0xff,
+                        _mm512_maskz_inserti64x4(0xff, zero, q, 0), q, 1);
+                for (; r + 2 <= rows; r += 2) {
+                    const uchar* t = train + r * step;
+                    __m512i tt = _mm512_maskz_inserti64x4(0xff,
+                            _mm512_maskz_inserti64x4(0xff, zero,
+                            _mm256_loadu_si256((const __m256i*) t), 0),
+                            _mm256_loadu_si256((const __m256i*) (t + step)), 1);
+                    __m512i sums = _mm512_sad_epu8(
+                            popcountBytes512(_mm512_xor_si512(qq, tt)), zero);
+                    uint64_t lanes[8];
+                    _mm512_storeu_si512((void*) lanes, sums);
+                    distances[r] = (int) (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+                    distances[r + 1] = (int) (lanes[4] + lanes[5] + lanes[6] + lanes[7]);
+                }
+            }
+
+            int rest = bytes & 63;
+            __mmask64 tail = rest == 0 ? 0 : (((__mmask64) 1) << rest) - 1;
+            for (; r < rows; r++) {
+                const uchar* t = train + r * step;
+                __m512i sum = zero;
+                int i = 0;
+                for (; i + 64 <= bytes; i += 64) {
+                    __m512i x = _mm512_xor_si512(
+                            _mm512_loadu_si512((const void*) (query + i)),
+                            _mm512_loadu_si512((const void*) (t + i)));
+                    sum = _mm512_add_epi64(sum,
+                            _mm512_sad_epu8(popcountBytes512(x), zero));
+                }
+                if (tail) {
+                    __m512i x = _mm512_xor_si512(
+                            _mm512_maskz_loadu_epi8(tail, query + i),
+                            _mm512_maskz_loadu_epi8(tail, t + i));
+                    sum = _mm512_add_epi64(sum,
+                            _mm512_sad_epu8(popcountBytes512(x), zero));
+                }
+                uint64_t lanes[8];
+                _mm512_storeu_si512((void*) lanes, sum);
+                uint64_t d = 0;
+                for (int k = 0; k < 8; k++) {
+                    d += lanes[k];
+                }
+                distances[r] = (int) d;
+            }
+        }
+
+#endif
+
+        DistanceKernel distanceKernel(HammingMatcher::Kernel kernel) {
+            switch (kernel) {
+#ifdef TPOFINDER_X86
+                case HammingMatcher::AVX2:
+                    return distancesAvx2;
+                case HammingMatcher::AVX512:
+                    return distancesAvx512;
+#endif
+                default:
+                    return distancesScalar;
+            }
+        }
+
+        HammingMatcher::Kernel fastestKernel() {
+            static const HammingMatcher::Kernel kernel =
+                    HammingMatcher::supports(HammingMatcher::AVX512) ? HammingMatcher::AVX512
+                    : HammingMatcher::supports(HammingMatcher::AVX2) ? HammingMatcher::AVX2
+                    : HammingMatcher::SCALAR;
+            return kernel;
+        }
+
+        /** Calls visit(queryIdx, imgIdx, trainIdx, distance) for every pair
+         * of query and train descriptor that is not masked out. For each
+         * query, the pairs are visited in order of image and train index. */
+        template <typename Visit>
+        void scan(DistanceKernel kernel, const Mat& query,
+                const vector<Mat>& train, const vector<Mat>& masks,
+                Visit visit) {
+            CV_Assert(query.type() == CV_8U);
+            int bytes = query.cols;
+            int block = max(1, TRAIN_BLOCK_BYTES / max(1, bytes));
+            vector<int> distances(block);
+
+            for (int q0 = 0; q0 < query.rows; q0 += QUERY_BLOCK) {
+                int q1 = min(query.rows, q0 + QUERY_BLOCK);
+                for (size_t i = 0; i < train.size(); i++) {
+                    const Mat& descriptors = train[i];
+                    if (descriptors.empty()) {
+                        continue;
+                    }
+                    CV_Assert(descriptors.type() == CV_8U && descriptors.cols == bytes);
+                    const Mat* mask = masks.empty() || masks[i].empty() ? 0 : &masks[i];
+
+                    for (int t0 = 0; t0 < descriptors.rows; t0 += block) {
+                        int n = min(descriptors.rows - t0, block);
+                        for (int q = q0; q < q1; q++) {
+                            kernel(query.ptr(q), descriptors.ptr(t0),
+                                    descriptors.step, n, bytes, &distances[0]);
+                            const uchar* m = mask ? mask->ptr(q) + t0 : 0;
+                            for (int j = 0; j < n; j++) {
+                                if (!m || m[j]) {
+                                    visit(q, i, t0 + j, distances[j]);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        /** Largest number of bits of a multi-index hashing substring; the
+         * table of a substring has 2^bits buckets. */
+        const int MAX_SUBSTRING_BITS = 16;
+
+        /** Returns the bits [offset, offset + bits) of a descriptor, where
+         * bit i is bit i % 8 of byte i / 8. */
+        inline unsigned substring(const uchar* descriptor, int bytes, int offset,
+                int bits) {
+            unsigned value = 0;
+            int first = offset >> 3;
+            for (int i = 0; i < 3 && first + i < bytes; i++) {
+                value |= (unsigned) descriptor[first + i] << (8 * i);
+            }
+            return (value >> (offset & 7)) & ((1u << bits) - 1);
+        }
+
+        /** Returns the next larger integer with the same number of bits set
+         * (Gosper's hack). */
+        inline unsigned nextCombination(unsigned x) {
+            unsigned lowest = x & -x;
+            unsigned ripple = x + lowest;
+            return (((ripple ^ x) >> 2) / lowest) | ripple;
+        }
+
+        /** Cost of probing a bucket or visiting a descriptor by its id,
+         * relative to comparing one descriptor in a linear scan; both access
+         * memory at random. */
+        const double RANDOM_ACCESS_COST = 16;
+
+        /** First stage of a multi-index hashing search whose cost is predicted
+         * from the distance of the neighbours found so far. */
+        const int FIRST_PREDICTED_STAGE = 2;
+
+        /** Inserts a neighbour into the k nearest neighbours so far, sorted by
+         * distance and then by id, unless it is among them already. Unused
+         * entries have distance and id INT_MAX. */
+        inline void insertNeighbour(int* dist, int* ids, int k, int id, int d) {
+            if (d > dist[k - 1] || (d == dist[k - 1] && id >= ids[k - 1])) {
+                return;
+            }
+            int j = k - 1;
+            while (j > 0 && (dist[j - 1] > d || (dist[j - 1] == d && ids[j - 1] >= id))) {
+                j--;
+            }
+            if (ids[j] == id) {
+                return;
+            }
+            for (int i = k - 1; i > j; i--) {
+                dist[i] = dist[i - 1];
+                ids[i] = ids[i - 1];
+            }
+            dist[j] = d;
+            ids[j] = id;
+        }
+
+        double binomial(int n, int k) {
+            double b = 1;
+            for (int i = 1; i <= k; i++) {
+                b = b * (n - k + i) / i;
+            }
+            return b;
+        }
+
+    }
+
+    HammingMatcher::HammingMatcher(Kernel kernel) :
+    /*       */ kernel_(kernel == AUTO ? fastestKernel() : kernel) {
+        CV_Assert(supports(kernel_));
+    }
+
+    bool HammingMatcher::supports(Kernel kernel) {
+        switch (kernel) {
+            case AUTO:
+            case SCALAR:
+                return true;
+#ifdef TPOFINDER_X86
+            case AVX2:
+                return __builtin_cpu_supports("avx2");
+            case AVX512:
+                return __builtin_cpu_supports("avx512f")
+                        && __builtin_cpu_supports("avx512bw");
+#endif
+            default:
+                return false;
+        }
+    }
+
+    HammingMatcher::Kernel HammingMatcher::kernel() const {
+        return kernel_;
+    }
+
+    bool HammingMatcher::isMaskSupported() const {
+        return true;
+    }
+
+    Ptr<DescriptorMatcher> HammingMatcher::clone(bool emptyTrainData) const {
+        HammingMatcher* matcher = new HammingMatcher(kernel_);
+        if (!emptyTrainData) {
+            transform(trainDescCollection.begin(), trainDescCollection.end(),
+                    back_inserter(matcher->trainDescCollection), clone_op);
+        }
+        return matcher;
+    }
+
+    void HammingMatcher::knnMatchImpl(const Mat& queryDescriptors,
+            vector<vector<DMatch> >& matches, int k, const vector<Mat>& masks,
+            bool compactResult) {
+        CV_Assert(k > 0);
+        matches.clear();
+        if (queryDescriptors.empty() || trainDescCollection.empty()) {
+            return;
+        }
+        checkMasks(masks, queryDescriptors.rows);
+
+        // The k nearest neighbours of each query sorted by distance; a new
+        // neighbour is placed behind those of equal distance.
+        vector<int> dist(queryDescriptors.rows * k, INT_MAX);
+        vector<int> img(queryDescriptors.rows * k, -1);
+        vector<int> idx(queryDescriptors.rows * k, -1);
+
+        scan(distanceKernel(kernel_), queryDescriptors, trainDescCollection, masks,
+                [&](int q, int i, int t, int d) {
+                    int* qdist = &dist[q * k];
+                    if (d >= qdist[k - 1]) {
+                        return;
+                    }
+                    int* qimg = &img[q * k];
+                    int* qidx = &idx[q * k];
+                    int j = k - 1;
+                    for (; j > 0 && qdist[j - 1] > d; j--) {
+                        qdist[j] = qdist[j - 1];
+                        qimg[j] = qimg[j - 1];
+                        qidx[j] = qidx[j - 1];
+                    }
+                    qdist[j] = d;
+                    qimg[j] = i;
+                    qidx[j] = t;
+                });
+
+        matches.reserve(queryDescriptors.rows);
+        for (int q = 0; q < queryDescriptors.rows; q++) {
+            vector<DMatch> neighbours;
+            for (int j = 0; j < k && idx[q * k + j] >= 0; j++) {
+                neighbours.push_back(DMatch(q, idx[q * k + j], img[q * k + j],
+                        (float) dist[q * k + j]));
+            }
+            if (!neighbours.empty() || !compactResult) {
+                matches.push_back(neighbours);
+            }
+        }
+    }
+
+    void HammingMatcher::radiusMatchImpl(const Mat& queryDescriptors,
+            vector<vector<DMatch> >& matches, float maxDistance,
+            const vector<Mat>& masks, bool compactResult) {
+        matches.clear();
+        if (queryDescriptors.empty() || trainDescCollection.empty()) {
+            return;
+        }
+        checkMasks(masks, queryDescriptors.rows);
+
+        vector<vector<DMatch> > all(queryDescriptors.rows);
+        scan(distanceKernel(kernel_), queryDescriptors, trainDescCollection, masks,
+                [&](int q, int i, int t, int d) {
+                    if (d < maxDistance) {
+                        all[q].push_back(DMatch(q, t, i, (float) d));
+                    }
+                });
+
+        for (int q = 0; q < queryDescriptors.rows; q++) {
+            if (all[q].empty() && compactResult) {
+                continue;
+            }
+            stable_sort(all[q].begin(), all[q].end());
+            matches.push_back(vector<DMatch>());
+            matches.back().swap(all[q]);
+        }
+    }
+
+    MihMatcher::MihMatcher(int substringBits) :
+    /*       */ substringBits_(substringBits), trained_(false), bytes_(0) {
+        CV_Assert(substringBits >= 0 && substringBits <= MAX_SUBSTRING_BITS);
+    }
+
+    void MihMatcher::add(const vector<Mat>& descriptors) {
+        DescriptorMatcher::add(descriptors);
+        trained_ = false;
+    }
+
+    void MihMatcher::clear() {
+        DescriptorMatcher::clear();
+        tables_.clear();
+        rows_.clear();
+        imageStarts_.clear();
+        bytes_ = 0;
+        trained_ = false;
+    }
+
+    void MihMatcher::collectRows() {
+        tables_.clear();
+        rows_.clear();
+        imageStarts_.clear();
+        bytes_ = 0;
+
+        for (size_t i = 0; i < trainDescCollection.size(); i++) {
+            const Mat& descriptors = trainDescCollection[i];
+            imageStarts_.push_back(rows_.size());
+            if (descriptors.empty()) {
+                continue;
+            }
+            CV_Assert(descriptors.type() == CV_8U);
+            CV_Assert(bytes_ == 0 || bytes_ == descriptors.cols);
+            bytes_ = descriptors.cols;
+            for (int r = 0; r < descriptors.rows; r++) {
+                rows_.push_back(descriptors.ptr(r));
+            }
+        }
+    }
+
+    void MihMatcher::train() {
+        if (trained_) {
+            return;
+        }
+        collectRows();
+        trained_ = true;
+        int n = rows_.size();
+        if (n == 0) {
+            return;
+        }
+
+        // Substrings of about log2(n) bits leave about one descriptor per
+        // bucket (Norouzi et al.).
+        int bits = substringBits_;
+        if (bits == 0) {
+            bits = max(8, min(MAX_SUBSTRING_BITS, cvRound(log((double) n) / log(2.0))));
+        }
+        // Substrings differ by at most one bit in length; a much shorter one
+        // would have crowded buckets.
+        int totalBits = bytes_ * 8;
+        int m = (totalBits + bits - 1) / bits;
+        for (int j = 0, offset = 0; j < m; j++) {
+            tables_.push_back(Table());
+            Table& table = tables_.back();
+            table.offset = offset;
+            table.bits = totalBits / m + (j < totalBits % m ? 1 : 0);
+            offset += table.bits;
+            table.starts.assign((1 << table.bits) + 1, 0);
+            for (int id = 0; id < n; id++) {
+                table.starts[substring(rows_[id], bytes_, table.offset, table.bits) + 1]++;
+            }
+            for (size_t v = 1; v < table.starts.size(); v++) {
+                table.starts[v] += table.starts[v - 1];
+            }
+            vector<int> next(table.starts.begin(), table.starts.end() - 1);
+            table.ids.resize(n);
+            for (int id = 0; id < n; id++) {
+                table.ids[next[substring(rows_[id], bytes_, table.offset, table.bits)]++] = id;
+            }
+        }
+    }
+
+    void MihMatcher::writeIndex(ostream& out) const {
+        CV_Assert(trained_);
+        int32_t header[] = {substringBits_, bytes_, (int32_t) rows_.size(),
+            (int32_t) tables_.size()};
+        out.write(reinterpret_cast<const char*> (header), sizeof (header));
+
+        BOOST_FOREACH(const Table& table, tables_) {
+            int32_t layout[] = {table.offset, table.bits};
+            out.write(reinterpret_cast<const char*> (layout), sizeof (layout));
+            out.write(reinterpret_cast<const char*> (&table.starts[0]),
+                    table.starts.size() * sizeof (int));
+            out.write(reinterpret_cast<const char*> (&table.ids[0]),
+                    table.ids.size() * sizeof (int));
+        }
+    }
+
+    bool MihMatcher::readIndex(istream& in) {
+        trained_ = false;
+        collectRows();
+        int n = rows_.size();
+
+        int32_t header[4];
+        in.read(reinterpret_cast<char*> (header), sizeof (header));
+        int m = header[3];
+        if (!in.good() || header[0] != substringBits_ || header[2] != n
+                || (n > 0 && header[1] != bytes_) || m < 0 || m > bytes_ * 8) {
+            return false;
+        }
+
+        vector<Table> tables(m);
+        int offset = 0;
+
+        BOOST_FOREACH(Table& table, tables) {
+            int32_t layout[2];
+            in.read(reinterpret_cast<char*> (layout), sizeof (layout));
+            table.offset = layout[0];
+            table.bits = layout[1];
+            if (!in.good() || table.offset != offset || table.bits < 1
+                    || table.bits > MAX_SUBSTRING_BITS || offset + table.bits > bytes_ * 8) {
+                return false;
+            }
+            offset += table.bits;
+
+            table.starts.resize((1 << table.bits) + 1);
+            table.ids.resize(n);
+            in.read(reinterpret_cast<char*> (&table.starts[0]),
+                    table.starts.size() * sizeof (int));
+            in.read(reinterpret_cast<char*> (&table.ids[0]), n * sizeof (int));
+            if (!in.good() || table.starts.front() != 0 || table.starts.back() != n) {
+                return false;
+            }
+
+            // Make sure that a corrupt index cannot cause reads out of bounds.
+            for (size_t v = 1; v < table.starts.size(); v++) {
+                if (table.starts[v] < table.starts[v - 1]) {
+                    return false;
+                }
+            }
+
+            BOOST_FOREACH(int id, table.ids) {
+                if (id < 0 || id >= n) {
+                    return false;
+                }
+            }
+        }
+        if (n > 0 && offset != bytes_ * 8) {
+            return false;
+        }
+
+        tables_.swap(tables);
+        trained_ = true;
+        return true;
+    }
+
+    bool MihMatcher::isMaskSupported() const {
+        return true;
+    }
+
+    Ptr<DescriptorMatcher> MihMatcher::clone(bool emptyTrainData) const {
+        MihMatcher* matcher = new MihMatcher(substringBits_);
+        if (!emptyTrainData) {
+            transform(trainDescCollection.begin(), trainDescCollection.end(),
+                    back_inserter(matcher->trainDescCollection), clone_op);
+        }
+        return matcher;
+    }
+
+    template <typename Visit, typename Bound>
+    bool MihMatcher::search(const uchar* query, Visit visit, Bound bound) const {
+        int m = tables_.size();
+        int n = rows_.size();
+        if (n == 0 || bound() < 0) {
+            return true;
+        }
+
+        vector<unsigned> keys(m);
+        for (int j = 0; j < m; j++) {
+            keys[j] = substring(query, bytes_, tables_[j].offset, tables_[j].bits);
+        }
+
+        // Stage s probes the buckets whose substring differs from the query
+        // in s bits. A descriptor that has not been found after probing
+        // table j in stage s differs from the query in at least s + 1 bits on
+        // tables 0 to j and in at least s bits on the others; its distance is
+        // thus at least m * s + j + 1.
+        //
+        // Once the stages still needed for the current bound, including the
+        // expected number of descriptors in their buckets, would bring the
+        // cost above that of a linear scan, the search gives up. The bound is
+        // trusted from stage 2 on; the first two stages are cheap and usually
+        // find the nearest neighbours.
+        double accesses = 0;
+        for (int s = 0;; s++) {
+            int last = s;
+            if (s >= FIRST_PREDICTED_STAGE) {
+                last = max(s, min(bound() / m, MAX_SUBSTRING_BITS));
+            }
+            double expected = 0;
+            for (int t = s; t <= last; t++) {
+                for (int j = 0; j < m; j++) {
+                    expected += binomial(tables_[j].bits, t)
+                            * (1 + double(n) / (1 << tables_[j].bits));
+                }
+            }
+            if ((accesses + expected) * RANDOM_ACCESS_COST > n) {
+                return false;
+            }
+
+            for (int j = 0; j < m; j++) {
+                const Table& table = tables_[j];
+                unsigned end = 1u << table.bits;
+                unsigned flips = (1u << s) - 1;
+                for (; flips < end; flips = s == 0 ? end : nextCombination(flips)) {
+                    unsigned key = keys[j] ^ flips;
+                    accesses += 1 + table.starts[key + 1] - table.starts[key];
+                    for (int b = table.starts[key]; b < table.starts[key + 1]; b++) {
+                        int id = table.ids[b];
+                        visit(id, hammingScalar(query, rows_[id], bytes_));
+                    }
+                }
+                if (s == table.bits || bound() <= m * s + j) {
+                    // All buckets of the table have been probed, or no
+                    // descriptor left is close enough.
+                    return true;
+                }
+            }
+        }
+    }
+
+    template <typename Visit>
+    void MihMatcher::scanRemaining(const Mat& queryDescriptors,
+            const vector<int>& queries, Visit visit) const {
+        if (queries.empty()) {
+            return;
+        }
+        Mat rest(queries.size(), bytes_, CV_8U);
+        for (size_t p = 0; p < queries.size(); p++) {
+            memcpy(rest.ptr(p), queryDescriptors.ptr(queries[p]), bytes_);
+        }
+        scan(distanceKernel(fastestKernel()), rest, trainDescCollection, vector<Mat>(),
+                [&](int p, int i, int t, int d) {
+                    visit(queries[p], imageStarts_[i] + t, d);
+                });
+    }
+
+    int MihMatcher::imageOf(int id) const {
+        return upper_bound(imageStarts_.begin(), imageStarts_.end(), id)
+                - imageStarts_.begin() - 1;
+    }
+
+    bool MihMatcher::masked(const vector<Mat>& masks, int query, int id) const {
+        if (masks.empty()) {
+            return false;
+        }
+        int image = imageOf(id);
+        return !masks[image].empty()
+                && !masks[image].at<uchar>(query, id - imageStarts_[image]);
+    }
+
+    void MihMatcher::knnMatchImpl(const Mat& queryDescriptors,
+            vector<vector<DMatch> >& matches, int k, const vector<Mat>& masks,
+            bool compactResult) {
+        CV_Assert(k > 0);
+        matches.clear();
+        if (queryDescriptors.empty() || trainDescCollection.empty()) {
+            return;
+        }
+        checkMasks(masks, queryDescriptors.rows);
+        train();
+        CV_Assert(rows_.empty() || (queryDescriptors.type() == CV_8U
+                && queryDescriptors.cols == bytes_));
+
+        // Descriptors are found in no particular order and possibly several
+        // times, so neighbours of equal distance are ordered by id, i.e. by
+        // image and train index, and a descriptor found again is skipped.
+        vector<int> dist(queryDescriptors.rows * k, INT_MAX);
+        vector<int> ids(queryDescriptors.rows * k, INT_MAX);
+        auto visit = [&](int q, int id, int d) {
+            if (!masked(masks, q, id)) {
+                insertNeighbour(&dist[q * k], &ids[q * k], k, id, d);
+            }
+        };
+
+        vector<int> remaining;
+        for (int q = 0; q < queryDescriptors.rows; q++) {
+            bool complete = search(queryDescriptors.ptr(q),
+                    [&](int id, int d) {
+                        visit(q, id, d);
+                    },
+                    [&]() {
+                        return dist[q * k + k - 1];
+                    });
+            if (!complete) {
+                remaining.push_back(q);
+            }
+        }
+        scanRemaining(queryDescriptors, remaining, visit);
+
+        matches.reserve(queryDescriptors.rows);
+        for (int q = 0; q < queryDescriptors.rows; q++) {
+            vector<DMatch> neighbours;
+            for (int j = 0; j < k && ids[q * k + j] != INT_MAX; j++) {
+                int id = ids[q * k + j];
+                int image = imageOf(id);
+                neighbours.push_back(DMatch(q, id - imageStarts_[image], image,
+                        (float) dist[q * k + j]));
+            }
+            if (!neighbours.empty() || !compactResult) {
+                matches.push_back(neighbours);
+            }
+        }
+    }
+
+    void MihMatcher::radiusMatchImpl(const Mat& queryDescriptors,
+            vector<vector<DMatch> >& matches, float maxDistance,
+            const vector<Mat>& masks, bool compactResult) {
+        matches.clear();
+        if (queryDescriptors.empty() || trainDescCollection.empty()) {
+            return;
+        }
+        checkMasks(masks, queryDescriptors.rows);
+        train();
+        CV_Assert(rows_.empty() || (queryDescriptors.type() == CV_8U
+                && queryDescriptors.cols == bytes_));
+
+        // Largest integer distance below maxDistance.
+        int radius = (int) ceil(maxDistance) - 1;
+        vector<vector<pair<int, int> > > found(queryDescriptors.rows);
+        auto visit = [&](int q, int id, int d) {
+            if (d <= radius) {
+                found[q].push_back(make_pair(d, id));
+            }
+        };
+
+        vector<int> remaining;
+        for (int q = 0; q < queryDescriptors.rows; q++) {
+            bool complete = search(queryDescriptors.ptr(q),
+                    [&](int id, int d) {
+                        visit(q, id, d);
+                    },
+                    [&]() {
+                        return radius;
+                    });
+            if (!complete) {
+                remaining.push_back(q);
+            }
+        }
+        scanRemaining(queryDescriptors, remaining, visit);
+
+        for (int q = 0; q < queryDescriptors.rows; q++) {
+            sort(found[q].begin(), found[q].end());
+            found[q].erase(unique(found[q].begin(), found[q].end()), found[q].end());
+
+            vector<DMatch> neighbours;
+            for (size_t j = 0; j < found[q].size(); j++) {
+                int id = found[q][j].second;
+                if (!masked(masks, q, id)) {
+                    int image = imageOf(id);
+                    neighbours.push_back(DMatch(q, id - imageStarts_[image], image,
+                            (float) found[q][j].first));
+                }
+            }
+            if (!neighbours.empty() || !compactResult) {
+                matches.push_back(neighbours);
+            }
+        }
+    }
+
+}
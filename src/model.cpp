@@ -5,10 +5,15 @@
  */
 
 #include "tpofinder/model.h"
+#include "tpofinder/parallel.h"
+#include "tpofinder/persist.h"
 #include "tpofinder/util.h"
 
+#include <algorithm>
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
+#include <cmath>
+#include <map>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
@@ -52,19 +57,148 @@ namespace tpofinder {
 
     PlanarModel::PlanarModel(const string& name, const Scalar& color,
             const vector<PlanarView>& views) : name(name), color(color), views(views) {
+        // Size the aggregate storage up front, such that it is filled in a
+        // single pass without reallocation.
+        int cols = 0;
+        int type = -1;
+        viewOffsets.reserve(views.size() + 1);
+        viewOffsets.push_back(0);
 
         BOOST_FOREACH(const PlanarView& v, views) {
-            vector<KeyPoint> kptsInRef;
+            CV_Assert(v.descriptors.rows == (int) v.keypoints.size());
+            if (!v.descriptors.empty()) {
+                CV_Assert(type < 0 || (v.descriptors.type() == type
+                        && v.descriptors.cols == cols));
+                cols = v.descriptors.cols;
+                type = v.descriptors.type();
+            }
+            viewOffsets.push_back(viewOffsets.back() + v.keypoints.size());
+        }
+
+        allKeypoints.reserve(viewOffsets.back());
+        allWeights.assign(viewOffsets.back(), 1);
+        if (type >= 0) {
+            allDescriptors = createAligned(viewOffsets.back(), cols, type);
+        }
+
+        for (size_t i = 0; i < this->views.size(); i++) {
+            PlanarView& v = this->views[i];
             Mat hInv;
             invert(v.homography, hInv);
-            perspectiveTransformKeypoints(v.keypoints, kptsInRef, hInv);
-            for (size_t i = 0; i < kptsInRef.size(); i++) {
-                allKeypoints.push_back(kptsInRef[i]);
-                allDescriptors.push_back(v.descriptors.row(i));
+            perspectiveTransformKeypoints(v.keypoints, allKeypoints, hInv);
+            if (!v.descriptors.empty()) {
+                Mat block = allDescriptors.rowRange(viewOffsets[i], viewOffsets[i + 1]);
+                v.descriptors.copyTo(block);
+                // Share the aggregate storage instead of keeping a copy.
+                v.descriptors = block;
             }
         }
     }
 
+    void PlanarModel::compact(float maxKeypointDistance,
+            double maxDescriptorDistance) {
+        CV_Assert(maxKeypointDistance > 0);
+        if (allKeypoints.empty()) {
+            return;
+        }
+        int normType = allDescriptors.depth() == CV_8U ? NORM_HAMMING : NORM_L2;
+
+        // Representatives are hashed into a grid of cells as large as the
+        // keypoint distance, such that merge candidates for a keypoint are
+        // found in the surrounding 3x3 cells.
+        typedef pair<int, int> Cell;
+        map<Cell, vector<int> > grid;
+        vector<int> representative(allKeypoints.size(), -1);
+
+        for (int i = 0; i < (int) allKeypoints.size(); i++) {
+            const Point2f& p = allKeypoints[i].pt;
+            int cx = (int) floor(p.x / maxKeypointDistance);
+            int cy = (int) floor(p.y / maxKeypointDistance);
+            int view = viewOf(i);
+
+            int best = -1;
+            double bestDistance = maxDescriptorDistance;
+            for (int dx = -1; dx <= 1; dx++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    map<Cell, vector<int> >::const_iterator c =
+                            grid.find(Cell(cx + dx, cy + dy));
+                    if (c == grid.end()) {
+                        continue;
+                    }
+
+                    BOOST_FOREACH(int j, c->second) {
+                        if (viewOf(j) == view
+                                || norm(allKeypoints[j].pt - p) > maxKeypointDistance) {
+                            continue;
+                        }
+                        double d = norm(allDescriptors.row(i),
+                                allDescriptors.row(j), normType);
+                        if (d <= bestDistance) {
+                            best = j;
+                            bestDistance = d;
+                        }
+                    }
+                }
+            }
+
+            if (best >= 0) {
+                representative[i] = best;
+                allWeights[best] += allWeights[i];
+            } else {
+                grid[Cell(cx, cy)].push_back(i);
+            }
+        }
+
+        // Rebuild the aggregate storage from the representatives, keeping
+        // the order of the features and thus the layout by view.
+        vector<int> kept;
+        for (size_t i = 0; i < representative.size(); i++) {
+            if (representative[i] < 0) {
+                kept.push_back(i);
+            }
+        }
+        if (kept.size() == allKeypoints.size()) {
+            return;
+        }
+
+        vector<KeyPoint> keypoints;
+        keypoints.reserve(kept.size());
+        vector<int> weights;
+        weights.reserve(kept.size());
+        Mat descriptors = createAligned(kept.size(), allDescriptors.cols,
+                allDescriptors.type());
+        vector<vector<KeyPoint> > viewKeypoints(views.size());
+        vector<int> offsets(views.size() + 1, 0);
+
+        for (size_t k = 0; k < kept.size(); k++) {
+            int i = kept[k];
+            int view = viewOf(i);
+            keypoints.push_back(allKeypoints[i]);
+            weights.push_back(allWeights[i]);
+            Mat row = descriptors.row(k);
+            allDescriptors.row(i).copyTo(row);
+            viewKeypoints[view].push_back(views[view].keypoints[i - viewOffsets[view]]);
+            offsets[view + 1]++;
+        }
+        for (size_t v = 0; v < views.size(); v++) {
+            offsets[v + 1] += offsets[v];
+            views[v].keypoints.swap(viewKeypoints[v]);
+            views[v].descriptors = descriptors.rowRange(offsets[v], offsets[v + 1]);
+        }
+
+        allKeypoints.swap(keypoints);
+        allWeights.swap(weights);
+        allDescriptors = descriptors;
+        viewOffsets.swap(offsets);
+    }
+
+    int PlanarModel::viewOf(int feature) const {
+        CV_Assert(!viewOffsets.empty());
+        CV_Assert(feature >= 0 && feature < viewOffsets.back());
+        return upper_bound(viewOffsets.begin(), viewOffsets.end(), feature)
+                - viewOffsets.begin() - 1;
+    }
+
     PlanarModel PlanarModel::create(const std::string& name,
             const Mat& image, const Mat& roi,
             const Scalar& color, const Feature& feature) {
@@ -76,7 +210,8 @@ namespace tpofinder {
         return PlanarModel(name, color, views);
     }
 
-    PlanarModel PlanarModel::load(const bfs::path& path, const Feature& feature) {
+    PlanarModel PlanarModel::load(const bfs::path& path, const Feature& feature,
+            unsigned threads) {
         CV_Assert(bfs::exists(path / "ref.jpg"));
         CV_Assert(bfs::exists(path / "roi.png"));
         CV_Assert(bfs::exists(path / "info.yml"));
@@ -92,20 +227,68 @@ namespace tpofinder {
         CV_Assert(!ref.empty());
         CV_Assert(!roi.empty());
 
-        vector<PlanarView> views;
-        views.push_back(PlanarView::create(ref, roi, EYE_HOMOGRAPHY, feature));
+        vector<bfs::path> paths = viewPaths(path);
+        vector<PlanarView> views(paths.size() + 1);
+        views[0] = PlanarView::create(ref, roi, EYE_HOMOGRAPHY, feature);
+
+        // All other views only depend on the reference view. Each is extracted
+        // with its own copy of the feature, unless it cannot be copied.
+        bool copyable = feature.copyable();
+        parallelFor(paths.size(), [&](size_t i) {
+            views[i + 1] = PlanarView::load(paths[i], views[0].roi,
+                    copyable ? feature.copy() : feature);
+        }, copyable ? threads : 1);
 
+        return PlanarModel(path.leaf().string(), color, views);
+    }
+
+    vector<bfs::path> PlanarModel::viewPaths(const bfs::path& path) {
         // The views must be loaded in the correct order; the files must follow
         // a certain naming scheme. This ensures reproducibility.
+        vector<bfs::path> paths;
         bfs::path p(path / "001.yml");
         int i = 2;
         while (bfs::exists(p)) {
-            views.push_back(PlanarView::load(p, views[0].roi, feature));
+            paths.push_back(p);
             p = path / str(boost::format("%03d.yml") % i);
             i++;
         }
+        return paths;
+    }
 
-        return PlanarModel(path.leaf().string(), color, views);
+    void Modelbase::add(const bfs::path& path) {
+        add(load(path, feature_, 0));
+    }
+
+    void Modelbase::addAll(const vector<bfs::path>& paths, unsigned threads) {
+        vector<PlanarModel> loaded(paths.size());
+        if (paths.size() == 1) {
+            loaded[0] = load(paths[0], feature_, threads);
+        } else {
+            // Models are independent of each other; the views of each model
+            // are loaded sequentially in order not to oversubscribe. Each
+            // model is loaded with its own copy of the feature, unless it
+            // cannot be copied.
+            bool copyable = feature_.copyable();
+            parallelFor(paths.size(), [&](size_t i) {
+                loaded[i] = load(paths[i], copyable ? feature_.copy() : feature_, 1);
+            }, copyable ? threads : 1);
+        }
+        models.insert(models.end(), loaded.begin(), loaded.end());
+    }
+
+    PlanarModel Modelbase::load(const bfs::path& path, const Feature& feature,
+            unsigned threads) const {
+        PlanarModel model;
+        if (useCache_ && readModelCache(path, feature, model)) {
+            return model;
+        }
+        model = PlanarModel::load(path, feature, threads);
+        if (useCache_) {
+            // A read-only model directory just means there is no cache.
+            writeModelCache(path, model, feature);
+        }
+        return model;
     }
 
     int Modelbase::findByName(const string& name) {
@@ -0,0 +1,195 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "tpofinder/parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace tpofinder {
+
+    unsigned defaultThreads() {
+        unsigned n = thread::hardware_concurrency();
+        return n > 0 ? n : 1;
+    }
+
+    void parallelFor(size_t n, const function<void(size_t)>& body,
+            unsigned threads) {
+        if (threads == 0) {
+            threads = defaultThreads();
+        }
+        threads = (unsigned) min<size_t>(threads, n);
+
+        if (threads <= 1) {
+            for (size_t i = 0; i < n; i++) {
+                body(i);
+            }
+            return;
+        }
+
+        atomic<size_t> next(0);
+        mutex errorMutex;
+        exception_ptr error;
+
+        auto work = [&]() {
+            for (size_t i = next++; i < n; i = next++) {
+                try {
+                    body(i);
+                } catch (...) {
+                    lock_guard<mutex> lock(errorMutex);
+                    if (!error) {
+                        error = current_exception();
+                    }
+                }
+            }
+        };
+
+        // The calling thread does its share of the work, too.
+        vector<thread> workers;
+        for (unsigned t = 1; t < threads; t++) {
+            workers.push_back(thread(work));
+        }
+        work();
+        for (size_t t = 0; t < workers.size(); t++) {
+            workers[t].join();
+        }
+
+        if (error) {
+            rethrow_exception(error);
+        }
+    }
+
+    /** A loop handed to the pool. All members but body and n are guarded by
+     * the mutex of the pool. */
+    struct ThreadPool::Job {
+
+        Job(size_t n, const function<void(size_t)>& body) :
+        /*       */ body(body), n(n), next(0), finished(0) {
+        }
+
+        const function<void(size_t)>& body;
+        const size_t n;
+        size_t next;
+        size_t finished;
+        exception_ptr error;
+        condition_variable completed;
+    };
+
+    ThreadPool::ThreadPool(unsigned threads) : stop_(false) {
+        if (threads == 0) {
+            threads = defaultThreads();
+        }
+        for (unsigned t = 1; t < threads; t++) {
+            workers_.push_back(thread(&ThreadPool::work, this));
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (size_t t = 0; t < workers_.size(); t++) {
+            workers_[t].join();
+        }
+    }
+
+    void ThreadPool::parallelFor(size_t n, const function<void(size_t)>& body) {
+        if (n == 0) {
+            return;
+        }
+        if (workers_.empty() || n == 1) {
+            tpofinder::parallelFor(n, body, 1);
+            return;
+        }
+
+        shared_ptr<Job> job = make_shared<Job>(n, body);
+        {
+            lock_guard<mutex> lock(mutex_);
+            jobs_.push_back(job);
+        }
+        wake_.notify_all();
+
+        // The calling thread works on its own loop only; other loops may
+        // take longer than this one.
+        unique_lock<mutex> lock(mutex_);
+        size_t i;
+        while (take(*job, i)) {
+            lock.unlock();
+            run(*job, i);
+            lock.lock();
+        }
+        job->completed.wait(lock, [&]() {
+            return job->finished == job->n;
+        });
+
+        if (job->error) {
+            rethrow_exception(job->error);
+        }
+    }
+
+    bool ThreadPool::take(Job& job, size_t& i) {
+        if (job.next == job.n) {
+            return false;
+        }
+        i = job.next++;
+        if (job.next == job.n) {
+            // All iterations are handed out; nobody needs to find the job.
+            for (size_t k = 0; k < jobs_.size(); k++) {
+                if (jobs_[k].get() == &job) {
+                    jobs_.erase(jobs_.begin() + k);
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    void ThreadPool::run(Job& job, size_t i) {
+        exception_ptr error;
+        try {
+            job.body(i);
+        } catch (...) {
+            error = current_exception();
+        }
+
+        lock_guard<mutex> lock(mutex_);
+        if (error && !job.error) {
+            job.error = error;
+        }
+        if (++job.finished == job.n) {
+            job.completed.notify_all();
+        }
+    }
+
+    void ThreadPool::work() {
+        unique_lock<mutex> lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [&]() {
+                return stop_ || !jobs_.empty();
+            });
+            if (jobs_.empty()) {
+                return;
+            }
+            // The job is kept alive by its caller until all iterations
+            // finished, which includes the one taken here.
+            Job& job = *jobs_.front();
+            size_t i;
+            take(job, i);
+            lock.unlock();
+            run(job, i);
+            lock.lock();
+        }
+    }
+
+}
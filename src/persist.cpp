@@ -0,0 +1,685 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "tpofinder/persist.h"
+#include "tpofinder/match.h"
+
+#include <boost/foreach.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/format.hpp>
+#include <cstring>
+#include <fstream>
+#include <opencv2/highgui/highgui.hpp>
+#include <stdexcept>
+#include <typeinfo>
+
+using namespace cv;
+using namespace std;
+namespace bfs = boost::filesystem;
+namespace bip = boost::interprocess;
+
+namespace tpofinder {
+
+    const char MODEL_CACHE_MAGIC[8] = {'T', 'P', 'O', 'M', 'O', 'D', 'E', 'L'};
+
+    const char PACK_MAGIC[8] = {'T', 'P', 'O', 'P', 'A', 'C', 'K', '\0'};
+
+    const char INDEX_MAGIC[8] = {'T', 'P', 'O', 'I', 'N', 'D', 'E', 'X'};
+
+    /** Alignment of the matrix data in a packed modelbase; a cache line. */
+    const size_t PACK_ALIGNMENT = 64;
+
+    /** Size of a keypoint as written by BinaryWriter::keypoints. */
+    const size_t KEYPOINT_BYTES = 5 * sizeof (float) + 2 * sizeof (int32_t);
+
+    /** non-public interface */
+    class BinaryWriter {
+    public:
+
+        BinaryWriter(const bfs::path& path) :
+        /*       */ out_(path.string().c_str(), ios::out | ios::binary) {
+        }
+
+        bool good() const {
+            return out_.good();
+        }
+
+        void bytes(const void* data, size_t n) {
+            out_.write(static_cast<const char*> (data), n);
+        }
+
+        template<typename T>
+        void value(const T& v) {
+            bytes(&v, sizeof (T));
+        }
+
+        void text(const string& s) {
+            value<uint32_t > (s.size());
+            bytes(s.data(), s.size());
+        }
+
+        void keypoints(const vector<KeyPoint>& kpts) {
+            value<uint32_t > (kpts.size());
+
+            BOOST_FOREACH(const KeyPoint& k, kpts) {
+                value<float>(k.pt.x);
+                value<float>(k.pt.y);
+                value<float>(k.size);
+                value<float>(k.angle);
+                value<float>(k.response);
+                value<int32_t > (k.octave);
+                value<int32_t > (k.class_id);
+            }
+        }
+
+        void matrix(const Mat& m) {
+            value<int32_t > (m.rows);
+            value<int32_t > (m.cols);
+            value<int32_t > (m.type());
+            for (int i = 0; i < m.rows; i++) {
+                bytes(m.ptr(i), m.cols * m.elemSize());
+            }
+        }
+
+        /** Like matrix, but pads such that the data starts at a multiple of
+         * PACK_ALIGNMENT bytes from the beginning of the file. */
+        void alignedMatrix(const Mat& m) {
+            value<int32_t > (m.rows);
+            value<int32_t > (m.cols);
+            value<int32_t > (m.type());
+            static const char zeros[PACK_ALIGNMENT] = {0};
+            size_t pos = out_.tellp();
+            bytes(zeros, (PACK_ALIGNMENT - pos % PACK_ALIGNMENT) % PACK_ALIGNMENT);
+            for (int i = 0; i < m.rows; i++) {
+                bytes(m.ptr(i), m.cols * m.elemSize());
+            }
+        }
+
+        ostream& stream() {
+            return out_;
+        }
+
+    private:
+        ofstream out_;
+    };
+
+    /** non-public interface */
+    class BinaryReader {
+    public:
+
+        BinaryReader(const bfs::path& path) :
+        /*       */ in_(path.string().c_str(), ios::in | ios::binary), size_(0) {
+            boost::system::error_code ec;
+            size_ = bfs::file_size(path, ec);
+            if (ec) {
+                in_.setstate(ios::failbit);
+            }
+        }
+
+        bool good() const {
+            return in_.good();
+        }
+
+        void bytes(void* data, size_t n) {
+            in_.read(static_cast<char*> (data), n);
+        }
+
+        template<typename T>
+        T value() {
+            T v = T();
+            bytes(&v, sizeof (T));
+            return v;
+        }
+
+        /** Fails the stream unless n more bytes can be read, such that
+         * corrupt lengths do not lead to huge allocations. */
+        bool expect(uint64_t n) {
+            if (good() && n > size_ - (uint64_t) in_.tellg()) {
+                in_.setstate(ios::failbit);
+            }
+            return good();
+        }
+
+        string text() {
+            uint32_t n = value<uint32_t > ();
+            string s(expect(n) ? n : 0, '\0');
+            if (!s.empty()) {
+                bytes(&s[0], n);
+            }
+            return s;
+        }
+
+        void keypoints(vector<KeyPoint>& kpts) {
+            uint32_t n = value<uint32_t > ();
+            kpts.clear();
+            kpts.reserve(expect((uint64_t) n * KEYPOINT_BYTES) ? n : 0);
+            for (uint32_t i = 0; i < n && good(); i++) {
+                KeyPoint k;
+                k.pt.x = value<float>();
+                k.pt.y = value<float>();
+                k.size = value<float>();
+                k.angle = value<float>();
+                k.response = value<float>();
+                k.octave = value<int32_t > ();
+                k.class_id = value<int32_t > ();
+                kpts.push_back(k);
+            }
+        }
+
+        void matrix(Mat& m) {
+            int32_t rows = value<int32_t > ();
+            int32_t cols = value<int32_t > ();
+            int32_t type = value<int32_t > ();
+            if (!good() || rows < 0 || cols < 0 || type != CV_MAT_TYPE(type)) {
+                in_.setstate(ios::failbit);
+                return;
+            }
+            if (!expect((uint64_t) rows * cols * CV_ELEM_SIZE(type))) {
+                return;
+            }
+            m.create(rows, cols, type);
+            for (int i = 0; i < m.rows && good(); i++) {
+                bytes(m.ptr(i), m.cols * m.elemSize());
+            }
+        }
+
+        istream& stream() {
+            return in_;
+        }
+
+    private:
+        ifstream in_;
+        uint64_t size_;
+    };
+
+    /** non-public interface */
+    class MemoryReader {
+    public:
+
+        MemoryReader(const uchar* begin, const uchar* end) :
+        /*       */ begin_(begin), pos_(begin), end_(end) {
+        }
+
+        const uchar* bytes(size_t n) {
+            if (n > (size_t) (end_ - pos_)) {
+                throw runtime_error("Packed modelbase is truncated.");
+            }
+            const uchar* p = pos_;
+            pos_ += n;
+            return p;
+        }
+
+        template<typename T>
+        T value() {
+            T v;
+            memcpy(&v, bytes(sizeof (T)), sizeof (T));
+            return v;
+        }
+
+        /** Reads a count of items of at least the given size each; throws if
+         * fewer bytes are left, such that corrupt counts do not lead to huge
+         * allocations. */
+        uint32_t count(size_t itemBytes) {
+            uint32_t n = value<uint32_t > ();
+            if ((uint64_t) n * itemBytes > (uint64_t) (end_ - pos_)) {
+                throw runtime_error("Packed modelbase is truncated or corrupt.");
+            }
+            return n;
+        }
+
+        string text() {
+            uint32_t n = value<uint32_t > ();
+            const char* p = reinterpret_cast<const char*> (bytes(n));
+            return string(p, n);
+        }
+
+        void keypoints(vector<KeyPoint>& kpts) {
+            uint32_t n = count(KEYPOINT_BYTES);
+            kpts.resize(n);
+            for (uint32_t i = 0; i < n; i++) {
+                KeyPoint& k = kpts[i];
+                k.pt.x = value<float>();
+                k.pt.y = value<float>();
+                k.size = value<float>();
+                k.angle = value<float>();
+                k.response = value<float>();
+                k.octave = value<int32_t > ();
+                k.class_id = value<int32_t > ();
+            }
+        }
+
+        /** Returns a header for a matrix written by
+         * BinaryWriter::alignedMatrix that points into the mapped memory. */
+        Mat alignedMatrix() {
+            int32_t rows = value<int32_t > ();
+            int32_t cols = value<int32_t > ();
+            int32_t type = value<int32_t > ();
+            size_t pos = pos_ - begin_;
+            bytes((PACK_ALIGNMENT - pos % PACK_ALIGNMENT) % PACK_ALIGNMENT);
+            if (rows < 0 || cols < 0 || type != CV_MAT_TYPE(type)) {
+                throw runtime_error("Packed modelbase is corrupt.");
+            }
+            if (rows == 0 || cols == 0) {
+                return Mat(rows, cols, type);
+            }
+            size_t n = (size_t) rows * cols * CV_ELEM_SIZE(type);
+            return Mat(rows, cols, type, const_cast<uchar*> (bytes(n)));
+        }
+
+    private:
+        const uchar* begin_;
+        const uchar* pos_;
+        const uchar* end_;
+    };
+
+    /** non-public interface */
+    struct MappedFile {
+
+        MappedFile(const bfs::path& path) :
+        /*       */ file(path.string().c_str(), bip::read_only),
+        /*       */ region(file, bip::read_only) {
+        }
+
+        bip::file_mapping file;
+        bip::mapped_region region;
+    };
+
+    /** non-public interface */
+    vector<bfs::path> modelSourceFiles(const bfs::path& modelPath) {
+        vector<bfs::path> files;
+        files.push_back(modelPath / "ref.jpg");
+        files.push_back(modelPath / "roi.png");
+        files.push_back(modelPath / "info.yml");
+
+        BOOST_FOREACH(const bfs::path& p, PlanarModel::viewPaths(modelPath)) {
+            bfs::path imgPath = p;
+            imgPath.replace_extension(".jpg");
+            files.push_back(p);
+            files.push_back(imgPath);
+        }
+        return files;
+    }
+
+    bfs::path modelCachePath(const bfs::path& modelPath) {
+        return modelPath / "model.cache";
+    }
+
+    bool writeModelCache(const bfs::path& modelPath, const PlanarModel& model,
+            const Feature& feature) {
+        if (feature.fingerprint().empty()) {
+            return false;
+        }
+        bfs::path path = modelCachePath(modelPath);
+        bfs::path tmp = path.string() + "." + bfs::unique_path().string();
+
+        // A cache is only valid for the sources as they are now.
+        vector<bfs::path> sources = modelSourceFiles(modelPath);
+        vector<int64_t> times;
+        vector<uint64_t> sizes;
+
+        BOOST_FOREACH(const bfs::path& p, sources) {
+            boost::system::error_code ec;
+            times.push_back(bfs::last_write_time(p, ec));
+            sizes.push_back(bfs::file_size(p, ec));
+            if (ec) {
+                return false;
+            }
+        }
+
+        {
+            BinaryWriter out(tmp);
+            out.bytes(MODEL_CACHE_MAGIC, sizeof (MODEL_CACHE_MAGIC));
+            out.value<uint32_t > (MODEL_CACHE_VERSION);
+            out.text(feature.fingerprint());
+            out.text(model.name);
+            for (int i = 0; i < 4; i++) {
+                out.value<double>(model.color[i]);
+            }
+            out.value<uint32_t > (sources.size());
+            for (size_t i = 0; i < sources.size(); i++) {
+                out.value<int64_t > (times[i]);
+                out.value<uint64_t > (sizes[i]);
+            }
+            out.value<uint32_t > (model.views.size());
+
+            BOOST_FOREACH(const PlanarView& v, model.views) {
+                Mat h;
+                v.homography.convertTo(h, CV_64F);
+                out.matrix(h);
+                out.keypoints(v.keypoints);
+                out.matrix(v.descriptors);
+            }
+
+            if (!out.good()) {
+                bfs::remove(tmp);
+                return false;
+            }
+        }
+
+        boost::system::error_code ec;
+        bfs::rename(tmp, path, ec);
+        if (ec) {
+            bfs::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    /** non-public interface */
+    bool readModelCacheUnchecked(const bfs::path& modelPath, const Feature& feature,
+            PlanarModel& model) {
+        bfs::path path = modelCachePath(modelPath);
+        string fingerprint = feature.fingerprint();
+        if (fingerprint.empty() || !bfs::exists(path)) {
+            return false;
+        }
+
+        vector<bfs::path> sources = modelSourceFiles(modelPath);
+
+        BOOST_FOREACH(const bfs::path& p, sources) {
+            if (!bfs::exists(p)) {
+                return false;
+            }
+        }
+
+        BinaryReader in(path);
+        char magic[sizeof (MODEL_CACHE_MAGIC)];
+        in.bytes(magic, sizeof (magic));
+        if (!in.good() || memcmp(magic, MODEL_CACHE_MAGIC, sizeof (magic)) != 0) {
+            return false;
+        }
+        if (in.value<uint32_t > () != MODEL_CACHE_VERSION) {
+            return false;
+        }
+        if (in.text() != fingerprint) {
+            return false;
+        }
+
+        string name = in.text();
+        Scalar color;
+        for (int i = 0; i < 4; i++) {
+            color[i] = in.value<double>();
+        }
+
+        // The cache is stale as soon as any source differs from when it was
+        // written. Comparing for equality does not depend on the clock or on
+        // the resolution of modification times.
+        if (in.value<uint32_t > () != sources.size()) {
+            return false;
+        }
+
+        BOOST_FOREACH(const bfs::path& p, sources) {
+            int64_t time = in.value<int64_t > ();
+            uint64_t size = in.value<uint64_t > ();
+            if (!in.good() || time != (int64_t) bfs::last_write_time(p)
+                    || size != (uint64_t) bfs::file_size(p)) {
+                return false;
+            }
+        }
+
+        // Besides the reference view, there are two source files per view.
+        uint32_t nviews = in.value<uint32_t > ();
+        if (!in.good() || nviews == 0 || 2 * (nviews - 1) + 3 != sources.size()) {
+            return false;
+        }
+
+        vector<PlanarView> views(nviews);
+
+        BOOST_FOREACH(PlanarView& v, views) {
+            in.matrix(v.homography);
+            in.keypoints(v.keypoints);
+            in.matrix(v.descriptors);
+            if (!in.good() || v.homography.rows != 3 || v.homography.cols != 3
+                    || v.homography.type() != CV_64FC1
+                    || v.descriptors.rows != (int) v.keypoints.size()) {
+                return false;
+            }
+        }
+
+        // The reference view is needed for visualization; decoding it is cheap
+        // compared to feature extraction on all views.
+        views[0].image = imread((modelPath / "ref.jpg").string());
+        Mat roi = imread((modelPath / "roi.png").string(), 0);
+        if (views[0].image.empty() || roi.empty()) {
+            return false;
+        }
+        views[0].roi = roi > 0;
+
+        model = PlanarModel(name, color, views);
+        return true;
+    }
+
+    bool readModelCache(const bfs::path& modelPath, const Feature& feature,
+            PlanarModel& model) {
+        // A corrupt or foreign cache is as good as none; the caller extracts
+        // the features instead.
+        try {
+            return readModelCacheUnchecked(modelPath, feature, model);
+        } catch (const cv::Exception&) {
+            return false;
+        } catch (const bad_alloc&) {
+            return false;
+        } catch (const bfs::filesystem_error&) {
+            return false;
+        }
+    }
+
+    /** non-public interface */
+    uint64_t hashDescriptors(const vector<Mat>& descriptors) {
+        // FNV-1a over the shape and the rows of every matrix, taking eight
+        // bytes at a time.
+        const uint64_t prime = 0x100000001b3ULL;
+        uint64_t h = 0xcbf29ce484222325ULL;
+
+        BOOST_FOREACH(const Mat& d, descriptors) {
+            h = (h ^ (uint64_t) d.rows) * prime;
+            h = (h ^ (uint64_t) d.cols) * prime;
+            h = (h ^ (uint64_t) d.type()) * prime;
+            size_t n = d.cols * d.elemSize();
+            for (int r = 0; r < d.rows; r++) {
+                const uchar* row = d.ptr(r);
+                size_t i = 0;
+                for (; i + 8 <= n; i += 8) {
+                    uint64_t word;
+                    memcpy(&word, row + i, 8);
+                    h = (h ^ word) * prime;
+                }
+                for (; i < n; i++) {
+                    h = (h ^ row[i]) * prime;
+                }
+            }
+        }
+        return h;
+    }
+
+    string matcherIndexFingerprint(const DescriptorMatcher& matcher,
+            const Feature& feature) {
+        FileStorage fs(".yml", FileStorage::WRITE + FileStorage::MEMORY);
+        matcher.write(fs);
+        return feature.fingerprint() + typeid (matcher).name() + "\n"
+                + fs.releaseAndGetString()
+                + (boost::format("%016x") % hashDescriptors(matcher.getTrainDescriptors())).str();
+    }
+
+    bool writeMatcherIndex(const bfs::path& path, const DescriptorMatcher& matcher,
+            const Feature& feature) {
+        const PersistentIndex* index = dynamic_cast<const PersistentIndex*> (&matcher);
+        if (!index) {
+            return false;
+        }
+        bfs::path tmp = path.string() + "." + bfs::unique_path().string();
+
+        {
+            BinaryWriter out(tmp);
+            out.bytes(INDEX_MAGIC, sizeof (INDEX_MAGIC));
+            out.value<uint32_t > (MATCHER_INDEX_VERSION);
+            out.text(matcherIndexFingerprint(matcher, feature));
+            index->writeIndex(out.stream());
+
+            if (!out.good()) {
+                bfs::remove(tmp);
+                return false;
+            }
+        }
+
+        boost::system::error_code ec;
+        bfs::rename(tmp, path, ec);
+        if (ec) {
+            bfs::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    bool readMatcherIndex(const bfs::path& path, DescriptorMatcher& matcher,
+            const Feature& feature) {
+        PersistentIndex* index = dynamic_cast<PersistentIndex*> (&matcher);
+        if (!index || !bfs::exists(path)) {
+            return false;
+        }
+
+        BinaryReader in(path);
+        char magic[sizeof (INDEX_MAGIC)];
+        in.bytes(magic, sizeof (magic));
+        if (!in.good() || memcmp(magic, INDEX_MAGIC, sizeof (magic)) != 0) {
+            return false;
+        }
+        if (in.value<uint32_t > () != MATCHER_INDEX_VERSION) {
+            return false;
+        }
+        if (in.text() != matcherIndexFingerprint(matcher, feature)) {
+            return false;
+        }
+        return in.good() && index->readIndex(in.stream());
+    }
+
+    void writePackedModelbase(const bfs::path& path, const Modelbase& modelbase,
+            const Feature& feature) {
+        // Processes may have mapped the pack at path; replacing it by a rename
+        // leaves their mapping intact, whereas truncating it would not.
+        bfs::path tmp = path.string() + "." + bfs::unique_path().string();
+
+        {
+            BinaryWriter out(tmp);
+            out.bytes(PACK_MAGIC, sizeof (PACK_MAGIC));
+            out.value<uint32_t > (PACKED_MODELBASE_VERSION);
+            out.text(feature.fingerprint());
+            out.value<uint32_t > (modelbase.models.size());
+
+            BOOST_FOREACH(const PlanarModel& m, modelbase.models) {
+                CV_Assert(!m.views.empty());
+                out.text(m.name);
+                for (int i = 0; i < 4; i++) {
+                    out.value<double>(m.color[i]);
+                }
+                out.value<uint32_t > (m.views.size());
+
+                BOOST_FOREACH(const PlanarView& v, m.views) {
+                    Mat h;
+                    v.homography.convertTo(h, CV_64F);
+                    out.matrix(h);
+                    out.keypoints(v.keypoints);
+                }
+                out.keypoints(m.allKeypoints);
+                CV_Assert(m.allWeights.size() == m.allKeypoints.size());
+
+                BOOST_FOREACH(int w, m.allWeights) {
+                    out.value<int32_t > (w);
+                }
+                out.alignedMatrix(m.allDescriptors);
+                out.alignedMatrix(m.views[0].image);
+                out.alignedMatrix(m.views[0].roi);
+            }
+
+            out.stream().flush();
+            if (!out.good()) {
+                bfs::remove(tmp);
+                throw runtime_error("Cannot write packed modelbase " + path.string());
+            }
+        }
+
+        boost::system::error_code ec;
+        bfs::rename(tmp, path, ec);
+        if (ec) {
+            bfs::remove(tmp, ec);
+            throw runtime_error("Cannot write packed modelbase " + path.string());
+        }
+    }
+
+    Modelbase mapPackedModelbase(const bfs::path& path, const Feature& feature) {
+        shared_ptr<MappedFile> mapping = make_shared<MappedFile>(path);
+        const uchar* begin = static_cast<const uchar*> (mapping->region.get_address());
+        MemoryReader in(begin, begin + mapping->region.get_size());
+
+        if (memcmp(in.bytes(sizeof (PACK_MAGIC)), PACK_MAGIC, sizeof (PACK_MAGIC)) != 0
+                || in.value<uint32_t > () != PACKED_MODELBASE_VERSION) {
+            throw runtime_error(path.string() + " is not a packed modelbase.");
+        }
+        if (in.text() != feature.fingerprint()) {
+            throw runtime_error(path.string() + " was packed with another feature.");
+        }
+
+        // A model takes at least a name, a color and a view count.
+        Modelbase modelbase(feature);
+        uint32_t nmodels = in.count(sizeof (uint32_t) + 4 * sizeof (double)
+                + sizeof (uint32_t));
+        modelbase.models.resize(nmodels);
+
+        BOOST_FOREACH(PlanarModel& m, modelbase.models) {
+            m.name = in.text();
+            for (int i = 0; i < 4; i++) {
+                m.color[i] = in.value<double>();
+            }
+            // A view takes at least its homography and a keypoint count.
+            uint32_t nviews = in.count(3 * sizeof (int32_t) + 9 * sizeof (double)
+                    + sizeof (uint32_t));
+            if (nviews == 0) {
+                throw runtime_error(path.string() + " is corrupt.");
+            }
+            m.views.resize(nviews);
+
+            BOOST_FOREACH(PlanarView& v, m.views) {
+                Mat h(3, 3, CV_64FC1);
+                int32_t rows = in.value<int32_t > ();
+                int32_t cols = in.value<int32_t > ();
+                int32_t type = in.value<int32_t > ();
+                if (rows != 3 || cols != 3 || type != CV_64FC1) {
+                    throw runtime_error(path.string() + " is corrupt.");
+                }
+                memcpy(h.data, in.bytes(9 * sizeof (double)), 9 * sizeof (double));
+                v.homography = h;
+                in.keypoints(v.keypoints);
+            }
+            in.keypoints(m.allKeypoints);
+            m.allWeights.resize(m.allKeypoints.size());
+
+            BOOST_FOREACH(int& w, m.allWeights) {
+                w = in.value<int32_t > ();
+            }
+            m.allDescriptors = in.alignedMatrix();
+            m.views[0].image = in.alignedMatrix();
+            m.views[0].roi = in.alignedMatrix();
+
+            // The descriptors of the views are stored one after another.
+            m.viewOffsets.assign(1, 0);
+
+            BOOST_FOREACH(PlanarView& v, m.views) {
+                int offset = m.viewOffsets.back();
+                int n = v.keypoints.size();
+                if (offset + n > m.allDescriptors.rows) {
+                    throw runtime_error(path.string() + " is corrupt.");
+                }
+                v.descriptors = m.allDescriptors.rowRange(offset, offset + n);
+                m.viewOffsets.push_back(offset + n);
+            }
+            m.storage = mapping;
+        }
+
+        return modelbase;
+    }
+
+}
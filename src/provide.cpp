@@ -6,26 +6,174 @@
 
 #include "tpofinder/provide.h"
 
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <stdexcept>
 
 using namespace cv;
 using namespace std;
 
 namespace tpofinder {
 
-    void WebcamImageProvider::capture_loop() {
-        cv::Mat buffer;
-        while (!stop_) {
-            capture_ >> buffer;
-            image_mutex_.lock();
-            image_ = buffer;
+    /** non-public interface */
+    namespace {
+
+        /** Marks the middle slot of a FrameBuffer as not taken yet. */
+        const unsigned FRESH = 4;
+
+        const unsigned SLOT = 3;
+
+        double now() {
+            return chrono::duration<double>(
+                    chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        /** Reduces the image in place as given by the options and returns the
+         * factor. */
+        int reduce(Mat &image, const DecodeOptions &options) {
+            int reduction = 1;
+            if (image.empty() || options.max_pixels <= 0) {
+                return reduction;
+            }
+            // The factors of reduced JPEG decoding; area interpolation by an
+            // integer factor averages whole blocks of pixels.
+            double pixels = image.total();
+            while (reduction < 8
+                    && pixels / (reduction * reduction) > options.max_pixels) {
+                reduction *= 2;
+            }
+            if (reduction > 1) {
+                Mat reduced;
+                resize(image, reduced, Size(image.cols / reduction,
+                        image.rows / reduction), 0, 0, INTER_AREA);
+                image = reduced;
+            }
+            return reduction;
+        }
+
+    }
+
+    FrameBuffer::FrameBuffer(Policy policy, size_t capacity) :
+    /*       */ policy_(policy), capacity_(capacity), middle_(1), back_(0),
+    /*       */ front_(2), waiting_(false), closed_(false), dropped_(0) {
+        CV_Assert(capacity > 0);
+    }
+
+    bool FrameBuffer::put(Mat &image, const FrameInfo &info) {
+        if (policy_ == LATEST) {
+            return putLatest(image, info);
+        }
+        unique_lock<mutex> lock(mutex_);
+        if (policy_ == NEVER_DROP) {
+            space_.wait(lock, [&]() {
+                return closed_ || queue_.size() < capacity_;
+            });
+        } else if (queue_.size() == capacity_) {
+            queue_.pop_front();
+            dropped_++;
+        }
+        if (closed_) {
+            return false;
+        }
+        Slot slot;
+        slot.image = image;
+        slot.info = info;
+        queue_.push_back(slot);
+        image = Mat();
+        ready_.notify_one();
+        return true;
+    }
+
+    bool FrameBuffer::putLatest(Mat &image, const FrameInfo &info) {
+        if (closed_) {
+            return false;
+        }
+        // The back slot holds either an empty image or a frame that has been
+        // dropped, which nobody refers to; hand it back for reuse.
+        swap(slots_[back_].image, image);
+        slots_[back_].info = info;
+        unsigned old = middle_.exchange(back_ | FRESH);
+        back_ = old & SLOT;
+        if (old & FRESH) {
+            dropped_++;
+        }
+        if (waiting_) {
+            // The consumer either sees the new frame before it waits, or it
+            // holds the mutex until it waits and is woken up here.
+            lock_guard<mutex> lock(mutex_);
             ready_.notify_one();
-            image_mutex_.unlock();
         }
+        return true;
+    }
+
+    bool FrameBuffer::take(Mat &image, FrameInfo &info) {
+        if (policy_ == LATEST) {
+            return takeLatest(image, info);
+        }
+        unique_lock<mutex> lock(mutex_);
+        ready_.wait(lock, [&]() {
+            return closed_ || !queue_.empty();
+        });
+        if (queue_.empty()) {
+            return false;
+        }
+        image = queue_.front().image;
+        info = queue_.front().info;
+        queue_.pop_front();
+        space_.notify_one();
+        return true;
+    }
+
+    bool FrameBuffer::takeLatest(Mat &image, FrameInfo &info) {
+        if (!(middle_ & FRESH)) {
+            unique_lock<mutex> lock(mutex_);
+            waiting_ = true;
+            ready_.wait(lock, [&]() {
+                return closed_ || (middle_ & FRESH);
+            });
+            waiting_ = false;
+            if (!(middle_ & FRESH)) {
+                return false;
+            }
+        }
+        front_ = middle_.exchange(front_) & SLOT;
+        // The caller keeps the only reference to the frame; the producer will
+        // capture into a new image.
+        image = slots_[front_].image;
+        slots_[front_].image.release();
+        info = slots_[front_].info;
+        return true;
+    }
+
+    void FrameBuffer::close() {
+        lock_guard<mutex> lock(mutex_);
+        closed_ = true;
+        ready_.notify_all();
+        space_.notify_all();
+    }
+
+    uint64_t FrameBuffer::dropped() const {
+        return dropped_;
+    }
+
+    void WebcamImageProvider::capture_loop() {
+        cv::Mat frame;
+        FrameInfo info;
+        while (!stop_ && capture_.read(frame)) {
+            info.timestamp = now();
+            if (!buffer_.put(frame, info)) {
+                break;
+            }
+            info.sequence++;
+        }
+        buffer_.close();
     }
     
-    WebcamImageProvider::WebcamImageProvider() : capture_(0), image_mutex_(),
-            image_(), ready_(), stop_(false) {
+    WebcamImageProvider::WebcamImageProvider(int device,
+            FrameBuffer::Policy policy, size_t capacity) : capture_(device),
+            buffer_(policy, capacity), stop_(false) {
         if (!capture_.isOpened()) {
             cerr << "Could not open default camera." << endl;
             exit(-1);
@@ -35,42 +183,259 @@ namespace tpofinder {
 
     WebcamImageProvider::~WebcamImageProvider() {
         stop_ = true;
+        buffer_.close();
         worker_->join();
         delete worker_;
     }
 
     bool WebcamImageProvider::next(cv::Mat &image) {
-        std::unique_lock<std::mutex> lock(image_mutex_);
-        ready_.wait(lock);
-        image = image_;
+        FrameInfo info;
+        return next(image, info);
+    }
+
+    bool WebcamImageProvider::next(cv::Mat &image, FrameInfo &info) {
+        return buffer_.take(image, info);
+    }
+
+    uint64_t WebcamImageProvider::dropped() const {
+        return buffer_.dropped();
+    }
+
+    Mat read_image(const string &file, const DecodeOptions &options,
+            int &reduction) {
+        Mat image = imread(file, options.grayscale
+                ? CV_LOAD_IMAGE_GRAYSCALE : CV_LOAD_IMAGE_COLOR);
+        reduction = reduce(image, options);
+        return image;
+    }
+
+    VideoFileImageProvider::VideoFileImageProvider(const string &file,
+            size_t stride, size_t start, const DecodeOptions &options,
+            size_t capacity) : ImageProvider(options), capture_(file),
+            stride_(stride), fps_(0),
+            buffer_(FrameBuffer::NEVER_DROP, capacity), stop_(false) {
+        CV_Assert(stride > 0);
+        if (!capture_.isOpened()) {
+            throw runtime_error("Could not open video " + file);
+        }
+        fps_ = capture_.get(CV_CAP_PROP_FPS);
+        if (start > 0) {
+            capture_.set(CV_CAP_PROP_POS_FRAMES, start);
+        }
+        last_file_ = file;
+        worker_ = new thread(&VideoFileImageProvider::decode_loop, std::ref(*this));
+    }
+
+    VideoFileImageProvider::~VideoFileImageProvider() {
+        stop_ = true;
+        buffer_.close();
+        worker_->join();
+        delete worker_;
+    }
+
+    void VideoFileImageProvider::decode_loop() {
+        Mat frame;
+        FrameInfo info;
+        while (!stop_) {
+            if (!capture_.read(frame)) {
+                break;
+            }
+            info.timestamp = now();
+            // After reading, the position is that of the frame just read,
+            // but the frame number is that of the next one. Image sequences
+            // have no position; derive it from the frame rate then.
+            info.sequence = (uint64_t) capture_.get(CV_CAP_PROP_POS_FRAMES) - 1;
+            info.position = capture_.get(CV_CAP_PROP_POS_MSEC) / 1000;
+            if (info.position == 0 && fps_ > 0) {
+                info.position = info.sequence / fps_;
+            }
+            if (options_.grayscale && frame.channels() > 1) {
+                Mat gray;
+                cvtColor(frame, gray, CV_BGR2GRAY);
+                frame = gray;
+            }
+            info.reduction = reduce(frame, options_);
+            if (!buffer_.put(frame, info)) {
+                break;
+            }
+            // Skipped frames are only grabbed, not converted.
+            bool more = true;
+            for (size_t i = 1; i < stride_ && more; i++) {
+                more = capture_.grab();
+            }
+            if (!more) {
+                break;
+            }
+        }
+        buffer_.close();
+    }
+
+    bool VideoFileImageProvider::next(Mat &image) {
+        FrameInfo info;
+        return next(image, info);
+    }
+
+    bool VideoFileImageProvider::next(Mat &image, FrameInfo &info) {
+        if (!buffer_.take(image, info)) {
+            return false;
+        }
+        last_reduction_ = info.reduction;
         return true;
     }
-    
+
+    double VideoFileImageProvider::fps() const {
+        return fps_;
+    }
+
+    Mat ImageProvider::read_file(const string &file) {
+        last_file_ = file;
+        Mat image = read_image(file, options_, last_reduction_);
+        if (image.empty()) {
+            last_error_ = "Could not read image " + file;
+        } else {
+            last_error_.clear();
+        }
+        return image;
+    }
+
+    StdinFilenameImageProvider::StdinFilenameImageProvider(
+            const DecodeOptions &options) : ImageProvider(options) {}
+
     bool StdinFilenameImageProvider::next(Mat &image) {
         string s;
         getline(cin, s);
         if (s.empty()) {
             return false;
-        } else {
-            image = imread(s);
-        }
-        if (image.empty()) {
-            return false;
-        } else {
-            return true;
         }
+        image = read_file(s);
+        return true;
     }
 
     ListFilenameImageProvider::ListFilenameImageProvider(const vector<string>
-            &files) : num_(0), files_(files) {}
+            &files, const DecodeOptions &options) : ImageProvider(options),
+            num_(0), files_(files) {}
 
     bool ListFilenameImageProvider::next(Mat &image) {
         if (num_ < files_.size()) {
-            string f = files_[num_++];
-            image = imread(f);
+            image = read_file(files_[num_++]);
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    PrefetchImageProvider::PrefetchImageProvider(const vector<string> &files,
+            unsigned threads, size_t memory_budget,
+            const DecodeOptions &options) : ImageProvider(options),
+            files_(files), stream_(NULL), memory_budget_(memory_budget) {
+        start(threads);
+    }
+
+    PrefetchImageProvider::PrefetchImageProvider(istream &files,
+            unsigned threads, size_t memory_budget,
+            const DecodeOptions &options) : ImageProvider(options),
+            stream_(&files), memory_budget_(memory_budget) {
+        start(threads);
+    }
+
+    void PrefetchImageProvider::start(unsigned threads) {
+        if (threads == 0) {
+            threads = defaultThreads();
+        }
+        next_file_ = 0;
+        end_of_files_ = false;
+        waiting_bytes_ = 0;
+        taken_ = 0;
+        decoded_.reset(new OrderedQueue<Decoded>(2 * threads));
+        running_ = threads;
+        for (unsigned t = 0; t < threads; t++) {
+            workers_.push_back(thread(&PrefetchImageProvider::decode_loop, this));
+        }
+    }
+
+    PrefetchImageProvider::~PrefetchImageProvider() {
+        end_of_files_ = true;
+        {
+            lock_guard<mutex> lock(mutex_);
+            // Release workers waiting for the budget.
+            memory_budget_ = SIZE_MAX;
+            budget_.notify_all();
+        }
+        decoded_->close();
+        for (size_t t = 0; t < workers_.size(); t++) {
+            workers_[t].join();
+        }
+    }
+
+    bool PrefetchImageProvider::take_file(size_t &number, string &file) {
+        lock_guard<mutex> lock(files_mutex_);
+        if (end_of_files_) {
+            return false;
+        }
+        if (stream_) {
+            if (!getline(*stream_, file) || file.empty()) {
+                end_of_files_ = true;
+                return false;
+            }
+        } else if (next_file_ < files_.size()) {
+            file = files_[next_file_];
         } else {
+            end_of_files_ = true;
+            return false;
+        }
+        number = next_file_++;
+        return true;
+    }
+
+    void PrefetchImageProvider::decode_loop() {
+        size_t number;
+        Decoded decoded;
+        while (take_file(number, decoded.file)) {
+            {
+                // The next image to be taken is decoded in any case, such that
+                // the consumer cannot starve.
+                unique_lock<mutex> lock(mutex_);
+                budget_.wait(lock, [&]() {
+                    return waiting_bytes_ < memory_budget_ || number == taken_;
+                });
+            }
+            decoded.image = read_image(decoded.file, options_, decoded.reduction);
+            decoded.error.clear();
+            if (decoded.image.empty()) {
+                decoded.error = "Could not read image " + decoded.file;
+            }
+            size_t bytes = decoded.image.total() * decoded.image.elemSize();
+            {
+                lock_guard<mutex> lock(mutex_);
+                waiting_bytes_ += bytes;
+            }
+            if (!decoded_->push(number, move(decoded))) {
+                break;
+            }
+            decoded = Decoded();
+        }
+        if (--running_ == 0) {
+            decoded_->close();
+        }
+    }
+
+    bool PrefetchImageProvider::next(Mat &image) {
+        size_t number;
+        Decoded decoded;
+        if (!decoded_->pop(number, decoded)) {
             return false;
         }
+        {
+            lock_guard<mutex> lock(mutex_);
+            waiting_bytes_ -= decoded.image.total() * decoded.image.elemSize();
+            taken_ = number + 1;
+            budget_.notify_all();
+        }
+        image = decoded.image;
+        last_file_ = decoded.file;
+        last_error_ = decoded.error;
+        last_reduction_ = decoded.reduction;
+        return true;
     }
 
 }
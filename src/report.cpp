@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "tpofinder/report.h"
+
+#include <boost/foreach.hpp>
+#include <boost/format.hpp>
+
+using namespace cv;
+using namespace std;
+
+namespace tpofinder {
+
+    /** non-public interface */
+    namespace {
+
+        string jsonString(const string& s) {
+            string quoted = "\"";
+
+            BOOST_FOREACH(char c, s) {
+                switch (c) {
+                    case '"':
+                        quoted += "\\\"";
+                        break;
+                    case '\\':
+                        quoted += "\\\\";
+                        break;
+                    case '\n':
+                        quoted += "\\n";
+                        break;
+                    case '\t':
+                        quoted += "\\t";
+                        break;
+                    default:
+                        if ((unsigned char) c < 0x20) {
+                            quoted += str(boost::format("\\u%04x") % (int) c);
+                        } else {
+                            quoted += c;
+                        }
+                }
+            }
+            return quoted + "\"";
+        }
+
+        /** Quotes a CSV field if it contains a separator, a quote or a line
+         * break. */
+        string csvField(const string& s) {
+            if (s.find_first_of(",\"\r\n") == string::npos) {
+                return s;
+            }
+            string quoted = "\"";
+
+            BOOST_FOREACH(char c, s) {
+                quoted += c;
+                if (c == '"') {
+                    quoted += '"';
+                }
+            }
+            return quoted + "\"";
+        }
+
+        string number(double x) {
+            return str(boost::format("%.9g") % x);
+        }
+
+        string milliseconds(double seconds) {
+            return str(boost::format("%.3f") % (1000 * seconds));
+        }
+
+        void writeStage(ostream& out, const string& stage,
+                const LatencyHistogram& h) {
+            out << boost::format("%-10s %8d %9.3f %9.3f %9.3f %9.3f %9.3f\n")
+                    % stage % h.count() % (1000 * h.mean())
+                    % (1000 * h.quantile(0.5)) % (1000 * h.quantile(0.9))
+                    % (1000 * h.quantile(0.99)) % (1000 * h.max());
+        }
+
+        /** The nine entries of a homography, separated by the given string. */
+        string homography(const Mat& h, const string& separator) {
+            string entries;
+            for (int i = 0; i < 9; i++) {
+                entries += (i > 0 ? separator : "") + number(h.at<double>(i / 3, i % 3));
+            }
+            return entries;
+        }
+
+    }
+
+    void writeReportHeader(ostream& out, ReportFormat format) {
+        if (format == CSV) {
+            out << "frame,file,error,decode_ms,describe_ms,detect_ms,model,"
+                    "matches,inliers,h00,h01,h02,h10,h11,h12,h20,h21,h22\n";
+        }
+    }
+
+    void writeReport(ostream& out, ReportFormat format, const FrameReport& frame,
+            const vector<Detection>& detections) {
+        if (format == JSON_LINES) {
+            out << "{\"frame\":" << frame.frame
+                    << ",\"file\":" << jsonString(frame.file);
+            if (!frame.error.empty()) {
+                out << ",\"error\":" << jsonString(frame.error);
+            }
+            out << ",\"decode_ms\":" << milliseconds(frame.decodeTime)
+                    << ",\"describe_ms\":" << milliseconds(frame.describeTime)
+                    << ",\"detect_ms\":" << milliseconds(frame.detectTime)
+                    << ",\"detections\":[";
+            for (size_t i = 0; i < detections.size(); i++) {
+                const Detection& d = detections[i];
+                out << (i > 0 ? "," : "")
+                        << "{\"model\":" << jsonString(d.model->name)
+                        << ",\"matches\":" << d.matches.size()
+                        << ",\"inliers\":" << d.inliers.size()
+                        << ",\"homography\":[" << homography(d.homography, ",")
+                        << "]}";
+            }
+            out << "]}\n";
+        } else {
+            string prefix = str(boost::format("%d,%s,%s,%s,%s,%s,")
+                    % frame.frame % csvField(frame.file) % csvField(frame.error)
+                    % milliseconds(frame.decodeTime)
+                    % milliseconds(frame.describeTime)
+                    % milliseconds(frame.detectTime));
+            if (detections.empty()) {
+                out << prefix << ",,,,,,,,,,,\n";
+            }
+
+            BOOST_FOREACH(const Detection& d, detections) {
+                out << prefix << csvField(d.model->name) << ","
+                        << d.matches.size() << "," << d.inliers.size() << ","
+                        << homography(d.homography, ",") << "\n";
+            }
+        }
+    }
+
+    void writeProfile(ostream& out, const DetectionProfile& profile) {
+        out << "stage         calls   mean ms    p50 ms    p90 ms    p99 ms    max ms\n";
+        writeStage(out, "keypoints", profile.keypoints);
+        writeStage(out, "extract", profile.extract);
+        writeStage(out, "match", profile.match);
+        writeStage(out, "verify", profile.verify);
+        writeStage(out, "filter", profile.filter);
+        writeStage(out, "detect", profile.detect);
+    }
+
+}
@@ -0,0 +1,495 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "tpofinder/report.h"
+#include "tpofinder/serve.h"
+
+#include <algorithm>
+#include <boost/foreach.hpp>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <opencv2/highgui/highgui.hpp>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace std;
+
+namespace tpofinder {
+
+    /** non-public interface */
+    namespace {
+
+        /** Number of latencies the statistics are computed from. */
+        const size_t LATENCY_WINDOW = 1024;
+
+        /** Requests with more data are rejected. */
+        const size_t MAX_REQUEST_BYTES = 256 << 20;
+
+        double now() {
+            return chrono::duration<double>(
+                    chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        sockaddr_un socketAddress(const string& path) {
+            sockaddr_un address;
+            memset(&address, 0, sizeof (address));
+            address.sun_family = AF_UNIX;
+            if (path.size() >= sizeof (address.sun_path)) {
+                throw runtime_error("Socket path too long: " + path);
+            }
+            strncpy(address.sun_path, path.c_str(), sizeof (address.sun_path) - 1);
+            return address;
+        }
+
+        string systemError(const string& what) {
+            return what + ": " + strerror(errno);
+        }
+
+        /** Reads a line without its line break; data received beyond it is
+         * kept in the buffer. */
+        bool readLine(int socket, string& buffer, string& line) {
+            size_t end;
+            while ((end = buffer.find('\n')) == string::npos) {
+                if (buffer.size() > 4096) {
+                    return false;
+                }
+                char chunk[4096];
+                ssize_t n = recv(socket, chunk, sizeof (chunk), 0);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return false;
+                }
+                buffer.append(chunk, n);
+            }
+            line = buffer.substr(0, end);
+            buffer.erase(0, end + 1);
+            return true;
+        }
+
+        /** Reads the given number of bytes, starting with those in the
+         * buffer. */
+        bool readBytes(int socket, string& buffer, uchar* data, size_t size) {
+            size_t taken = min(size, buffer.size());
+            copy(buffer.begin(), buffer.begin() + taken, data);
+            buffer.erase(0, taken);
+            while (taken < size) {
+                ssize_t n = recv(socket, data + taken, size - taken, 0);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return false;
+                }
+                taken += n;
+            }
+            return true;
+        }
+
+        bool writeAll(int socket, const char* data, size_t size) {
+            while (size > 0) {
+                ssize_t n = send(socket, data, size, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return false;
+                }
+                data += n;
+                size -= n;
+            }
+            return true;
+        }
+
+        /** Removes a socket file that no server listens on anymore, since it
+         * cannot be bound again. Throws if the path is taken by anything
+         * else, including a server that still listens. */
+        void removeStaleSocket(const string& path, const sockaddr_un& address) {
+            struct stat status;
+            if (lstat(path.c_str(), &status) < 0) {
+                if (errno == ENOENT) {
+                    return;
+                }
+                throw runtime_error(systemError("Cannot listen on " + path));
+            }
+            if (!S_ISSOCK(status.st_mode)) {
+                throw runtime_error("Cannot listen on " + path + ": address in use");
+            }
+            int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (probe < 0) {
+                throw runtime_error(systemError("Cannot create socket"));
+            }
+            int connected = connect(probe, (const sockaddr*) &address, sizeof (address));
+            int error = errno;
+            close(probe);
+            if (connected == 0 || error != ECONNREFUSED) {
+                throw runtime_error("Cannot listen on " + path + ": address in use");
+            }
+            unlink(path.c_str());
+        }
+
+        string milliseconds(double seconds) {
+            return str(boost::format("%.3f") % (1000 * seconds));
+        }
+
+    }
+
+    DetectionServer::DetectionServer(const Detector& detector,
+            const string& socketPath, const ServerConfig& config) :
+    /*       */ detector_(detector), path_(socketPath), config_(config),
+    /*       */ listener_(-1), stopping_(false), stopWorkers_(false),
+    /*       */ requests_(0), rejected_(0), batches_(0), maxQueueDepth_(0),
+    /*       */ latencies_(LATENCY_WINDOW, 0), latencyCount_(0) {
+        CV_Assert(config.workers > 0 && config.maxBatch > 0);
+        sockaddr_un address = socketAddress(path_);
+        listener_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener_ < 0) {
+            throw runtime_error(systemError("Cannot create socket"));
+        }
+        try {
+            removeStaleSocket(path_, address);
+        } catch (...) {
+            close(listener_);
+            throw;
+        }
+        if (::bind(listener_, (sockaddr*) &address, sizeof (address)) < 0
+                || listen(listener_, 64) < 0) {
+            string error = systemError("Cannot listen on " + path_);
+            close(listener_);
+            throw runtime_error(error);
+        }
+    }
+
+    DetectionServer::~DetectionServer() {
+        stop();
+        close(listener_);
+        unlink(path_.c_str());
+    }
+
+    void DetectionServer::run() {
+        vector<thread> workers;
+        for (unsigned t = 0; t < config_.workers; t++) {
+            workers.push_back(thread(&DetectionServer::work, this));
+        }
+
+        while (!stopping_) {
+            int socket = accept(listener_, 0, 0);
+            if (socket < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                break;
+            }
+
+            // Forget connections that have been closed.
+            for (list<shared_ptr<Connection> >::iterator it = connections_.begin();
+                    it != connections_.end();) {
+                if ((*it)->closed) {
+                    (*it)->thread.join();
+                    close((*it)->socket);
+                    it = connections_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            shared_ptr<Connection> connection = make_shared<Connection>();
+            connection->socket = socket;
+            connection->closed = false;
+            connection->thread = thread(&DetectionServer::serve, this,
+                    ref(*connection));
+            connections_.push_back(connection);
+        }
+
+        // Waiting requests are still detected; a connection ends after its
+        // current request.
+
+        BOOST_FOREACH(const shared_ptr<Connection>& c, connections_) {
+            shutdown(c->socket, SHUT_RD);
+        }
+
+        BOOST_FOREACH(const shared_ptr<Connection>& c, connections_) {
+            c->thread.join();
+            close(c->socket);
+        }
+        connections_.clear();
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopWorkers_ = true;
+        }
+        wake_.notify_all();
+
+        BOOST_FOREACH(thread& t, workers) {
+            t.join();
+        }
+    }
+
+    void DetectionServer::stop() {
+        stopping_ = true;
+        shutdown(listener_, SHUT_RDWR);
+    }
+
+    void DetectionServer::serve(Connection& connection) {
+        DetectionContext context;
+        string buffer;
+        string line;
+        for (size_t number = 0; readLine(connection.socket, buffer, line);) {
+            double start = now();
+            istringstream header(line);
+            string command;
+            header >> command;
+
+            if (command == "STATS") {
+                string reply = statsLine();
+                if (!writeAll(connection.socket, reply.data(), reply.size())) {
+                    break;
+                }
+                continue;
+            }
+
+            FrameReport report;
+            report.frame = number++;
+            Mat image;
+            bool valid = false;
+            if (command == "IMAGE") {
+                size_t size = 0;
+                if (header >> size && size > 0 && size <= MAX_REQUEST_BYTES) {
+                    vector<uchar> encoded(size);
+                    if (!readBytes(connection.socket, buffer, &encoded[0], size)) {
+                        break;
+                    }
+                    valid = true;
+                    image = imdecode(encoded, CV_LOAD_IMAGE_COLOR);
+                    if (image.empty()) {
+                        report.error = "Cannot decode image";
+                    }
+                }
+            } else if (command == "FRAME") {
+                int cols = 0, rows = 0, channels = 0;
+                if (header >> cols >> rows >> channels && cols > 0 && rows > 0
+                        && (channels == 1 || channels == 3)
+                        && (size_t) cols * rows * channels <= MAX_REQUEST_BYTES) {
+                    image.create(rows, cols, CV_8UC(channels));
+                    if (!readBytes(connection.socket, buffer, image.data,
+                            image.total() * image.elemSize())) {
+                        break;
+                    }
+                    valid = true;
+                }
+            }
+            if (!valid) {
+                // The data that follows cannot be told from the next request.
+                report.error = "Invalid request: " + line;
+                ostringstream reply;
+                writeReport(reply, JSON_LINES, report, vector<Detection>());
+                writeAll(connection.socket, reply.str().data(), reply.str().size());
+                break;
+            }
+            report.decodeTime = now() - start;
+
+            Request request;
+            if (!image.empty()) {
+                try {
+                    double describeStart = now();
+                    Scene scene = detector_.describe(image, context);
+                    report.describeTime = now() - describeStart;
+                    request.scene = &scene;
+                    if (!submit(request)) {
+                        report.error = "busy";
+                    } else if (request.error) {
+                        rethrow_exception(request.error);
+                    }
+                    report.detectTime = request.detectTime;
+                } catch (const exception& e) {
+                    report.error = e.what();
+                }
+            }
+
+            // The request counts before the reply is sent, such that a client
+            // that has received it also finds it in the statistics.
+            ostringstream reply;
+            writeReport(reply, JSON_LINES, report, request.detections);
+            recordLatency(now() - start);
+            if (!writeAll(connection.socket, reply.str().data(), reply.str().size())) {
+                break;
+            }
+        }
+        // The socket is closed by run(), such that its descriptor cannot be
+        // reused while run() may still shut it down.
+        shutdown(connection.socket, SHUT_RDWR);
+        connection.closed = true;
+    }
+
+    bool DetectionServer::submit(Request& request) {
+        unique_lock<mutex> lock(mutex_);
+        if (queue_.size() >= config_.maxQueue) {
+            rejected_++;
+            return false;
+        }
+        queue_.push_back(&request);
+        maxQueueDepth_ = max(maxQueueDepth_, queue_.size());
+        wake_.notify_one();
+        done_.wait(lock, [&request]() {
+            return request.done;
+        });
+        return true;
+    }
+
+    void DetectionServer::work() {
+        DetectionContext context;
+        vector<Request*> batch;
+        vector<const Scene*> scenes;
+        while (true) {
+            unique_lock<mutex> lock(mutex_);
+            wake_.wait(lock, [this]() {
+                return stopWorkers_ || !queue_.empty();
+            });
+            if (queue_.empty()) {
+                return;
+            }
+            // Everything that arrived while the workers were busy is detected
+            // together.
+            batch.clear();
+            scenes.clear();
+            while (!queue_.empty() && batch.size() < config_.maxBatch) {
+                batch.push_back(queue_.front());
+                scenes.push_back(queue_.front()->scene);
+                queue_.pop_front();
+            }
+            lock.unlock();
+
+            double start = now();
+            vector<vector<Detection> > detections;
+            exception_ptr error;
+            try {
+                detections = detector_.detect(scenes, context);
+            } catch (...) {
+                error = current_exception();
+            }
+            double time = now() - start;
+
+            lock.lock();
+            for (size_t i = 0; i < batch.size(); i++) {
+                if (error) {
+                    batch[i]->error = error;
+                } else {
+                    batch[i]->detections = move(detections[i]);
+                }
+                batch[i]->detectTime = time;
+                batch[i]->done = true;
+            }
+            batches_++;
+            done_.notify_all();
+        }
+    }
+
+    void DetectionServer::recordLatency(double seconds) {
+        lock_guard<mutex> lock(mutex_);
+        latencies_[latencyCount_ % LATENCY_WINDOW] = seconds;
+        latencyCount_++;
+        requests_++;
+    }
+
+    ServerStats DetectionServer::stats() const {
+        ServerStats stats;
+        vector<double> latencies;
+        {
+            lock_guard<mutex> lock(mutex_);
+            stats.requests = requests_;
+            stats.rejected = rejected_;
+            stats.batches = batches_;
+            stats.queueDepth = queue_.size();
+            stats.maxQueueDepth = maxQueueDepth_;
+            latencies.assign(latencies_.begin(),
+                    latencies_.begin() + min(latencyCount_, LATENCY_WINDOW));
+        }
+
+        stats.meanLatency = stats.medianLatency = stats.p90Latency = 0;
+        stats.p99Latency = stats.maxLatency = 0;
+        if (!latencies.empty()) {
+            sort(latencies.begin(), latencies.end());
+            double sum = 0;
+
+            BOOST_FOREACH(double l, latencies) {
+                sum += l;
+            }
+            size_t n = latencies.size();
+            stats.meanLatency = sum / n;
+            stats.medianLatency = latencies[n / 2];
+            stats.p90Latency = latencies[min(n - 1, n * 90 / 100)];
+            stats.p99Latency = latencies[min(n - 1, n * 99 / 100)];
+            stats.maxLatency = latencies[n - 1];
+        }
+        return stats;
+    }
+
+    string DetectionServer::statsLine() const {
+        ServerStats s = stats();
+        return str(boost::format("{\"requests\":%d,\"rejected\":%d,"
+                "\"batches\":%d,\"queue_depth\":%d,\"max_queue_depth\":%d,"
+                "\"latency_ms\":{\"mean\":%s,\"median\":%s,\"p90\":%s,"
+                "\"p99\":%s,\"max\":%s}}\n")
+                % s.requests % s.rejected % s.batches % s.queueDepth
+                % s.maxQueueDepth % milliseconds(s.meanLatency)
+                % milliseconds(s.medianLatency) % milliseconds(s.p90Latency)
+                % milliseconds(s.p99Latency) % milliseconds(s.maxLatency));
+    }
+
+    DetectionClient::DetectionClient(const string& socketPath) {
+        sockaddr_un address = socketAddress(socketPath);
+        socket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket_ < 0) {
+            throw runtime_error(systemError("Cannot create socket"));
+        }
+        if (connect(socket_, (sockaddr*) &address, sizeof (address)) < 0) {
+            string error = systemError("Cannot connect to " + socketPath);
+            close(socket_);
+            throw runtime_error(error);
+        }
+    }
+
+    DetectionClient::~DetectionClient() {
+        close(socket_);
+    }
+
+    string DetectionClient::detect(const vector<uchar>& encoded) {
+        return request(str(boost::format("IMAGE %d\n") % encoded.size()),
+                encoded.empty() ? 0 : &encoded[0], encoded.size());
+    }
+
+    string DetectionClient::detect(const Mat& frame) {
+        CV_Assert(frame.depth() == CV_8U
+                && (frame.channels() == 1 || frame.channels() == 3));
+        Mat continuous = frame.isContinuous() ? frame : frame.clone();
+        return request(str(boost::format("FRAME %d %d %d\n") % frame.cols
+                % frame.rows % frame.channels()), continuous.data,
+                continuous.total() * continuous.elemSize());
+    }
+
+    string DetectionClient::stats() {
+        return request("STATS\n", 0, 0);
+    }
+
+    string DetectionClient::request(const string& header, const uchar* data,
+            size_t size) {
+        string reply;
+        if (!writeAll(socket_, header.data(), header.size())
+                || !writeAll(socket_, (const char*) data, size)
+                || !readLine(socket_, buffer_, reply)) {
+            throw runtime_error("Connection to detection server lost");
+        }
+        return reply;
+    }
+
+}
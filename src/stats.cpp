@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "tpofinder/stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace tpofinder {
+
+    LatencyHistogram::LatencyHistogram() {
+        clear();
+    }
+
+    int LatencyHistogram::bucketOf(uint64_t micros) {
+        // Durations below 8 microseconds have a bucket each; above, the three
+        // bits after the leading one select the bucket within the octave.
+        if (micros < 8) {
+            return micros;
+        }
+        int octave = 63;
+        while (!(micros >> octave)) {
+            octave--;
+        }
+        int bucket = (octave - 2) * 8 + ((micros >> (octave - 3)) & 7);
+        return min(bucket, BUCKETS - 1);
+    }
+
+    uint64_t LatencyHistogram::lowerBound(int bucket) {
+        if (bucket < 8) {
+            return bucket;
+        }
+        int octave = bucket / 8 + 2;
+        return (uint64_t) (8 + bucket % 8) << (octave - 3);
+    }
+
+    void LatencyHistogram::record(double seconds) {
+        uint64_t nanos = (uint64_t) (std::max(seconds, 0.0) * 1e9);
+        counts_[bucketOf(nanos / 1000)].fetch_add(1, memory_order_relaxed);
+        totalNanos_.fetch_add(nanos, memory_order_relaxed);
+        uint64_t m = maxNanos_.load(memory_order_relaxed);
+        while (nanos > m && !maxNanos_.compare_exchange_weak(m, nanos,
+                memory_order_relaxed)) {
+        }
+        count_.fetch_add(1, memory_order_relaxed);
+    }
+
+    size_t LatencyHistogram::count() const {
+        return count_.load(memory_order_relaxed);
+    }
+
+    double LatencyHistogram::mean() const {
+        uint64_t n = count_.load(memory_order_relaxed);
+        return n == 0 ? 0 : totalNanos_.load(memory_order_relaxed) * 1e-9 / n;
+    }
+
+    double LatencyHistogram::max() const {
+        return maxNanos_.load(memory_order_relaxed) * 1e-9;
+    }
+
+    double LatencyHistogram::quantile(double fraction) const {
+        // Counts may be updated meanwhile; the buckets are summed first, such
+        // that the rank refers to what is actually seen.
+        uint64_t counts[BUCKETS];
+        uint64_t total = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            counts[b] = counts_[b].load(memory_order_relaxed);
+            total += counts[b];
+        }
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t) ceil(fraction * total));
+        for (int b = 0; b < BUCKETS; b++) {
+            if (counts[b] >= rank) {
+                // The middle of the bucket, but never more than the maximum.
+                double middle = (lowerBound(b) + lowerBound(b + 1)) * 0.5e-6;
+                return min(middle, max());
+            }
+            rank -= counts[b];
+        }
+        return max();
+    }
+
+    void LatencyHistogram::clear() {
+        for (int b = 0; b < BUCKETS; b++) {
+            counts_[b] = 0;
+        }
+        count_ = 0;
+        totalNanos_ = 0;
+        maxNanos_ = 0;
+    }
+
+}
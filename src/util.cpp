@@ -52,12 +52,16 @@ namespace tpofinder {
 
     void perspectiveTransformKeypoints(const vector<KeyPoint>& src,
             vector<KeyPoint>& dst, const Mat& mtx) {
-        Mat_<Point2f> srcMat;
+        if (src.empty()) {
+            return;
+        }
+        Mat_<Point2f> srcMat(src.size(), 1);
         for (size_t i = 0; i < src.size(); i++) {
-            srcMat.push_back(src[i].pt);
+            srcMat(i) = src[i].pt;
         }
         Mat_<Point2f> dstMat;
         perspectiveTransform(srcMat, dstMat, mtx);
+        dst.reserve(dst.size() + src.size());
         for (size_t i = 0; i < src.size(); i++) {
             KeyPoint k = src[i];
             k.pt = dstMat.at<Point2f > (i);
@@ -65,6 +69,25 @@ namespace tpofinder {
         }
     }
 
+    Mat createAligned(int rows, int cols, int type, size_t alignment) {
+        int cn = CV_MAT_CN(type);
+        int depth = CV_MAT_DEPTH(type);
+        size_t esz1 = CV_ELEM_SIZE1(depth);
+        int n = rows * cols * cn;
+        if (n == 0) {
+            return Mat(rows, cols, type);
+        }
+        CV_Assert(alignment % esz1 == 0);
+
+        // Over-allocate a single row and cut out a properly aligned range;
+        // the range shares the reference count of the whole row.
+        int pad = alignment / esz1;
+        Mat buffer(1, n + pad, depth);
+        size_t misalignment = (size_t) buffer.data % alignment;
+        int offset = misalignment == 0 ? 0 : (alignment - misalignment) / esz1;
+        return buffer.colRange(offset, offset + n).reshape(cn, rows);
+    }
+
     vector<int> findInliers(const vector<Point2f>& pts1, const vector<Point2f>& pts2,
             const Mat& homography, const float reprojThreshold) {
         CV_Assert(pts1.size() == pts2.size());
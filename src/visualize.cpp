@@ -47,9 +47,9 @@ namespace tpofinder {
     }
 
     void drawMatches(Mat& out, const Scene& scene, const Detection& detection) {
-        const PlanarView& view = detection.model.views[0];
+        const PlanarView& view = detection.model->views[0];
         drawMatches(scene.image, scene.keypoints, view.image,
-                detection.model.allKeypoints, detection.matches, out);
+                detection.model->allKeypoints, detection.matches, out);
     }
 
     /** non-public interface */
@@ -118,14 +118,14 @@ namespace tpofinder {
         vector<KeyPoint> inlierKpts, tKpts;
 
         BOOST_FOREACH(const DMatch& dm, detection.matches) {
-            inlierKpts.push_back(detection.model.allKeypoints[dm.trainIdx]);
+            inlierKpts.push_back(detection.model->allKeypoints[dm.trainIdx]);
         }
         perspectiveTransformKeypoints(inlierKpts, tKpts, detection.homography);
-        drawKeypoints(out, tKpts, out, detection.model.color);
+        drawKeypoints(out, tKpts, out, detection.model->color);
 
-        string label = str(boost::format("%s (%d/%d)") % detection.model.name %
+        string label = str(boost::format("%s (%d/%d)") % detection.model->name %
                 detection.inliers.size() % detection.matches.size());
-        drawModelContour(out, detection.model, detection.homography, label);
+        drawModelContour(out, *detection.model, detection.homography, label);
     }
 
     void drawCenteredText(Mat& out, const string& text, const Point& org,
@@ -0,0 +1,330 @@
+/**
+ * Copyright (c) 2012 Andreas Heider, Julius Adorf, Markus Grimm
+ *
+ * MIT License (http://www.opensource.org/licenses/mit-license.php)
+ */
+
+#include "tpofinder/vocabulary.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <limits>
+
+using namespace cv;
+using namespace std;
+
+namespace tpofinder {
+
+    /** non-public interface */
+    namespace {
+
+        /** Seed of the cluster initialization; fixed such that building a
+         * vocabulary is reproducible. */
+        const uint64 SEED = 0x70cab;
+
+        /** Returns the index of the center nearest to the descriptor; ties
+         * are resolved in favour of the lower index. */
+        int nearest(const uchar* descriptor, const vector<uchar>& centers,
+                int k, int bytes) {
+            int best = 0;
+            int bestDistance = INT_MAX;
+            for (int c = 0; c < k; c++) {
+                int d = normHamming(descriptor, &centers[c * bytes], bytes);
+                if (d < bestDistance) {
+                    best = c;
+                    bestDistance = d;
+                }
+            }
+            return best;
+        }
+
+        /** Chooses k initial centers among the descriptors by k-means++
+         * seeding: every further center is drawn with a probability
+         * proportional to the squared distance to the nearest center so
+         * far. */
+        void seed(const vector<const uchar*>& descriptors, int k, int bytes,
+                RNG& rng, vector<uchar>& centers) {
+            size_t n = descriptors.size();
+            centers.resize(k * bytes);
+            vector<double> distances(n, numeric_limits<double>::max());
+
+            int chosen = rng.uniform(0, (int) n);
+            for (int c = 0; c < k; c++) {
+                copy(descriptors[chosen], descriptors[chosen] + bytes,
+                        centers.begin() + c * bytes);
+
+                double total = 0;
+                for (size_t i = 0; i < n; i++) {
+                    double d = normHamming(descriptors[i], &centers[c * bytes], bytes);
+                    distances[i] = min(distances[i], d * d);
+                    total += distances[i];
+                }
+                if (total == 0) {
+                    // All descriptors coincide with a center; repeat it.
+                    continue;
+                }
+                double r = rng.uniform(0.0, total);
+                chosen = n - 1;
+                for (size_t i = 0; i < n; i++) {
+                    r -= distances[i];
+                    if (r < 0) {
+                        chosen = i;
+                        break;
+                    }
+                }
+            }
+        }
+
+    }
+
+    VocabularyTree::VocabularyTree(int branching, int depth, int iterations,
+            int maxSamples) :
+    /*       */ branching_(branching), depth_(depth), iterations_(iterations),
+    /*       */ maxSamples_(maxSamples), bytes_(0) {
+        CV_Assert(branching >= 2 && depth >= 1 && maxSamples >= 1);
+    }
+
+    void VocabularyTree::build(const vector<Mat>& documents) {
+        nodes_.clear();
+        centers_.clear();
+        idf_.clear();
+        bytes_ = 0;
+
+        size_t total = 0;
+        for (size_t i = 0; i < documents.size(); i++) {
+            const Mat& d = documents[i];
+            if (d.empty()) {
+                continue;
+            }
+            CV_Assert(d.type() == CV_8U);
+            CV_Assert(bytes_ == 0 || bytes_ == d.cols);
+            bytes_ = d.cols;
+            total += d.rows;
+        }
+        if (total == 0) {
+            return;
+        }
+
+        // Take evenly spaced samples if there are too many descriptors.
+        vector<const uchar*> samples;
+        samples.reserve(min(total, (size_t) maxSamples_));
+        double stride = max(1.0, double(total) / maxSamples_);
+        double next = 0;
+        size_t position = 0;
+        for (size_t i = 0; i < documents.size(); i++) {
+            for (int r = 0; r < documents[i].rows; r++, position++) {
+                if (position >= next) {
+                    samples.push_back(documents[i].ptr(r));
+                    next += stride;
+                }
+            }
+        }
+
+        Node root = {-1, 0, -1};
+        nodes_.push_back(root);
+        centers_.resize(bytes_);
+        split(0, samples, 0);
+
+        // Inverse document frequencies.
+        vector<int> frequency(idf_.size(), 0);
+        int n = 0;
+        for (size_t i = 0; i < documents.size(); i++) {
+            if (documents[i].empty()) {
+                continue;
+            }
+            n++;
+            vector<char> seen(idf_.size(), 0);
+            for (int r = 0; r < documents[i].rows; r++) {
+                int w = quantize(documents[i].ptr(r));
+                if (!seen[w]) {
+                    seen[w] = 1;
+                    frequency[w]++;
+                }
+            }
+        }
+        for (size_t w = 0; w < idf_.size(); w++) {
+            idf_[w] = frequency[w] == 0 ? 0 : log(1.0 + double(n) / frequency[w]);
+        }
+    }
+
+    void VocabularyTree::split(int node, const vector<const uchar*>& descriptors,
+            int level) {
+        int k = min(branching_, (int) descriptors.size());
+        if (level == depth_ || k < 2) {
+            nodes_[node].word = idf_.size();
+            idf_.push_back(0);
+            return;
+        }
+
+        RNG rng(SEED + node);
+        vector<uchar> centers;
+        seed(descriptors, k, bytes_, rng, centers);
+
+        vector<int> assignment(descriptors.size(), -1);
+        for (int iteration = 0; iteration < iterations_; iteration++) {
+            bool changed = false;
+            for (size_t i = 0; i < descriptors.size(); i++) {
+                int c = nearest(descriptors[i], centers, k, bytes_);
+                if (c != assignment[i]) {
+                    assignment[i] = c;
+                    changed = true;
+                }
+            }
+            if (!changed) {
+                break;
+            }
+
+            // The center of a cluster is the bitwise majority of its members;
+            // empty clusters keep their center.
+            vector<int> bits(k * bytes_ * 8, 0);
+            vector<int> members(k, 0);
+            for (size_t i = 0; i < descriptors.size(); i++) {
+                int* b = &bits[assignment[i] * bytes_ * 8];
+                members[assignment[i]]++;
+                for (int j = 0; j < bytes_ * 8; j++) {
+                    b[j] += (descriptors[i][j >> 3] >> (j & 7)) & 1;
+                }
+            }
+            for (int c = 0; c < k; c++) {
+                if (members[c] == 0) {
+                    continue;
+                }
+                const int* b = &bits[c * bytes_ * 8];
+                uchar* center = &centers[c * bytes_];
+                fill(center, center + bytes_, 0);
+                for (int j = 0; j < bytes_ * 8; j++) {
+                    if (2 * b[j] > members[c]) {
+                        center[j >> 3] |= 1 << (j & 7);
+                    }
+                }
+            }
+        }
+
+        vector<vector<const uchar*> > clusters(k);
+        for (size_t i = 0; i < descriptors.size(); i++) {
+            clusters[assignment[i]].push_back(descriptors[i]);
+        }
+
+        // Children are created before descending, such that they are
+        // consecutive in nodes_.
+        int first = nodes_.size();
+        vector<int> childOf(k, -1);
+        for (int c = 0; c < k; c++) {
+            if (clusters[c].empty()) {
+                continue;
+            }
+            childOf[c] = nodes_.size();
+            Node child = {-1, 0, -1};
+            nodes_.push_back(child);
+            centers_.insert(centers_.end(), centers.begin() + c * bytes_,
+                    centers.begin() + (c + 1) * bytes_);
+        }
+        nodes_[node].firstChild = first;
+        nodes_[node].children = nodes_.size() - first;
+
+        if (nodes_[node].children == 1) {
+            // All descriptors are equal to the center; stop here.
+            nodes_[node].children = 0;
+            nodes_[node].firstChild = -1;
+            nodes_.pop_back();
+            centers_.resize(centers_.size() - bytes_);
+            nodes_[node].word = idf_.size();
+            idf_.push_back(0);
+            return;
+        }
+
+        for (int c = 0; c < k; c++) {
+            if (childOf[c] >= 0) {
+                split(childOf[c], clusters[c], level + 1);
+            }
+        }
+    }
+
+    bool VocabularyTree::empty() const {
+        return nodes_.empty();
+    }
+
+    int VocabularyTree::words() const {
+        return idf_.size();
+    }
+
+    int VocabularyTree::distance(const uchar* descriptor, int node) const {
+        return normHamming(descriptor, &centers_[node * bytes_], bytes_);
+    }
+
+    int VocabularyTree::quantize(const uchar* descriptor) const {
+        CV_Assert(!empty());
+        int node = 0;
+        while (nodes_[node].word < 0) {
+            const Node& n = nodes_[node];
+            int best = n.firstChild;
+            int bestDistance = distance(descriptor, best);
+            for (int c = n.firstChild + 1; c < n.firstChild + n.children; c++) {
+                int d = distance(descriptor, c);
+                if (d < bestDistance) {
+                    best = c;
+                    bestDistance = d;
+                }
+            }
+            node = best;
+        }
+        return nodes_[node].word;
+    }
+
+    BowVector VocabularyTree::transform(const Mat& descriptors) const {
+        BowVector bow;
+        if (descriptors.empty() || empty()) {
+            return bow;
+        }
+        CV_Assert(descriptors.type() == CV_8U && descriptors.cols == bytes_);
+
+        vector<int> words(descriptors.rows);
+        for (int r = 0; r < descriptors.rows; r++) {
+            words[r] = quantize(descriptors.ptr(r));
+        }
+        sort(words.begin(), words.end());
+
+        double norm = 0;
+        for (size_t i = 0; i < words.size();) {
+            size_t j = i;
+            while (j < words.size() && words[j] == words[i]) {
+                j++;
+            }
+            float weight = (j - i) * idf_[words[i]];
+            if (weight > 0) {
+                bow.push_back(make_pair(words[i], weight));
+                norm += weight;
+            }
+            i = j;
+        }
+        for (size_t i = 0; i < bow.size(); i++) {
+            bow[i].second /= norm;
+        }
+        return bow;
+    }
+
+    void InvertedFile::add(int document, const BowVector& bow) {
+        for (size_t i = 0; i < bow.size(); i++) {
+            int w = bow[i].first;
+            if (w >= (int) postings_.size()) {
+                postings_.resize(w + 1);
+            }
+            postings_[w].push_back(make_pair(document, bow[i].second));
+        }
+    }
+
+    void InvertedFile::score(const BowVector& query, vector<float>& scores) const {
+        for (size_t i = 0; i < query.size(); i++) {
+            int w = query[i].first;
+            if (w >= (int) postings_.size()) {
+                continue;
+            }
+            const vector<pair<int, float> >& posting = postings_[w];
+            for (size_t j = 0; j < posting.size(); j++) {
+                scores[posting[j].first] += min(query[i].second, posting[j].second);
+            }
+        }
+    }
+
+}
@@ -0,0 +1,41 @@
+#include "test.h"
+#include "tpofinder/defaults.h"
+#include "tpofinder/match.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+
+using namespace cv;
+using namespace tpofinder;
+using namespace std;
+namespace bfs = boost::filesystem;
+
+TEST(defaults, createMatcher) {
+    Ptr<DescriptorMatcher> hamming = createMatcher("hamming");
+    Ptr<DescriptorMatcher> mih = createMatcher("mih");
+    Ptr<DescriptorMatcher> lsh = createMatcher("lsh");
+    EXPECT_TRUE(dynamic_cast<HammingMatcher*> (hamming.obj) != NULL);
+    EXPECT_TRUE(dynamic_cast<MihMatcher*> (mih.obj) != NULL);
+    EXPECT_TRUE(dynamic_cast<FlannBasedMatcher*> (lsh.obj) != NULL);
+    EXPECT_TRUE(createMatcher("sift").empty());
+}
+
+TEST(defaults, modelAndSceneFeatureShareExtractor) {
+    Ptr<DescriptorMatcher> matcher = createMatcher("hamming");
+    Feature model = modelFeature(matcher);
+    Feature scene = sceneFeature(matcher);
+    EXPECT_EQ(model.extractor->get<int>("nFeatures"),
+            scene.extractor->get<int>("nFeatures"));
+    EXPECT_LT(model.detector->get<int>("nFeatures"),
+            scene.detector->get<int>("nFeatures"));
+    EXPECT_NE(model.fingerprint(), scene.fingerprint());
+}
+
+TEST(defaults, defaultModelPaths) {
+    vector<bfs::path> paths = defaultModelPaths();
+    EXPECT_EQ(paths.size(), 5);
+
+    BOOST_FOREACH(const bfs::path& p, paths) {
+        EXPECT_TRUE(bfs::exists(p / "ref.jpg"));
+    }
+}
@@ -4,6 +4,8 @@
 
 #include <boost/foreach.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 using namespace cv;
@@ -25,9 +27,9 @@ public:
     Mat image;
     Scene scene;
 
-    size_t findIndex(const vector<Detection> detections, const string& modelName) {
+    size_t findIndex(const vector<Detection>& detections, const string& modelName) {
         for (size_t i = 0; i < detections.size(); i++) {
-            if (detections[i].model.name == modelName) {
+            if (detections[i].model->name == modelName) {
                 return i;
             }
         }
@@ -103,11 +105,309 @@ TEST_F(detect, modelMatchesTrainIdxWithinBounds) {
 
         BOOST_FOREACH(DMatch& m, detections[i].matches) {
             EXPECT_GE(m.trainIdx, 0);
-            EXPECT_LT(m.trainIdx, detections[i].model.allKeypoints.size());
+            EXPECT_LT(m.trainIdx, detections[i].model->allKeypoints.size());
         }
     }
 }
 
+TEST_F(detect, addModelIncrementally) {
+    Detector d;
+    EXPECT_EQ(d.detect(scene).size(), 0);
+    d.addModel(models.models[0]);
+    d.addModel(models.models[1]);
+    EXPECT_EQ(d.segments(), 2);
+    EXPECT_EQ(d.modelbase().models.size(), 2);
+    vector<Detection> detections = d.detect(scene);
+    EXPECT_LT(findIndex(detections, "taco"), detections.size());
+}
+
+TEST_F(detect, incrementalMatchesEqualSingleSegment) {
+    Detector d;
+    d.addModel(models.models[0]);
+    d.addModel(models.models[1]);
+    vector<Detection> incremental = d.detect(scene);
+    vector<Detection> batch = detector.detect(scene);
+    ASSERT_EQ(incremental.size(), batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+        EXPECT_EQ(incremental[i].model->name, batch[i].model->name);
+        EXPECT_EQ(incremental[i].matches.size(), batch[i].matches.size());
+    }
+}
+
+TEST_F(detect, removeModel) {
+    EXPECT_TRUE(detector.removeModel("taco"));
+    EXPECT_FALSE(detector.removeModel("taco"));
+    EXPECT_EQ(detector.modelbase().models.size(), 1);
+    vector<Detection> detections = detector.detect(scene);
+    for (size_t i = 0; i < detections.size(); i++) {
+        EXPECT_NE(detections[i].model->name, "taco");
+    }
+}
+
+TEST_F(detect, compact) {
+    detector.addModel(models.models[0]);
+    EXPECT_TRUE(detector.removeModel("taco"));
+    EXPECT_EQ(detector.segments(), 2);
+    detector.compact();
+    EXPECT_EQ(detector.segments(), 1);
+    Modelbase modelbase = detector.modelbase();
+    ASSERT_EQ(modelbase.models.size(), 2);
+    EXPECT_EQ(modelbase.models[0].name, "blokus");
+    EXPECT_EQ(modelbase.models[1].name, "taco");
+}
+
+TEST_F(detect, copiesAreIndependent) {
+    Detector copy = detector;
+    copy.removeModel("taco");
+    EXPECT_EQ(copy.modelbase().models.size(), 1);
+    EXPECT_EQ(detector.modelbase().models.size(), 2);
+}
+
+TEST_F(detect, detectionsIndependentOfThreads) {
+    Detector parallel(models, Feature(), new AcceptAllFilter(), 3.0, 4);
+    vector<Detection> expected = detector.detect(scene);
+    for (int round = 0; round < 5; round++) {
+        vector<Detection> actual = parallel.detect(scene);
+        ASSERT_EQ(actual.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            EXPECT_EQ(actual[i].model->name, expected[i].model->name);
+            EXPECT_EQ(actual[i].matches.size(), expected[i].matches.size());
+            EXPECT_EQ(actual[i].inliers.size(), expected[i].inliers.size());
+        }
+    }
+}
+
+TEST_F(detect, contextGivesSameDetections) {
+    DetectionContext context;
+    Scene described = detector.describe(image, context);
+    EXPECT_EQ(scene.keypoints.size(), described.keypoints.size());
+    vector<Detection> expected = detector.detect(scene);
+    for (int round = 0; round < 3; round++) {
+        vector<Detection> actual = detector.detect(described, context);
+        ASSERT_EQ(actual.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            EXPECT_EQ(actual[i].model->name, expected[i].model->name);
+            EXPECT_EQ(actual[i].inliers, expected[i].inliers);
+        }
+    }
+}
+
+TEST_F(detect, batchGivesSameDetections) {
+    Scene other = detector.describe(
+            imread(PROJECT_BINARY_DIR + "/data/test/scene-blokus-taco-2.png"));
+    Scene blank = detector.describe(Mat(100, 100, CV_8UC3, Scalar(0)));
+    vector<const Scene*> scenes;
+    scenes.push_back(&scene);
+    scenes.push_back(&blank);
+    scenes.push_back(&other);
+    scenes.push_back(&scene);
+
+    DetectionContext context;
+    vector<vector<Detection> > batch = detector.detect(scenes, context);
+    ASSERT_EQ(scenes.size(), batch.size());
+    EXPECT_TRUE(batch[1].empty());
+    for (size_t s = 0; s < scenes.size(); s++) {
+        vector<Detection> expected = detector.detect(*scenes[s]);
+        ASSERT_EQ(expected.size(), batch[s].size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            EXPECT_EQ(expected[i].model->name, batch[s][i].model->name);
+            EXPECT_EQ(expected[i].matches.size(), batch[s][i].matches.size());
+            EXPECT_EQ(expected[i].inliers, batch[s][i].inliers);
+        }
+    }
+}
+
+TEST_F(detect, statsCountStages) {
+    DetectionContext context;
+    size_t calls = detector.profile().detect.count();
+    Scene described = detector.describe(image, context);
+    vector<Detection> detections = detector.detect(described, context);
+
+    const DetectionStats& stats = context.stats();
+    EXPECT_EQ(described.keypoints.size(), stats.keypoints);
+    EXPECT_GT(stats.keypointTime, 0);
+    EXPECT_GT(stats.matches, 0u);
+    EXPECT_GE(stats.candidates, detections.size());
+    EXPECT_EQ(detections.size(), stats.detections);
+    EXPECT_GE(stats.iterations, stats.candidates);
+    // The fixture verifies on a single thread, so the stages add up to at
+    // most the time of detection.
+    EXPECT_GE(stats.detectTime,
+            stats.matchTime + stats.verifyTime + stats.filterTime);
+
+    EXPECT_EQ(calls + 1, detector.profile().detect.count());
+    EXPECT_GE(detector.profile().verify.count(), stats.candidates);
+
+    // Detecting again keeps the counters of the description.
+    detector.detect(described, context);
+    EXPECT_EQ(described.keypoints.size(), context.stats().keypoints);
+    EXPECT_EQ(detections.size(), context.stats().detections);
+}
+
+TEST_F(detect, concurrentDetectionWithSharedDetector) {
+    const Detector shared(models, Feature(), new AcceptAllFilter(), 3.0, 2,
+            MatchConfig(0.8f, true));
+    vector<Detection> expected = shared.detect(scene);
+    const int n = 4;
+    vector<vector<size_t> > inliers(n);
+    vector<std::thread> threads;
+    for (int t = 0; t < n; t++) {
+        threads.push_back(std::thread([&, t]() {
+            DetectionContext context;
+            for (int round = 0; round < 5; round++) {
+                Scene s = shared.describe(image, context);
+                vector<Detection> detections = shared.detect(s, context);
+                BOOST_FOREACH(const Detection& d, detections) {
+                    inliers[t].push_back(d.inliers.size());
+                }
+            }
+        }));
+    }
+    BOOST_FOREACH(std::thread& t, threads) {
+        t.join();
+    }
+    for (int t = 0; t < n; t++) {
+        ASSERT_EQ(5 * expected.size(), inliers[t].size());
+        for (size_t i = 0; i < inliers[t].size(); i++) {
+            EXPECT_EQ(expected[i % expected.size()].inliers.size(), inliers[t][i]);
+        }
+    }
+}
+
+TEST_F(detect, scaleDetectionsToOriginalImage) {
+    vector<Detection> detections = detector.detect(scene);
+    ASSERT_GE(detections.size(), 1);
+    Mat h = detections[0].homography.clone();
+    scaleDetections(detections, 4);
+
+    vector<Point2f> model(1, Point2f(10, 20)), reduced, original;
+    perspectiveTransform(model, reduced, h);
+    perspectiveTransform(model, original, detections[0].homography);
+    EXPECT_NEAR(4 * reduced[0].x, original[0].x, 1e-3);
+    EXPECT_NEAR(4 * reduced[0].y, original[0].y, 1e-3);
+}
+
+TEST_F(detect, detectionsAreMoveOnly) {
+    EXPECT_FALSE(std::is_copy_constructible<Detection>::value);
+    EXPECT_TRUE(std::is_move_constructible<Detection>::value);
+}
+
+TEST_F(detect, detectionsShareModels) {
+    vector<Detection> first = detector.detect(scene);
+    vector<Detection> second = detector.detect(scene);
+    ASSERT_GE(first.size(), 1);
+    ASSERT_EQ(first.size(), second.size());
+    EXPECT_EQ(first[0].model.get(), second[0].model.get());
+
+    // Models outlive their removal from the detector.
+    string name = first[0].model->name;
+    detector.removeModel(name);
+    detector.compact();
+    EXPECT_EQ(first[0].model->name, name);
+}
+
+TEST_F(detect, defaultMatchConfigKeepsNearestNeighbours) {
+    Detector explicitDefaults(models, Feature(), new AcceptAllFilter(), 3.0, 1,
+            MatchConfig(1.0f, false, 4));
+    vector<Detection> expected = detector.detect(scene);
+    vector<Detection> actual = explicitDefaults.detect(scene);
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        EXPECT_EQ(actual[i].model->name, expected[i].model->name);
+        EXPECT_EQ(actual[i].matches.size(), expected[i].matches.size());
+    }
+}
+
+TEST_F(detect, ratioTestRemovesAmbiguousMatches) {
+    Detector ratio(models, Feature(), new AcceptAllFilter(), 3.0, 1,
+            MatchConfig(0.8f));
+    vector<Detection> all = detector.detect(scene);
+    vector<Detection> unambiguous = ratio.detect(scene);
+
+    size_t allMatches = 0;
+    BOOST_FOREACH(const Detection& d, all) {
+        allMatches += d.matches.size();
+    }
+    size_t unambiguousMatches = 0;
+    BOOST_FOREACH(const Detection& d, unambiguous) {
+        unambiguousMatches += d.matches.size();
+    }
+    EXPECT_LT(unambiguousMatches, allMatches);
+    EXPECT_LT(findIndex(unambiguous, "taco"), unambiguous.size());
+}
+
+TEST_F(detect, crossCheckKeepsMutualNearestNeighbours) {
+    Detector checked(models, Feature(), new AcceptAllFilter(), 3.0, 1,
+            MatchConfig(1.0f, true));
+    vector<Detection> detections = checked.detect(scene);
+    EXPECT_LT(findIndex(detections, "taco"), detections.size());
+
+    BFMatcher matcher(NORM_HAMMING);
+    matcher.add(vector<Mat>(1, scene.descriptors));
+
+    BOOST_FOREACH(const Detection& d, detections) {
+
+        BOOST_FOREACH(const DMatch& m, d.matches) {
+            vector<DMatch> reverse;
+            matcher.match(d.model->allDescriptors.row(m.trainIdx), reverse);
+            ASSERT_EQ(reverse.size(), 1);
+            EXPECT_EQ(reverse[0].trainIdx, m.queryIdx);
+        }
+    }
+}
+
+TEST_F(detect, minSupportRejectsWeakModels) {
+    Detector strict(models, Feature(), new AcceptAllFilter(), 3.0, 1,
+            MatchConfig(1.0f, false, scene.descriptors.rows + 1));
+    EXPECT_EQ(strict.detect(scene).size(), 0);
+}
+
+TEST_F(detect, shortlistFindsModelInTrainingImage) {
+    Modelbase all;
+    all.add(PROJECT_BINARY_DIR + "/data/adapter");
+    all.add(PROJECT_BINARY_DIR + "/data/blokus");
+    all.add(PROJECT_BINARY_DIR + "/data/stockholm");
+    all.add(PROJECT_BINARY_DIR + "/data/taco");
+    all.add(PROJECT_BINARY_DIR + "/data/tea");
+    Detector shortlisted(all, Feature(), new AcceptAllFilter(), 3.0, 1,
+            MatchConfig(1.0f, false, 4, 1));
+
+    Scene trainingView = shortlisted.describe(
+            imread(PROJECT_BINARY_DIR + "/data/taco/ref.jpg"));
+    vector<Detection> detections = shortlisted.detect(trainingView);
+    ASSERT_EQ(detections.size(), 1);
+    EXPECT_EQ(detections[0].model->name, "taco");
+}
+
+TEST_F(detect, shortlistCoveringAllModelsChangesNothing) {
+    Detector shortlisted(models, Feature(), new AcceptAllFilter(), 3.0, 1,
+            MatchConfig(1.0f, false, 4, 2));
+    vector<Detection> expected = detector.detect(scene);
+    vector<Detection> actual = shortlisted.detect(scene);
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        EXPECT_EQ(actual[i].model->name, expected[i].model->name);
+        EXPECT_EQ(actual[i].matches.size(), expected[i].matches.size());
+    }
+}
+
+TEST_F(detect, shortlistWithIncrementalModels) {
+    Detector d(Modelbase(), Feature(), new AcceptAllFilter(), 3.0, 1,
+            MatchConfig(1.0f, false, 4, 1));
+    d.addModel(models.models[0]);
+    d.addModel(models.models[1]);
+    EXPECT_EQ(d.segments(), 2);
+
+    Scene trainingView = d.describe(
+            imread(PROJECT_BINARY_DIR + "/data/taco/ref.jpg"));
+    vector<Detection> detections = d.detect(trainingView);
+    EXPECT_LT(findIndex(detections, "taco"), detections.size());
+
+    d.compact();
+    detections = d.detect(trainingView);
+    EXPECT_LT(findIndex(detections, "taco"), detections.size());
+}
+
 TEST_F(detect, eigenvalueFilterIdentity) {
     Detection d;
     d.homography = Mat::eye(3, 3, CV_64FC1);
@@ -0,0 +1,149 @@
+#include "test.h"
+#include "tpofinder/estimate.h"
+
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+using namespace tpofinder;
+
+class estimate : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        homography = (Mat_<double>(3, 3) <<
+                0.9, 0.1, 20,
+                -0.05, 1.1, -10,
+                0.0001, 0.0002, 1);
+
+        // The pairs are ordered as matches sorted by distance would be: most
+        // of the inliers come first, but outliers are mixed in throughout.
+        RNG rng(42);
+        int n = 300;
+        for (int i = 0; i < n; i++) {
+            Point2f p(rng.uniform(0.0, 640.0), rng.uniform(0.0, 480.0));
+            bool inlier = rng.uniform(0.0, 1.0) < (i < n / 2 ? 0.8 : 0.2);
+            Point2f q;
+            if (inlier) {
+                q = project(p);
+                q.x += rng.uniform(-0.5, 0.5);
+                q.y += rng.uniform(-0.5, 0.5);
+                trueInliers.push_back(i);
+            } else {
+                q = Point2f(rng.uniform(0.0, 640.0), rng.uniform(0.0, 480.0));
+            }
+            src.push_back(p);
+            dst.push_back(q);
+        }
+    }
+
+    Point2f project(const Point2f& p) const {
+        const double* h = homography.ptr<double>();
+        double w = h[6] * p.x + h[7] * p.y + h[8];
+        return Point2f((h[0] * p.x + h[1] * p.y + h[2]) / w,
+                (h[3] * p.x + h[4] * p.y + h[5]) / w);
+    }
+
+    Mat homography;
+    vector<Point2f> src;
+    vector<Point2f> dst;
+    vector<int> trueInliers;
+
+};
+
+TEST_F(estimate, recoversHomography) {
+    HomographyEstimate e = ProsacEstimator(3.0).estimate(src, dst);
+    ASSERT_FALSE(e.homography.empty());
+
+    vector<Point2f> corners;
+    corners.push_back(Point2f(0, 0));
+    corners.push_back(Point2f(640, 0));
+    corners.push_back(Point2f(640, 480));
+    corners.push_back(Point2f(0, 480));
+    vector<Point2f> expected, actual;
+    perspectiveTransform(corners, expected, homography);
+    perspectiveTransform(corners, actual, e.homography);
+    for (size_t i = 0; i < corners.size(); i++) {
+        EXPECT_LT(norm(expected[i] - actual[i]), 2.0);
+    }
+}
+
+TEST_F(estimate, findsInliers) {
+    HomographyEstimate e = ProsacEstimator(3.0).estimate(src, dst);
+
+    vector<int> found;
+    std::set_intersection(e.inliers.begin(), e.inliers.end(),
+            trueInliers.begin(), trueInliers.end(), back_inserter(found));
+    EXPECT_EQ(trueInliers.size(), found.size());
+    // Outliers are only consistent with the homography by chance.
+    EXPECT_LE(e.inliers.size() - found.size(), 5u);
+}
+
+TEST_F(estimate, inliersAreSortedAndUnique) {
+    HomographyEstimate e = ProsacEstimator(3.0).estimate(src, dst);
+    for (size_t i = 1; i < e.inliers.size(); i++) {
+        EXPECT_LT(e.inliers[i - 1], e.inliers[i]);
+    }
+}
+
+TEST_F(estimate, isDeterministic) {
+    ProsacEstimator estimator(3.0);
+    HomographyEstimate e1 = estimator.estimate(src, dst);
+    HomographyEstimate e2 = estimator.estimate(src, dst);
+    EXPECT_EQ(e1.iterations, e2.iterations);
+    EXPECT_EQ(e1.inliers, e2.inliers);
+    EXPECT_EQ(0, norm(e1.homography - e2.homography));
+}
+
+TEST_F(estimate, terminatesEarly) {
+    ProsacEstimator estimator(3.0, 0.995, 2000);
+    HomographyEstimate e = estimator.estimate(src, dst);
+    EXPECT_GT(e.iterations, 0);
+    EXPECT_LT(e.iterations, estimator.maxIterations);
+    EXPECT_LE(e.rejected, e.iterations);
+}
+
+TEST_F(estimate, rejectsBadHypothesesEarly) {
+    // With only few inliers, most hypotheses are bad and should be abandoned
+    // by the sequential test.
+    vector<Point2f> noisy(dst);
+    RNG rng(7);
+    for (size_t i = 0; i < noisy.size(); i++) {
+        if (i % 3 != 0) {
+            noisy[i] = Point2f(rng.uniform(0.0, 640.0), rng.uniform(0.0, 480.0));
+        }
+    }
+    HomographyEstimate e = ProsacEstimator(3.0).estimate(src, noisy);
+    EXPECT_GT(e.rejected, 0);
+}
+
+TEST_F(estimate, tooFewPoints) {
+    vector<Point2f> s(src.begin(), src.begin() + 3);
+    vector<Point2f> d(dst.begin(), dst.begin() + 3);
+    HomographyEstimate e = ProsacEstimator().estimate(s, d);
+    EXPECT_TRUE(e.homography.empty());
+    EXPECT_TRUE(e.inliers.empty());
+    EXPECT_EQ(0, e.iterations);
+}
+
+TEST_F(estimate, exactlyFourPoints) {
+    vector<Point2f> s, d;
+    for (size_t i = 0; i < trueInliers.size() && s.size() < 4; i++) {
+        s.push_back(src[trueInliers[i]]);
+        d.push_back(dst[trueInliers[i]]);
+    }
+    HomographyEstimate e = ProsacEstimator().estimate(s, d);
+    ASSERT_FALSE(e.homography.empty());
+    EXPECT_EQ(4u, e.inliers.size());
+}
+
+TEST_F(estimate, degenerateSamples) {
+    // All points on a line do not determine a homography.
+    vector<Point2f> s, d;
+    for (int i = 0; i < 20; i++) {
+        s.push_back(Point2f(i, 2 * i));
+        d.push_back(Point2f(i, 2 * i));
+    }
+    HomographyEstimate e = ProsacEstimator().estimate(s, d);
+    EXPECT_TRUE(e.homography.empty());
+}
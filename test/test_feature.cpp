@@ -71,6 +71,17 @@ TEST_F(feature, computeCustom) {
     testFeature(feature, 300);
 }
 
+TEST_F(feature, copyHasSameParameters) {
+    Feature feature(new OrbFeatureDetector(321), new OrbDescriptorExtractor(321),
+            new BFMatcher(NORM_HAMMING));
+    ASSERT_TRUE(feature.copyable());
+    Feature copy = feature.copy();
+    EXPECT_NE(feature.detector.obj, copy.detector.obj);
+    EXPECT_NE(feature.extractor.obj, copy.extractor.obj);
+    EXPECT_EQ(feature.matcher.obj, copy.matcher.obj);
+    EXPECT_EQ(feature.fingerprint(), copy.fingerprint());
+}
+
 TEST_F(feature, showSIFT) {
     Feature feature("SURF", "SURF", "BruteForce");
     vector<KeyPoint> kpts;
@@ -0,0 +1,294 @@
+#include "test.h"
+#include "tpofinder/configure.h"
+#include "tpofinder/detect.h"
+#include "tpofinder/match.h"
+
+#include <boost/foreach.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <vector>
+
+using namespace cv;
+using namespace tpofinder;
+
+class match : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        models.add(PROJECT_BINARY_DIR + "/data/taco");
+        models.add(PROJECT_BINARY_DIR + "/data/blokus");
+
+        BOOST_FOREACH(const PlanarModel& m, models.models) {
+            train.push_back(m.allDescriptors);
+        }
+        // Duplicate descriptors provoke ties across images.
+        train.push_back(models.models[0].allDescriptors.rowRange(0, 50));
+
+        Detector detector(models);
+        scene = detector.describe(
+                imread(PROJECT_BINARY_DIR + "/data/test/scene-blokus-taco-1.png"));
+
+        kernels.push_back(HammingMatcher::SCALAR);
+        kernels.push_back(HammingMatcher::AVX2);
+        kernels.push_back(HammingMatcher::AVX512);
+    }
+
+    void expectEqual(const vector<vector<DMatch> >& expected,
+            const vector<vector<DMatch> >& actual) {
+        ASSERT_EQ(expected.size(), actual.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            ASSERT_EQ(expected[i].size(), actual[i].size());
+            for (size_t j = 0; j < expected[i].size(); j++) {
+                EXPECT_EQ(expected[i][j].queryIdx, actual[i][j].queryIdx);
+                EXPECT_EQ(expected[i][j].trainIdx, actual[i][j].trainIdx);
+                EXPECT_EQ(expected[i][j].imgIdx, actual[i][j].imgIdx);
+                EXPECT_EQ(expected[i][j].distance, actual[i][j].distance);
+            }
+        }
+    }
+
+    Modelbase models;
+    vector<Mat> train;
+    Scene scene;
+    vector<HammingMatcher::Kernel> kernels;
+
+};
+
+TEST_F(match, autoKernelIsSupported) {
+    HammingMatcher matcher;
+    EXPECT_NE(HammingMatcher::AUTO, matcher.kernel());
+    EXPECT_TRUE(HammingMatcher::supports(matcher.kernel()));
+    EXPECT_TRUE(HammingMatcher::supports(HammingMatcher::SCALAR));
+}
+
+TEST_F(match, matchEqualsBruteForce) {
+    BFMatcher reference(NORM_HAMMING);
+    reference.add(train);
+    vector<DMatch> expected;
+    reference.match(scene.descriptors, expected);
+
+    BOOST_FOREACH(HammingMatcher::Kernel kernel, kernels) {
+        if (!HammingMatcher::supports(kernel)) {
+            continue;
+        }
+        HammingMatcher matcher(kernel);
+        matcher.add(train);
+        vector<DMatch> actual;
+        matcher.match(scene.descriptors, actual);
+        expectEqual(vector<vector<DMatch> >(1, expected),
+                vector<vector<DMatch> >(1, actual));
+    }
+}
+
+TEST_F(match, knnMatchEqualsBruteForce) {
+    BFMatcher reference(NORM_HAMMING);
+    reference.add(train);
+    vector<vector<DMatch> > expected;
+    reference.knnMatch(scene.descriptors, expected, 3);
+
+    BOOST_FOREACH(HammingMatcher::Kernel kernel, kernels) {
+        if (!HammingMatcher::supports(kernel)) {
+            continue;
+        }
+        HammingMatcher matcher(kernel);
+        matcher.add(train);
+        vector<vector<DMatch> > actual;
+        matcher.knnMatch(scene.descriptors, actual, 3);
+        expectEqual(expected, actual);
+    }
+}
+
+TEST_F(match, knnMatchWithMask) {
+    vector<Mat> masks;
+    for (size_t i = 0; i < train.size(); i++) {
+        Mat mask(scene.descriptors.rows, train[i].rows, CV_8U, Scalar(1));
+        mask.colRange(0, train[i].rows / 2) = Scalar(0);
+        masks.push_back(mask);
+    }
+
+    BFMatcher reference(NORM_HAMMING);
+    reference.add(train);
+    vector<vector<DMatch> > expected;
+    reference.knnMatch(scene.descriptors, expected, 2, masks);
+
+    HammingMatcher matcher;
+    matcher.add(train);
+    vector<vector<DMatch> > actual;
+    matcher.knnMatch(scene.descriptors, actual, 2, masks);
+    expectEqual(expected, actual);
+}
+
+TEST_F(match, radiusMatchFindsSameNeighbours) {
+    BFMatcher reference(NORM_HAMMING);
+    reference.add(train);
+    vector<vector<DMatch> > expected;
+    reference.radiusMatch(scene.descriptors, expected, 40);
+
+    HammingMatcher matcher;
+    matcher.add(train);
+    vector<vector<DMatch> > actual;
+    matcher.radiusMatch(scene.descriptors, actual, 40);
+
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ(expected[i].size(), actual[i].size());
+        for (size_t j = 0; j < expected[i].size(); j++) {
+            EXPECT_EQ(expected[i][j].distance, actual[i][j].distance);
+        }
+    }
+}
+
+TEST_F(match, emptyTrainData) {
+    HammingMatcher matcher;
+    vector<DMatch> matches;
+    matcher.match(scene.descriptors, matches);
+    EXPECT_TRUE(matches.empty());
+}
+
+TEST_F(match, cloneKeepsKernel) {
+    HammingMatcher matcher(HammingMatcher::SCALAR);
+    matcher.add(train);
+    Ptr<DescriptorMatcher> empty = matcher.clone(true);
+    Ptr<DescriptorMatcher> full = matcher.clone();
+    EXPECT_TRUE(empty->getTrainDescriptors().empty());
+    EXPECT_EQ(train.size(), full->getTrainDescriptors().size());
+    EXPECT_EQ(HammingMatcher::SCALAR, empty.ptr<HammingMatcher>()->kernel());
+}
+
+TEST_F(match, detectorWithHammingMatcher) {
+    Feature feature("ORB", "ORB", "BruteForce-Hamming");
+    Feature fast(feature.detector, feature.extractor, new HammingMatcher());
+    vector<Detection> expected = Detector(models, feature).detect(scene);
+    vector<Detection> actual = Detector(models, fast).detect(scene);
+
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        EXPECT_EQ(expected[i].model->name, actual[i].model->name);
+        EXPECT_EQ(expected[i].inliers, actual[i].inliers);
+    }
+}
+
+TEST_F(match, mihKnnMatchEqualsBruteForce) {
+    BFMatcher reference(NORM_HAMMING);
+    reference.add(train);
+    vector<vector<DMatch> > expected;
+    reference.knnMatch(scene.descriptors, expected, 3);
+
+    int bits[] = {0, 8, 13, 16};
+    BOOST_FOREACH(int b, bits) {
+        MihMatcher matcher(b);
+        matcher.add(train);
+        vector<vector<DMatch> > actual;
+        matcher.knnMatch(scene.descriptors, actual, 3);
+        expectEqual(expected, actual);
+    }
+}
+
+TEST_F(match, mihKnnMatchWithMask) {
+    vector<Mat> masks;
+    for (size_t i = 0; i < train.size(); i++) {
+        Mat mask(scene.descriptors.rows, train[i].rows, CV_8U, Scalar(1));
+        mask.colRange(0, train[i].rows / 2) = Scalar(0);
+        masks.push_back(mask);
+    }
+
+    BFMatcher reference(NORM_HAMMING);
+    reference.add(train);
+    vector<vector<DMatch> > expected;
+    reference.knnMatch(scene.descriptors, expected, 2, masks);
+
+    MihMatcher matcher;
+    matcher.add(train);
+    vector<vector<DMatch> > actual;
+    matcher.knnMatch(scene.descriptors, actual, 2, masks);
+    expectEqual(expected, actual);
+}
+
+TEST_F(match, mihRadiusMatchEqualsLinearScan) {
+    HammingMatcher reference;
+    reference.add(train);
+    MihMatcher matcher;
+    matcher.add(train);
+
+    float radii[] = {0, 1, 20.5f, 40, 300};
+    BOOST_FOREACH(float radius, radii) {
+        vector<vector<DMatch> > expected;
+        reference.radiusMatch(scene.descriptors, expected, radius);
+        vector<vector<DMatch> > actual;
+        matcher.radiusMatch(scene.descriptors, actual, radius);
+        expectEqual(expected, actual);
+    }
+}
+
+TEST_F(match, mihFindsNearNeighboursByProbing) {
+    // Many random descriptors and queries close to some of them, such that
+    // the search stops before scanning.
+    RNG rng(0x5eed);
+    Mat many(20000, 32, CV_8U);
+    rng.fill(many, RNG::UNIFORM, 0, 256);
+    Mat queries(200, 32, CV_8U);
+    for (int q = 0; q < queries.rows; q++) {
+        many.row(rng.uniform(0, many.rows)).copyTo(queries.row(q));
+        for (int f = 0; f < q % 25; f++) {
+            int bit = rng.uniform(0, 256);
+            queries.at<uchar>(q, bit / 8) ^= 1 << (bit % 8);
+        }
+    }
+
+    HammingMatcher reference;
+    reference.add(vector<Mat>(1, many));
+    vector<vector<DMatch> > expected;
+    reference.knnMatch(queries, expected, 1);
+
+    MihMatcher matcher;
+    matcher.add(vector<Mat>(1, many));
+    vector<vector<DMatch> > actual;
+    matcher.knnMatch(queries, actual, 1);
+    expectEqual(expected, actual);
+}
+
+TEST_F(match, mihRetrainsAfterAdd) {
+    MihMatcher matcher;
+    matcher.add(vector<Mat>(1, train[0]));
+    vector<vector<DMatch> > actual;
+    matcher.knnMatch(scene.descriptors, actual, 2);
+    matcher.add(vector<Mat>(train.begin() + 1, train.end()));
+    matcher.knnMatch(scene.descriptors, actual, 2);
+
+    BFMatcher reference(NORM_HAMMING);
+    reference.add(train);
+    vector<vector<DMatch> > expected;
+    reference.knnMatch(scene.descriptors, expected, 2);
+    expectEqual(expected, actual);
+
+    matcher.clear();
+    matcher.knnMatch(scene.descriptors, actual, 2);
+    EXPECT_TRUE(actual.empty());
+}
+
+TEST_F(match, mihClone) {
+    MihMatcher matcher(8);
+    matcher.add(train);
+    Ptr<DescriptorMatcher> empty = matcher.clone(true);
+    Ptr<DescriptorMatcher> full = matcher.clone();
+    EXPECT_TRUE(empty->getTrainDescriptors().empty());
+    ASSERT_EQ(train.size(), full->getTrainDescriptors().size());
+
+    vector<vector<DMatch> > expected;
+    matcher.knnMatch(scene.descriptors, expected, 2);
+    vector<vector<DMatch> > actual;
+    full->knnMatch(scene.descriptors, actual, 2);
+    expectEqual(expected, actual);
+}
+
+TEST_F(match, detectorWithMihMatcher) {
+    Feature feature("ORB", "ORB", "BruteForce-Hamming");
+    Feature fast(feature.detector, feature.extractor, new MihMatcher());
+    vector<Detection> expected = Detector(models, feature).detect(scene);
+    vector<Detection> actual = Detector(models, fast).detect(scene);
+
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        EXPECT_EQ(expected[i].model->name, actual[i].model->name);
+        EXPECT_EQ(expected[i].inliers, actual[i].inliers);
+    }
+}
@@ -108,6 +108,10 @@ struct model_homography_app : public ::testing::Test {
 
 };
 
+struct model_parallel : public ::testing::Test {
+
+};
+
 void viewModel(const string& test, const PlanarModel& model) {
     for (size_t i = 0; i < model.views.size(); i++) {
         Mat out = blend(model.views[0].image,
@@ -234,6 +238,67 @@ TEST_F(model_blokus, consistentFeatureNumber) {
     EXPECT_EQ(blokusModel.allDescriptors.rows, t);
 }
 
+TEST_F(model_blokus, viewOffsets) {
+    ASSERT_EQ(blokusModel.viewOffsets.size(), blokusModel.views.size() + 1);
+    EXPECT_EQ(blokusModel.viewOffsets[0], 0);
+    for (size_t i = 0; i < blokusModel.views.size(); i++) {
+        EXPECT_EQ(blokusModel.viewOffsets[i + 1] - blokusModel.viewOffsets[i],
+                blokusModel.views[i].keypoints.size());
+        for (int j = blokusModel.viewOffsets[i]; j < blokusModel.viewOffsets[i + 1]; j++) {
+            ASSERT_EQ(blokusModel.viewOf(j), i);
+        }
+    }
+    EXPECT_EQ(blokusModel.viewOffsets.back(), blokusModel.allKeypoints.size());
+}
+
+TEST_F(model_blokus, descriptorsContiguousAndAligned) {
+    EXPECT_TRUE(blokusModel.allDescriptors.isContinuous());
+    EXPECT_EQ((size_t) blokusModel.allDescriptors.data % 64, 0);
+    for (size_t i = 0; i < blokusModel.views.size(); i++) {
+        // Views share the storage of the model.
+        EXPECT_EQ(blokusModel.views[i].descriptors.data,
+                blokusModel.allDescriptors.ptr(blokusModel.viewOffsets[i]));
+    }
+}
+
+TEST_F(model_blokus, weightsDefaultToOne) {
+    ASSERT_EQ(blokusModel.allWeights.size(), blokusModel.allKeypoints.size());
+
+    BOOST_FOREACH(int w, blokusModel.allWeights) {
+        EXPECT_EQ(w, 1);
+    }
+}
+
+TEST_F(model_blokus, compactPreservesWeight) {
+    size_t n = blokusModel.allKeypoints.size();
+    blokusModel.compact(3.0f, 40);
+    EXPECT_LT(blokusModel.allKeypoints.size(), n);
+    EXPECT_EQ(blokusModel.allDescriptors.rows, blokusModel.allKeypoints.size());
+    EXPECT_EQ(blokusModel.allWeights.size(), blokusModel.allKeypoints.size());
+
+    int total = 0;
+
+    BOOST_FOREACH(int w, blokusModel.allWeights) {
+        total += w;
+    }
+    EXPECT_EQ(total, n);
+
+    size_t s = 0;
+    for (size_t i = 0; i < blokusModel.views.size(); i++) {
+        PlanarView& v = blokusModel.views[i];
+        EXPECT_EQ(v.keypoints.size(), v.descriptors.rows);
+        EXPECT_EQ(blokusModel.viewOffsets[i], s);
+        s += v.keypoints.size();
+    }
+    EXPECT_EQ(s, blokusModel.allKeypoints.size());
+}
+
+TEST_F(model_blokus, compactKeepsReferenceView) {
+    size_t n = blokusModel.views[0].keypoints.size();
+    blokusModel.compact();
+    EXPECT_EQ(blokusModel.views[0].keypoints.size(), n);
+}
+
 TEST_F(model_blokus, homographyLoaded) {
     Mat h = readHomography(PROJECT_BINARY_DIR + "/data/blokus/001.yml");
     EXPECT_DOUBLE_EQ(norm(blokusModel.views[1].homography - h), 0);
@@ -329,3 +394,30 @@ TEST_F(model_homography_app, alternativeHomographyMatrix) {
     }
 }
 
+
+TEST_F(model_parallel, viewOrderIndependentOfThreads) {
+    PlanarModel serial = PlanarModel::load(PROJECT_BINARY_DIR + "/data/blokus", Feature(), 1);
+    PlanarModel parallel = PlanarModel::load(PROJECT_BINARY_DIR + "/data/blokus", Feature(), 4);
+    ASSERT_EQ(serial.views.size(), parallel.views.size());
+    for (size_t i = 0; i < serial.views.size(); i++) {
+        EXPECT_DOUBLE_EQ(norm(serial.views[i].homography - parallel.views[i].homography), 0);
+        EXPECT_EQ(serial.views[i].keypoints.size(), parallel.views[i].keypoints.size());
+    }
+    EXPECT_EQ(norm(serial.allDescriptors, parallel.allDescriptors, NORM_HAMMING), 0);
+}
+
+TEST_F(model_parallel, addAllKeepsOrder) {
+    vector<boost::filesystem::path> paths;
+    paths.push_back(PROJECT_BINARY_DIR + "/data/adapter");
+    paths.push_back(PROJECT_BINARY_DIR + "/data/blokus");
+    paths.push_back(PROJECT_BINARY_DIR + "/data/stockholm");
+    paths.push_back(PROJECT_BINARY_DIR + "/data/taco");
+    paths.push_back(PROJECT_BINARY_DIR + "/data/tea");
+    Modelbase modelbase;
+    modelbase.addAll(paths, 3);
+    EXPECT_EQ(0, modelbase.findByName("adapter"));
+    EXPECT_EQ(1, modelbase.findByName("blokus"));
+    EXPECT_EQ(2, modelbase.findByName("stockholm"));
+    EXPECT_EQ(3, modelbase.findByName("taco"));
+    EXPECT_EQ(4, modelbase.findByName("tea"));
+}
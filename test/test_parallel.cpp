@@ -0,0 +1,164 @@
+#include "test.h"
+#include "tpofinder/parallel.h"
+
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace tpofinder;
+using namespace std;
+
+class parallel : public ::testing::Test {
+};
+
+TEST_F(parallel, defaultThreadsPositive) {
+    EXPECT_GE(defaultThreads(), 1);
+}
+
+TEST_F(parallel, forVisitsEachIndexOnce) {
+    vector<int> visits(1000, 0);
+    parallelFor(visits.size(), [&](size_t i) {
+        visits[i]++;
+    }, 8);
+    for (size_t i = 0; i < visits.size(); i++) {
+        EXPECT_EQ(visits[i], 1);
+    }
+}
+
+TEST_F(parallel, forNoIterations) {
+    parallelFor(0, [](size_t) {
+        FAIL();
+    });
+}
+
+TEST_F(parallel, forRethrows) {
+    EXPECT_THROW(parallelFor(100, [](size_t i) {
+        if (i == 42) {
+            throw runtime_error("42");
+        }
+    }, 4), runtime_error);
+}
+
+TEST_F(parallel, poolVisitsEachIndexOnce) {
+    ThreadPool pool(4);
+    EXPECT_EQ(pool.threads(), 4);
+    for (int round = 0; round < 10; round++) {
+        vector<int> visits(100, 0);
+        pool.parallelFor(visits.size(), [&](size_t i) {
+            visits[i]++;
+        });
+        for (size_t i = 0; i < visits.size(); i++) {
+            ASSERT_EQ(visits[i], 1);
+        }
+    }
+}
+
+TEST_F(parallel, poolConcurrentLoops) {
+    ThreadPool pool(4);
+    vector<int> a(500, 0), b(500, 0);
+    thread other([&]() {
+        pool.parallelFor(a.size(), [&](size_t i) {
+            a[i] = i;
+        });
+    });
+    pool.parallelFor(b.size(), [&](size_t i) {
+        b[i] = 2 * i;
+    });
+    other.join();
+    for (size_t i = 0; i < a.size(); i++) {
+        EXPECT_EQ(a[i], i);
+        EXPECT_EQ(b[i], 2 * i);
+    }
+}
+
+TEST_F(parallel, poolRethrows) {
+    ThreadPool pool(3);
+    EXPECT_THROW(pool.parallelFor(100, [](size_t i) {
+        if (i == 7) {
+            throw runtime_error("7");
+        }
+    }), runtime_error);
+}
+
+TEST_F(parallel, orderedQueuePopsInOrder) {
+    OrderedQueue<int> queue(4);
+    EXPECT_TRUE(queue.push(2, 20));
+    EXPECT_TRUE(queue.push(0, 0));
+    EXPECT_TRUE(queue.push(1, 10));
+    size_t number;
+    int item;
+    for (size_t i = 0; i < 3; i++) {
+        ASSERT_TRUE(queue.pop(number, item));
+        EXPECT_EQ(number, i);
+        EXPECT_EQ(item, 10 * (int) i);
+    }
+    queue.close();
+    EXPECT_FALSE(queue.pop(number, item));
+    EXPECT_FALSE(queue.push(3, 30));
+}
+
+TEST_F(parallel, orderedQueueDrainsAfterClose) {
+    OrderedQueue<int> queue(2);
+    queue.push(0, 1);
+    queue.push(1, 2);
+    queue.close();
+    size_t number;
+    int item;
+    EXPECT_TRUE(queue.pop(number, item));
+    EXPECT_TRUE(queue.pop(number, item));
+    EXPECT_EQ(item, 2);
+    EXPECT_FALSE(queue.pop(number, item));
+}
+
+TEST_F(parallel, orderedQueueCloseReleasesProducers) {
+    OrderedQueue<int> queue(1);
+    queue.push(0, 0);
+    bool pushed = true;
+    thread producer([&]() {
+        pushed = queue.push(1, 1);
+    });
+    queue.close();
+    producer.join();
+    EXPECT_FALSE(pushed);
+}
+
+TEST_F(parallel, orderedQueuePipeline) {
+    // Several workers between two bounded queues; the output keeps the order
+    // of the input although workers finish in any order.
+    const size_t n = 2000;
+    OrderedQueue<size_t> input(3), output(3);
+    thread producer([&]() {
+        for (size_t i = 0; i < n; i++) {
+            input.push(i, i);
+        }
+        input.close();
+    });
+    vector<thread> workers;
+    for (int w = 0; w < 4; w++) {
+        workers.push_back(thread([&]() {
+            size_t number, item;
+            while (input.pop(number, item)) {
+                if (item % 7 == 0) {
+                    this_thread::yield();
+                }
+                output.push(number, 3 * item);
+            }
+        }));
+    }
+    thread closer([&]() {
+        producer.join();
+        for (size_t w = 0; w < workers.size(); w++) {
+            workers[w].join();
+        }
+        output.close();
+    });
+
+    size_t number, item, count = 0;
+    while (output.pop(number, item)) {
+        ASSERT_EQ(number, count);
+        ASSERT_EQ(item, 3 * count);
+        count++;
+    }
+    closer.join();
+    EXPECT_EQ(count, n);
+}
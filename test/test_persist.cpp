@@ -0,0 +1,331 @@
+#include "test.h"
+#include "tpofinder/configure.h"
+#include "tpofinder/detect.h"
+#include "tpofinder/match.h"
+#include "tpofinder/persist.h"
+
+#include <boost/filesystem.hpp>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <opencv2/highgui/highgui.hpp>
+#include <stdexcept>
+
+using namespace cv;
+using namespace tpofinder;
+using namespace std;
+namespace bfs = boost::filesystem;
+
+/** A detector that OpenCV does not know, and thus cannot fingerprint. */
+class CustomDetector : public FeatureDetector {
+protected:
+
+    virtual void detectImpl(const Mat& image, vector<KeyPoint>& keypoints,
+            const Mat& mask) const {
+        OrbFeatureDetector().detect(image, keypoints, mask);
+    }
+
+};
+
+class persist : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        path = PROJECT_BINARY_DIR + "/data/blokus";
+        bfs::remove(modelCachePath(path));
+        model = PlanarModel::load(path, feature);
+    }
+
+    virtual void TearDown() {
+        bfs::remove(modelCachePath(path));
+    }
+
+    bfs::path path;
+    Feature feature;
+    PlanarModel model;
+
+};
+
+TEST_F(persist, noCache) {
+    PlanarModel cached;
+    EXPECT_FALSE(readModelCache(path, feature, cached));
+}
+
+TEST_F(persist, writeReadModelCache) {
+    ASSERT_TRUE(writeModelCache(path, model, feature));
+    PlanarModel cached;
+    ASSERT_TRUE(readModelCache(path, feature, cached));
+
+    EXPECT_EQ(model.name, cached.name);
+    EXPECT_EQ(model.color, cached.color);
+    ASSERT_EQ(model.views.size(), cached.views.size());
+    for (size_t i = 0; i < model.views.size(); i++) {
+        EXPECT_DOUBLE_EQ(norm(model.views[i].homography - cached.views[i].homography), 0);
+        EXPECT_EQ(model.views[i].keypoints.size(), cached.views[i].keypoints.size());
+    }
+    ASSERT_EQ(model.allKeypoints.size(), cached.allKeypoints.size());
+    for (size_t i = 0; i < model.allKeypoints.size(); i++) {
+        EXPECT_FLOAT_EQ(model.allKeypoints[i].pt.x, cached.allKeypoints[i].pt.x);
+        EXPECT_FLOAT_EQ(model.allKeypoints[i].pt.y, cached.allKeypoints[i].pt.y);
+    }
+    EXPECT_EQ(norm(model.allDescriptors, cached.allDescriptors, NORM_HAMMING), 0);
+    EXPECT_FALSE(cached.views[0].image.empty());
+    EXPECT_FALSE(cached.views[0].roi.empty());
+}
+
+TEST_F(persist, cacheStaleForOtherFeature) {
+    ASSERT_TRUE(writeModelCache(path, model, feature));
+    Feature other(new OrbFeatureDetector(100), new OrbDescriptorExtractor(100),
+            DescriptorMatcher::create("BruteForce-Hamming"));
+    PlanarModel cached;
+    EXPECT_FALSE(readModelCache(path, other, cached));
+}
+
+TEST_F(persist, noCacheForCustomFeature) {
+    Feature custom(new CustomDetector(), new OrbDescriptorExtractor(),
+            DescriptorMatcher::create("BruteForce-Hamming"));
+    EXPECT_TRUE(custom.fingerprint().empty());
+    EXPECT_FALSE(writeModelCache(path, model, custom));
+    EXPECT_FALSE(bfs::exists(modelCachePath(path)));
+
+    ASSERT_TRUE(writeModelCache(path, model, feature));
+    PlanarModel cached;
+    EXPECT_FALSE(readModelCache(path, custom, cached));
+
+    Modelbase modelbase(custom, true);
+    modelbase.add(path);
+    EXPECT_EQ(modelbase.models.size(), 1);
+}
+
+TEST_F(persist, cacheStaleForTouchedSource) {
+    ASSERT_TRUE(writeModelCache(path, model, feature));
+    bfs::path info = path / "info.yml";
+    time_t original = bfs::last_write_time(info);
+    bfs::last_write_time(info, bfs::last_write_time(modelCachePath(path)) + 10);
+    PlanarModel cached;
+    EXPECT_FALSE(readModelCache(path, feature, cached));
+    bfs::last_write_time(info, original);
+}
+
+TEST_F(persist, cacheStaleForSourceSetBack) {
+    ASSERT_TRUE(writeModelCache(path, model, feature));
+    bfs::path info = path / "info.yml";
+    time_t original = bfs::last_write_time(info);
+    bfs::last_write_time(info, original - 10);
+    PlanarModel cached;
+    EXPECT_FALSE(readModelCache(path, feature, cached));
+    bfs::last_write_time(info, original);
+}
+
+TEST_F(persist, cacheValidWhenWrittenWithSource) {
+    // A source modified within the second the cache is written in.
+    bfs::path info = path / "info.yml";
+    time_t original = bfs::last_write_time(info);
+    bfs::last_write_time(info, time(NULL));
+    ASSERT_TRUE(writeModelCache(path, model, feature));
+    bfs::last_write_time(modelCachePath(path), bfs::last_write_time(info));
+    PlanarModel cached;
+    EXPECT_TRUE(readModelCache(path, feature, cached));
+    bfs::last_write_time(info, original);
+}
+
+TEST_F(persist, corruptCacheIsIgnored) {
+    ASSERT_TRUE(writeModelCache(path, model, feature));
+    bfs::path cache = modelCachePath(path);
+    time_t written = bfs::last_write_time(cache);
+    {
+        // Keep the header, but claim a huge name.
+        fstream out(cache.string().c_str(), ios::in | ios::out | ios::binary);
+        out.seekp(8 + 4 + 4 + feature.fingerprint().size());
+        uint32_t huge = 0xffffffff;
+        out.write(reinterpret_cast<const char*> (&huge), sizeof (huge));
+    }
+    bfs::last_write_time(cache, written);
+    PlanarModel cached;
+    EXPECT_FALSE(readModelCache(path, feature, cached));
+
+    Modelbase modelbase(feature, true);
+    modelbase.add(path);
+    EXPECT_EQ(model.allKeypoints.size(), modelbase.models[0].allKeypoints.size());
+}
+
+TEST_F(persist, modelbaseWritesCache) {
+    Modelbase modelbase(feature, true);
+    modelbase.add(path);
+    EXPECT_TRUE(bfs::exists(modelCachePath(path)));
+    modelbase.add(path);
+    ASSERT_EQ(modelbase.models.size(), 2);
+    EXPECT_EQ(modelbase.models[0].allKeypoints.size(),
+            modelbase.models[1].allKeypoints.size());
+}
+
+TEST_F(persist, writeMapPackedModelbase) {
+    Modelbase modelbase(feature);
+    modelbase.add(model);
+    modelbase.add(PROJECT_BINARY_DIR + "/data/taco");
+    bfs::path p = string(tmpnam(NULL));
+    writePackedModelbase(p, modelbase, feature);
+
+    Modelbase mapped = mapPackedModelbase(p, feature);
+    ASSERT_EQ(modelbase.models.size(), mapped.models.size());
+    for (size_t i = 0; i < mapped.models.size(); i++) {
+        const PlanarModel& m = modelbase.models[i];
+        const PlanarModel& n = mapped.models[i];
+        EXPECT_EQ(m.name, n.name);
+        EXPECT_EQ(m.color, n.color);
+        ASSERT_EQ(m.views.size(), n.views.size());
+        ASSERT_EQ(m.allKeypoints.size(), n.allKeypoints.size());
+        EXPECT_EQ(norm(m.allDescriptors, n.allDescriptors, NORM_HAMMING), 0);
+        EXPECT_EQ(norm(m.views[0].roi, n.views[0].roi, NORM_L1), 0);
+        for (size_t j = 0; j < m.views.size(); j++) {
+            EXPECT_EQ(norm(m.views[j].descriptors, n.views[j].descriptors, NORM_HAMMING), 0);
+        }
+        EXPECT_EQ((size_t) n.allDescriptors.data % 64, 0);
+    }
+
+    // The mapping stays valid as long as any model refers to it.
+    PlanarModel survivor = mapped.models[1];
+    mapped = Modelbase();
+    EXPECT_EQ(survivor.allDescriptors.rows, (int) survivor.allKeypoints.size());
+    EXPECT_EQ(norm(survivor.allDescriptors, modelbase.models[1].allDescriptors, NORM_HAMMING), 0);
+    bfs::remove(p);
+}
+
+TEST_F(persist, mapPackedModelbaseRejectsOtherFeature) {
+    Modelbase modelbase(feature);
+    modelbase.add(model);
+    bfs::path p = string(tmpnam(NULL));
+    writePackedModelbase(p, modelbase, feature);
+    Feature other(new OrbFeatureDetector(100), new OrbDescriptorExtractor(100),
+            DescriptorMatcher::create("BruteForce-Hamming"));
+    EXPECT_THROW(mapPackedModelbase(p, other), std::runtime_error);
+    bfs::remove(p);
+}
+
+TEST_F(persist, rewritePackKeepsMapping) {
+    Modelbase modelbase(feature);
+    modelbase.add(model);
+    bfs::path p = string(tmpnam(NULL));
+    writePackedModelbase(p, modelbase, feature);
+    Modelbase mapped = mapPackedModelbase(p, feature);
+
+    writePackedModelbase(p, Modelbase(feature), feature);
+    EXPECT_EQ(norm(model.allDescriptors, mapped.models[0].allDescriptors, NORM_HAMMING), 0);
+    EXPECT_TRUE(mapPackedModelbase(p, feature).models.empty());
+    bfs::remove(p);
+}
+
+TEST_F(persist, mapPackedModelbaseRejectsCorruptCounts) {
+    Modelbase modelbase(feature);
+    modelbase.add(model);
+    bfs::path p = string(tmpnam(NULL));
+    writePackedModelbase(p, modelbase, feature);
+
+    // Offsets of the view count and the keypoint count of the first view.
+    size_t views = 8 + 4 + 4 + feature.fingerprint().size() + 4
+            + 4 + model.name.size() + 4 * sizeof (double);
+    size_t keypoints = views + 4 + 3 * 4 + 9 * sizeof (double);
+    uint32_t counts[] = {0, 0xffffffff};
+    size_t offsets[] = {views, keypoints};
+    for (int i = 0; i < 2; i++) {
+        writePackedModelbase(p, modelbase, feature);
+        {
+            fstream out(p.string().c_str(), ios::in | ios::out | ios::binary);
+            out.seekp(offsets[i]);
+            out.write(reinterpret_cast<const char*> (&counts[i]), sizeof (uint32_t));
+        }
+        EXPECT_THROW(mapPackedModelbase(p, feature), std::runtime_error);
+    }
+    bfs::remove(p);
+}
+
+TEST_F(persist, writeReadMatcherIndex) {
+    vector<Mat> train(1, model.allDescriptors);
+    MihMatcher trained;
+    trained.add(train);
+    trained.train();
+    bfs::path p = string(tmpnam(NULL));
+    ASSERT_TRUE(writeMatcherIndex(p, trained, feature));
+
+    MihMatcher restored;
+    restored.add(train);
+    ASSERT_TRUE(readMatcherIndex(p, restored, feature));
+
+    vector<vector<DMatch> > expected, actual;
+    trained.knnMatch(model.allDescriptors, expected, 2);
+    restored.knnMatch(model.allDescriptors, actual, 2);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ(expected[i].size(), actual[i].size());
+        for (size_t j = 0; j < expected[i].size(); j++) {
+            EXPECT_EQ(expected[i][j].trainIdx, actual[i][j].trainIdx);
+            EXPECT_EQ(expected[i][j].distance, actual[i][j].distance);
+        }
+    }
+    bfs::remove(p);
+}
+
+TEST_F(persist, matcherIndexStale) {
+    vector<Mat> train(1, model.allDescriptors);
+    MihMatcher trained;
+    trained.add(train);
+    trained.train();
+    bfs::path p = string(tmpnam(NULL));
+    ASSERT_TRUE(writeMatcherIndex(p, trained, feature));
+
+    // Other train descriptors.
+    Mat changed = model.allDescriptors.clone();
+    changed.at<uchar>(0, 0) ^= 1;
+    MihMatcher other;
+    other.add(vector<Mat>(1, changed));
+    EXPECT_FALSE(readMatcherIndex(p, other, feature));
+
+    // Other feature.
+    Feature otherFeature(new OrbFeatureDetector(100), new OrbDescriptorExtractor(100),
+            DescriptorMatcher::create("BruteForce-Hamming"));
+    MihMatcher restored;
+    restored.add(train);
+    EXPECT_FALSE(readMatcherIndex(p, restored, otherFeature));
+
+    // Other matcher parameters.
+    MihMatcher narrow(8);
+    narrow.add(train);
+    EXPECT_FALSE(readMatcherIndex(p, narrow, feature));
+    bfs::remove(p);
+}
+
+TEST_F(persist, matcherIndexUnsupported) {
+    BFMatcher matcher(NORM_HAMMING);
+    matcher.add(vector<Mat>(1, model.allDescriptors));
+    bfs::path p = string(tmpnam(NULL));
+    EXPECT_FALSE(writeMatcherIndex(p, matcher, feature));
+    EXPECT_FALSE(bfs::exists(p));
+    EXPECT_FALSE(readMatcherIndex(p, matcher, feature));
+}
+
+TEST_F(persist, detectorRestoresMatcherIndex) {
+    Modelbase modelbase(feature);
+    modelbase.add(model);
+    modelbase.add(PROJECT_BINARY_DIR + "/data/taco");
+    Feature mih(feature.detector, feature.extractor, new MihMatcher());
+    bfs::path p = string(tmpnam(NULL));
+
+    Detector first(modelbase, mih, new AcceptAllFilter(), 3.0, 1, MatchConfig(),
+            p.string());
+    ASSERT_TRUE(bfs::exists(p));
+    time_t written = bfs::last_write_time(p);
+    Detector second(modelbase, mih, new AcceptAllFilter(), 3.0, 1, MatchConfig(),
+            p.string());
+    EXPECT_EQ(written, bfs::last_write_time(p));
+
+    Scene scene = first.describe(
+            imread(PROJECT_BINARY_DIR + "/data/test/scene-blokus-taco-1.png"));
+    vector<Detection> expected = first.detect(scene);
+    vector<Detection> actual = second.detect(scene);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        EXPECT_EQ(expected[i].model->name, actual[i].model->name);
+        EXPECT_EQ(expected[i].inliers, actual[i].inliers);
+    }
+    bfs::remove(p);
+}
@@ -0,0 +1,364 @@
+#include "test.h"
+#include "tpofinder/configure.h"
+#include "tpofinder/provide.h"
+
+#include <boost/format.hpp>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <sstream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+using namespace cv;
+using namespace tpofinder;
+using namespace std;
+
+/** A stream buffer whose reads block until text is appended or it is closed,
+ * like the reading end of a pipe. */
+class PipeBuffer : public streambuf {
+public:
+
+    PipeBuffer() : closed_(false) {
+    }
+
+    void append(const string& text) {
+        lock_guard<mutex> lock(mutex_);
+        pending_ += text;
+        ready_.notify_all();
+    }
+
+    void close() {
+        lock_guard<mutex> lock(mutex_);
+        closed_ = true;
+        ready_.notify_all();
+    }
+
+protected:
+
+    virtual int underflow() {
+        unique_lock<mutex> lock(mutex_);
+        ready_.wait(lock, [&]() {
+            return closed_ || !pending_.empty();
+        });
+        if (pending_.empty()) {
+            return traits_type::eof();
+        }
+        current_.swap(pending_);
+        pending_.clear();
+        setg(&current_[0], &current_[0], &current_[0] + current_.size());
+        return traits_type::to_int_type(current_[0]);
+    }
+
+private:
+
+    mutex mutex_;
+    condition_variable ready_;
+    string pending_;
+    string current_;
+    bool closed_;
+
+};
+
+class provide : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        const char* names[] = {"taco/001.jpg", "taco/002.jpg", "missing.jpg",
+            "taco/003.jpg", "test/scene-blokus-taco-1.png", "taco/ref.jpg"};
+        for (size_t i = 0; i < sizeof (names) / sizeof (names[0]); i++) {
+            files.push_back(PROJECT_BINARY_DIR + "/data/" + names[i]);
+        }
+    }
+
+    /** Expects the provider to return the images in files, in order. */
+    void expectFiles(ImageProvider& provider) {
+        ListFilenameImageProvider reference(files);
+        Mat expected, actual;
+        for (size_t i = 0; i < files.size(); i++) {
+            ASSERT_TRUE(reference.next(expected));
+            ASSERT_TRUE(provider.next(actual));
+            EXPECT_EQ(files[i], provider.last_file());
+            EXPECT_EQ(reference.last_error(), provider.last_error());
+            ASSERT_EQ(expected.rows, actual.rows);
+            ASSERT_EQ(expected.cols, actual.cols);
+            if (!expected.empty()) {
+                EXPECT_EQ(0, norm(expected, actual, NORM_L1));
+            }
+        }
+        EXPECT_FALSE(provider.next(actual));
+        EXPECT_FALSE(reference.next(expected));
+    }
+
+    vector<string> files;
+
+    /** Puts a frame whose single pixel is its sequence number. */
+    bool put(FrameBuffer& buffer, int sequence) {
+        Mat image(1, 1, CV_32S, Scalar(sequence));
+        FrameInfo info;
+        info.sequence = sequence;
+        info.timestamp = sequence / 30.0;
+        return buffer.put(image, info);
+    }
+
+    /** Takes a frame and returns its pixel, or -1 if there is none. */
+    int take(FrameBuffer& buffer) {
+        Mat image;
+        FrameInfo info;
+        if (!buffer.take(image, info)) {
+            return -1;
+        }
+        EXPECT_EQ(info.sequence, image.at<int>(0, 0));
+        return image.at<int>(0, 0);
+    }
+
+};
+
+TEST_F(provide, latestReturnsNewestFrame) {
+    FrameBuffer buffer(FrameBuffer::LATEST);
+    for (int i = 0; i < 5; i++) {
+        put(buffer, i);
+    }
+    EXPECT_EQ(4, take(buffer));
+    EXPECT_EQ(4, buffer.dropped());
+    put(buffer, 5);
+    EXPECT_EQ(5, take(buffer));
+    EXPECT_EQ(4, buffer.dropped());
+}
+
+TEST_F(provide, latestKeepsTakenFrames) {
+    FrameBuffer buffer(FrameBuffer::LATEST);
+    vector<Mat> taken;
+    for (int i = 0; i < 10; i++) {
+        put(buffer, i);
+        Mat image;
+        FrameInfo info;
+        ASSERT_TRUE(buffer.take(image, info));
+        taken.push_back(image);
+    }
+    // Later frames are not captured into images handed out before.
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(i, taken[i].at<int>(0, 0));
+    }
+}
+
+TEST_F(provide, neverDropKeepsAllFrames) {
+    FrameBuffer buffer(FrameBuffer::NEVER_DROP, 2);
+    const int n = 1000;
+    thread producer([&]() {
+        for (int i = 0; i < n; i++) {
+            put(buffer, i);
+        }
+        buffer.close();
+    });
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQ(i, take(buffer));
+    }
+    EXPECT_EQ(-1, take(buffer));
+    producer.join();
+    EXPECT_EQ(0, buffer.dropped());
+}
+
+TEST_F(provide, queueDropsOldestFrames) {
+    FrameBuffer buffer(FrameBuffer::QUEUE, 3);
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(put(buffer, i));
+    }
+    EXPECT_EQ(2, buffer.dropped());
+    EXPECT_EQ(2, take(buffer));
+    EXPECT_EQ(3, take(buffer));
+    EXPECT_EQ(4, take(buffer));
+}
+
+TEST_F(provide, closeEndsBuffer) {
+    FrameBuffer buffer(FrameBuffer::LATEST);
+    put(buffer, 0);
+    buffer.close();
+    EXPECT_FALSE(put(buffer, 1));
+    EXPECT_EQ(0, take(buffer));
+    EXPECT_EQ(-1, take(buffer));
+}
+
+TEST_F(provide, latestConcurrentFramesIncrease) {
+    FrameBuffer buffer(FrameBuffer::LATEST);
+    const int n = 100000;
+    thread producer([&]() {
+        for (int i = 0; i < n; i++) {
+            put(buffer, i);
+        }
+        buffer.close();
+    });
+    int last = -1, taken = 0;
+    for (int frame = take(buffer); frame >= 0; frame = take(buffer)) {
+        ASSERT_GT(frame, last);
+        last = frame;
+        taken++;
+    }
+    producer.join();
+    EXPECT_EQ(n - 1, last);
+    EXPECT_EQ(n, taken + (int) buffer.dropped());
+}
+
+TEST_F(provide, listReportsUnreadableFiles) {
+    ListFilenameImageProvider provider(files);
+    Mat image;
+    for (size_t i = 0; i < files.size(); i++) {
+        ASSERT_TRUE(provider.next(image));
+        EXPECT_EQ(image.empty(), i == 2);
+        EXPECT_EQ(provider.last_error().empty(), i != 2);
+    }
+    EXPECT_FALSE(provider.next(image));
+}
+
+TEST_F(provide, prefetchKeepsOrder) {
+    PrefetchImageProvider provider(files, 4);
+    expectFiles(provider);
+}
+
+TEST_F(provide, prefetchWithinTinyBudget) {
+    // Only the next image may be decoded ahead.
+    PrefetchImageProvider provider(files, 3, 1);
+    expectFiles(provider);
+}
+
+TEST_F(provide, prefetchFromStream) {
+    stringstream names;
+    for (size_t i = 0; i < files.size(); i++) {
+        names << files[i] << "\n";
+    }
+    names << "\n" << files[0] << "\n";
+    PrefetchImageProvider provider(names, 2);
+    expectFiles(provider);
+}
+
+TEST_F(provide, prefetchFromOpenStream) {
+    // An image is returned as soon as it is decoded, even though the next
+    // name has not arrived yet.
+    PipeBuffer pipe;
+    istream names(&pipe);
+    PrefetchImageProvider provider(names, 2);
+    pipe.append(files[0] + "\n");
+    Mat image;
+    EXPECT_TRUE(provider.next(image));
+    EXPECT_EQ(files[0], provider.last_file());
+    pipe.append(files[1] + "\n");
+    EXPECT_TRUE(provider.next(image));
+    EXPECT_EQ(files[1], provider.last_file());
+    pipe.close();
+    EXPECT_FALSE(provider.next(image));
+}
+
+TEST_F(provide, prefetchStopsEarly) {
+    PrefetchImageProvider provider(files, 2);
+    Mat image;
+    EXPECT_TRUE(provider.next(image));
+}
+
+TEST_F(provide, readImageReduced) {
+    int reduction;
+    Mat full = read_image(files[0], DecodeOptions(), reduction);
+    ASSERT_FALSE(full.empty());
+    EXPECT_EQ(1, reduction);
+    EXPECT_EQ(3, full.channels());
+
+    Mat reduced = read_image(files[0], DecodeOptions(false, full.total() / 3),
+            reduction);
+    EXPECT_EQ(2, reduction);
+    EXPECT_EQ(full.cols / 2, reduced.cols);
+    EXPECT_EQ(full.rows / 2, reduced.rows);
+
+    read_image(files[0], DecodeOptions(false, 1), reduction);
+    EXPECT_EQ(8, reduction);
+}
+
+TEST_F(provide, readImageGrayscale) {
+    int reduction;
+    Mat gray = read_image(files[0], DecodeOptions(true), reduction);
+    ASSERT_FALSE(gray.empty());
+    EXPECT_EQ(1, gray.channels());
+}
+
+TEST_F(provide, providersReportReduction) {
+    DecodeOptions options(true, 10000);
+    ListFilenameImageProvider list(files, options);
+    PrefetchImageProvider prefetch(files, 2, 256 << 20, options);
+    Mat expected, actual;
+    while (list.next(expected)) {
+        ASSERT_TRUE(prefetch.next(actual));
+        EXPECT_EQ(list.last_reduction(), prefetch.last_reduction());
+        EXPECT_EQ(expected.cols, actual.cols);
+        if (!expected.empty()) {
+            EXPECT_GT(list.last_reduction(), 1);
+            EXPECT_EQ(1, actual.channels());
+        }
+    }
+}
+
+TEST_F(provide, videoFileStrideAndStart) {
+    string video = string(tmpnam(NULL)) + ".avi";
+    VideoWriter writer(video, CV_FOURCC('M', 'J', 'P', 'G'), 25, Size(64, 48));
+    if (!writer.isOpened()) {
+        // OpenCV has been built without a video encoder.
+        return;
+    }
+    for (int i = 0; i < 20; i++) {
+        writer << Mat(48, 64, CV_8UC3, Scalar::all(10 * i));
+    }
+    writer.release();
+
+    VideoFileImageProvider all(video);
+    EXPECT_NEAR(25, all.fps(), 1e-3);
+    Mat image;
+    FrameInfo info;
+    for (int i = 0; i < 20; i++) {
+        ASSERT_TRUE(all.next(image, info));
+        EXPECT_EQ(i, info.sequence);
+        EXPECT_NEAR(i / 25.0, info.position, 1e-3);
+        EXPECT_NEAR(10 * i, mean(image)[0], 3);
+    }
+    EXPECT_FALSE(all.next(image));
+
+    VideoFileImageProvider strided(video, 3, 2, DecodeOptions(true));
+    for (int i = 2; i < 20; i += 3) {
+        ASSERT_TRUE(strided.next(image, info));
+        EXPECT_EQ(i, info.sequence);
+        EXPECT_EQ(1, image.channels());
+        EXPECT_NEAR(10 * i, mean(image)[0], 3);
+    }
+    EXPECT_FALSE(strided.next(image));
+    remove(video.c_str());
+}
+
+TEST_F(provide, imageSequenceReductionPerFrame) {
+    // Small and large frames alternate; the decoder runs ahead of the
+    // consumer by several frames.
+    string base = tmpnam(NULL);
+    vector<string> names;
+    for (int i = 0; i < 6; i++) {
+        names.push_back(base + str(boost::format("-%02d.png") % i));
+        int scale = i % 2 == 0 ? 1 : 4;
+        ASSERT_TRUE(imwrite(names.back(),
+                Mat(48 * scale, 64 * scale, CV_8UC3, Scalar::all(10 * i))));
+    }
+
+    VideoFileImageProvider sequence(base + "-%02d.png", 1, 0,
+            DecodeOptions(false, 64 * 48), 8);
+    Mat image;
+    FrameInfo info;
+    for (int i = 0; i < 6; i++) {
+        ASSERT_TRUE(sequence.next(image, info));
+        int reduction = i % 2 == 0 ? 1 : 4;
+        EXPECT_EQ(reduction, info.reduction);
+        EXPECT_EQ(reduction, sequence.last_reduction());
+        EXPECT_EQ(64, image.cols);
+    }
+    EXPECT_FALSE(sequence.next(image));
+    for (size_t i = 0; i < names.size(); i++) {
+        remove(names[i].c_str());
+    }
+}
+
+TEST_F(provide, videoFileMissing) {
+    EXPECT_THROW(VideoFileImageProvider("missing.avi"), runtime_error);
+}
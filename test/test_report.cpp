@@ -0,0 +1,65 @@
+#include "test.h"
+#include "tpofinder/report.h"
+
+#include <memory>
+#include <sstream>
+
+using namespace cv;
+using namespace std;
+using namespace tpofinder;
+
+class report : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        shared_ptr<PlanarModel> model(new PlanarModel());
+        model->name = "taco, \"soft\"";
+        vector<DMatch> matches(3);
+        vector<int> inliers;
+        inliers.push_back(0);
+        inliers.push_back(2);
+        detections.push_back(Detection(model, Mat::eye(3, 3, CV_64F),
+                matches, inliers));
+
+        frame.frame = 7;
+        frame.file = "scene.png";
+        frame.decodeTime = 0.001;
+        frame.describeTime = 0.002;
+        frame.detectTime = 0.0035;
+    }
+
+    FrameReport frame;
+    vector<Detection> detections;
+
+};
+
+TEST_F(report, jsonLine) {
+    ostringstream out;
+    writeReportHeader(out, JSON_LINES);
+    writeReport(out, JSON_LINES, frame, detections);
+    EXPECT_EQ("{\"frame\":7,\"file\":\"scene.png\",\"decode_ms\":1.000,"
+            "\"describe_ms\":2.000,\"detect_ms\":3.500,\"detections\":["
+            "{\"model\":\"taco, \\\"soft\\\"\",\"matches\":3,\"inliers\":2,"
+            "\"homography\":[1,0,0,0,1,0,0,0,1]}]}\n", out.str());
+}
+
+TEST_F(report, jsonLineWithError) {
+    frame.error = "cannot read\n";
+    ostringstream out;
+    writeReport(out, JSON_LINES, frame, vector<Detection>());
+    EXPECT_EQ("{\"frame\":7,\"file\":\"scene.png\",\"error\":\"cannot read\\n\","
+            "\"decode_ms\":1.000,\"describe_ms\":2.000,\"detect_ms\":3.500,"
+            "\"detections\":[]}\n", out.str());
+}
+
+TEST_F(report, csvRows) {
+    ostringstream out;
+    writeReportHeader(out, CSV);
+    writeReport(out, CSV, frame, detections);
+    writeReport(out, CSV, frame, vector<Detection>());
+    EXPECT_EQ("frame,file,error,decode_ms,describe_ms,detect_ms,model,"
+            "matches,inliers,h00,h01,h02,h10,h11,h12,h20,h21,h22\n"
+            "7,scene.png,,1.000,2.000,3.500,\"taco, \"\"soft\"\"\",3,2,"
+            "1,0,0,0,1,0,0,0,1\n"
+            "7,scene.png,,1.000,2.000,3.500,,,,,,,,,,,,\n", out.str());
+}
@@ -0,0 +1,159 @@
+#include "test.h"
+#include "tpofinder/configure.h"
+#include "tpofinder/detect.h"
+#include "tpofinder/serve.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <cstring>
+#include <fstream>
+#include <opencv2/highgui/highgui.hpp>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace cv;
+using namespace tpofinder;
+using namespace std;
+namespace bfs = boost::filesystem;
+
+class serve : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        Modelbase models;
+        models.add(PROJECT_BINARY_DIR + "/data/taco");
+        models.add(PROJECT_BINARY_DIR + "/data/blokus");
+        detector = Detector(models);
+        image = imread(PROJECT_BINARY_DIR + "/data/test/scene-blokus-taco-1.png");
+        ASSERT_TRUE(imencode(".png", image, encoded));
+        // Socket paths are limited to about a hundred characters.
+        path = (bfs::temp_directory_path() / bfs::unique_path("tpofinder-%%%%%%.sock")).string();
+    }
+
+    /** Returns how often the model occurs in a reply. */
+    size_t count(const string& reply, const string& model) {
+        string key = "\"model\":\"" + model + "\"";
+        size_t n = 0;
+        for (size_t p = reply.find(key); p != string::npos; p = reply.find(key, p + 1)) {
+            n++;
+        }
+        return n;
+    }
+
+    Detector detector;
+    Mat image;
+    vector<uchar> encoded;
+    string path;
+
+};
+
+TEST_F(serve, detectEncodedImagesAndFrames) {
+    vector<Detection> expected = detector.detect(detector.describe(image));
+    ASSERT_GE(expected.size(), 1);
+
+    DetectionServer server(detector, path);
+    std::thread runner([&server]() {
+        server.run();
+    });
+    {
+        DetectionClient client(path);
+        string first = client.detect(encoded);
+        string second = client.detect(image);
+        EXPECT_EQ(0u, first.find("{\"frame\":0,"));
+        EXPECT_EQ(0u, second.find("{\"frame\":1,"));
+
+        BOOST_FOREACH(const Detection& d, expected) {
+            EXPECT_EQ(1u, count(first, d.model->name));
+            EXPECT_EQ(1u, count(second, d.model->name));
+        }
+
+        string invalid = client.detect(vector<uchar>(10, 'x'));
+        EXPECT_NE(string::npos, invalid.find("\"error\":"));
+    }
+    server.stop();
+    runner.join();
+    EXPECT_EQ(3u, server.stats().requests);
+}
+
+TEST_F(serve, concurrentRequestsAreBatched) {
+    ServerConfig config;
+    config.maxBatch = 4;
+    DetectionServer server(detector, path, config);
+    std::thread runner([&server]() {
+        server.run();
+    });
+
+    const int clients = 6, requests = 5;
+    vector<string> replies(clients * requests);
+    vector<std::thread> threads;
+    for (int c = 0; c < clients; c++) {
+        threads.push_back(std::thread([&, c]() {
+            DetectionClient client(path);
+            for (int r = 0; r < requests; r++) {
+                replies[c * requests + r] = client.detect(encoded);
+            }
+        }));
+    }
+
+    BOOST_FOREACH(std::thread& t, threads) {
+        t.join();
+    }
+    BOOST_FOREACH(const string& reply, replies) {
+        EXPECT_EQ(replies[0].substr(reply.find("\"detections\"")),
+                reply.substr(reply.find("\"detections\"")));
+    }
+
+    ServerStats stats = server.stats();
+    EXPECT_EQ(size_t(clients * requests), stats.requests);
+    EXPECT_LE(stats.batches, stats.requests);
+    EXPECT_EQ(0u, stats.queueDepth);
+    EXPECT_LE(stats.medianLatency, stats.maxLatency);
+    DetectionClient client(path);
+    EXPECT_EQ(0u, client.stats().find("{\"requests\":30,"));
+
+    server.stop();
+    runner.join();
+}
+
+TEST_F(serve, pathInUse) {
+    {
+        ofstream file(path.c_str());
+        file << "notes" << endl;
+    }
+    EXPECT_THROW(DetectionServer(detector, path), runtime_error);
+    EXPECT_TRUE(bfs::is_regular_file(path));
+    bfs::remove(path);
+
+    DetectionServer live(detector, path);
+    EXPECT_THROW(DetectionServer(detector, path), runtime_error);
+}
+
+TEST_F(serve, replacesStaleSocket) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof (address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof (address.sun_path) - 1);
+    int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_EQ(0, ::bind(stale, (sockaddr*) &address, sizeof (address)));
+    close(stale);
+    ASSERT_TRUE(bfs::exists(path));
+
+    DetectionServer server(detector, path);
+    std::thread runner([&server]() {
+        server.run();
+    });
+    {
+        DetectionClient client(path);
+        EXPECT_EQ(0u, client.stats().find("{\"requests\":0,"));
+    }
+    server.stop();
+    runner.join();
+}
+
+TEST_F(serve, noServer) {
+    EXPECT_THROW(DetectionClient client(path), runtime_error);
+}
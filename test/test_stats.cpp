@@ -0,0 +1,80 @@
+#include "test.h"
+#include "tpofinder/stats.h"
+
+#include <boost/foreach.hpp>
+#include <thread>
+#include <vector>
+
+using namespace tpofinder;
+using namespace std;
+
+class stats : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        // One to a thousand milliseconds.
+        for (int i = 1; i <= 1000; i++) {
+            uniform.record(i * 1e-3);
+        }
+    }
+
+    LatencyHistogram uniform;
+
+};
+
+TEST_F(stats, empty) {
+    LatencyHistogram h;
+    EXPECT_EQ(0u, h.count());
+    EXPECT_EQ(0, h.mean());
+    EXPECT_EQ(0, h.max());
+    EXPECT_EQ(0, h.quantile(0.5));
+}
+
+TEST_F(stats, meanAndMaximumAreExact) {
+    EXPECT_EQ(1000u, uniform.count());
+    EXPECT_NEAR(0.5005, uniform.mean(), 1e-9);
+    EXPECT_NEAR(1.0, uniform.max(), 1e-9);
+}
+
+TEST_F(stats, quantilesWithinRelativeError) {
+    double fractions[] = {0.01, 0.5, 0.9, 0.99, 1.0};
+    BOOST_FOREACH(double f, fractions) {
+        EXPECT_NEAR(f, uniform.quantile(f), 0.07 * f);
+    }
+    EXPECT_LE(uniform.quantile(0.5), uniform.quantile(0.9));
+}
+
+TEST_F(stats, clear) {
+    uniform.clear();
+    EXPECT_EQ(0u, uniform.count());
+    EXPECT_EQ(0, uniform.quantile(0.99));
+}
+
+TEST_F(stats, scopedTimerAddsAndRecords) {
+    LatencyHistogram h;
+    double seconds = 1;
+    {
+        ScopedTimer timer(seconds, &h);
+        this_thread::sleep_for(chrono::milliseconds(2));
+    }
+    EXPECT_GE(seconds, 1.002);
+    ASSERT_EQ(1u, h.count());
+    EXPECT_NEAR(seconds - 1, h.max(), 1e-3);
+}
+
+TEST_F(stats, concurrentRecording) {
+    LatencyHistogram h;
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.push_back(thread([&h]() {
+            for (int i = 0; i < 10000; i++) {
+                h.record(1e-4);
+            }
+        }));
+    }
+    BOOST_FOREACH(thread& t, threads) {
+        t.join();
+    }
+    EXPECT_EQ(40000u, h.count());
+    EXPECT_NEAR(1e-4, h.quantile(0.5), 7e-6);
+}
@@ -175,3 +175,17 @@ TEST_F(util, identityPlusNoiseInliersSymmetric) {
     vector<int> inliers2 = findInliers(iPts2, iPts1, EYE_HOMOGRAPHY);
     EXPECT_EQ(inliers.size(), inliers2.size());
 }
+
+TEST_F(util, createAligned) {
+    for (int rows = 1; rows < 20; rows++) {
+        Mat m = createAligned(rows, 32, CV_8UC1);
+        EXPECT_EQ(m.rows, rows);
+        EXPECT_EQ(m.cols, 32);
+        EXPECT_EQ(m.type(), CV_8UC1);
+        EXPECT_TRUE(m.isContinuous());
+        EXPECT_EQ((size_t) m.data % 64, 0);
+    }
+    Mat f = createAligned(7, 128, CV_32FC1, 32);
+    EXPECT_EQ(f.type(), CV_32FC1);
+    EXPECT_EQ((size_t) f.data % 32, 0);
+}
@@ -0,0 +1,101 @@
+#include "test.h"
+#include "tpofinder/configure.h"
+#include "tpofinder/model.h"
+#include "tpofinder/vocabulary.h"
+
+#include <algorithm>
+#include <boost/foreach.hpp>
+#include <cmath>
+
+using namespace cv;
+using namespace tpofinder;
+
+class vocabulary : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        modelbase.add(PROJECT_BINARY_DIR + "/data/adapter");
+        modelbase.add(PROJECT_BINARY_DIR + "/data/blokus");
+        modelbase.add(PROJECT_BINARY_DIR + "/data/stockholm");
+        modelbase.add(PROJECT_BINARY_DIR + "/data/taco");
+        modelbase.add(PROJECT_BINARY_DIR + "/data/tea");
+
+        BOOST_FOREACH(const PlanarModel& m, modelbase.models) {
+            documents.push_back(m.allDescriptors);
+        }
+        tree = VocabularyTree(4, 3);
+        tree.build(documents);
+    }
+
+    Modelbase modelbase;
+    vector<Mat> documents;
+    VocabularyTree tree;
+
+};
+
+TEST_F(vocabulary, emptyUntilBuilt) {
+    VocabularyTree t;
+    EXPECT_TRUE(t.empty());
+    t.build(vector<Mat>());
+    EXPECT_TRUE(t.empty());
+    EXPECT_FALSE(tree.empty());
+}
+
+TEST_F(vocabulary, wordsBoundedByTreeSize) {
+    EXPECT_GT(tree.words(), 1);
+    EXPECT_LE(tree.words(), 4 * 4 * 4);
+}
+
+TEST_F(vocabulary, quantizeWithinWords) {
+    for (int r = 0; r < documents[0].rows; r++) {
+        int w = tree.quantize(documents[0].ptr(r));
+        EXPECT_GE(w, 0);
+        EXPECT_LT(w, tree.words());
+    }
+}
+
+TEST_F(vocabulary, buildIsDeterministic) {
+    VocabularyTree other(4, 3);
+    other.build(documents);
+    ASSERT_EQ(tree.words(), other.words());
+    for (int r = 0; r < documents[1].rows; r++) {
+        EXPECT_EQ(tree.quantize(documents[1].ptr(r)),
+                other.quantize(documents[1].ptr(r)));
+    }
+}
+
+TEST_F(vocabulary, transformIsNormalized) {
+    BowVector bow = tree.transform(documents[2]);
+    ASSERT_FALSE(bow.empty());
+    double sum = 0;
+    for (size_t i = 0; i < bow.size(); i++) {
+        EXPECT_GT(bow[i].second, 0);
+        if (i > 0) {
+            EXPECT_LT(bow[i - 1].first, bow[i].first);
+        }
+        sum += bow[i].second;
+    }
+    EXPECT_NEAR(sum, 1.0, 1e-5);
+}
+
+TEST_F(vocabulary, modelsAreMostSimilarToThemselves) {
+    VocabularyTree fine(10, 4);
+    fine.build(documents);
+    InvertedFile file;
+    for (size_t i = 0; i < documents.size(); i++) {
+        file.add(i, fine.transform(documents[i]));
+    }
+    for (size_t i = 0; i < documents.size(); i++) {
+        vector<float> scores(documents.size(), 0);
+        file.score(fine.transform(documents[i]), scores);
+        EXPECT_EQ(i, max_element(scores.begin(), scores.end()) - scores.begin());
+        EXPECT_NEAR(scores[i], 1.0, 1e-4);
+    }
+}
+
+TEST_F(vocabulary, samplesLimitClustering) {
+    VocabularyTree sampled(4, 3, 10, 100);
+    sampled.build(documents);
+    EXPECT_FALSE(sampled.empty());
+    EXPECT_LE(sampled.words(), 64);
+}